@@ -9,17 +9,65 @@ DEPENDPATH += ../includes ../common
 PRECOMPILED_HEADER = stable.h
 precompile_header:!isEmpty(PRECOMPILED_HEADER):DEFINES += USING_PCH
 QT += network webkit
+win32:LIBS += -lpsapi
 
 HEADERS = stable.h \
     globals.h \
+    certificatecache.h \
+    commandline.h \
+    daemon.h \
+    httpconnection.h \
+    jobjournal.h \
+    jobqueue.h \
+    json.h \
+    loadoptions.h \
+    metrics.h \
+    networkmanager.h \
     printhtml.h \
-    restserver.h
+    printercache.h \
+    printerregistry.h \
+    printoptions.h \
+    processmemory.h \
+    rasterwriter.h \
+    rendercache.h \
+    resourcepolicy.h \
+    restserver.h \
+    spooldirectory.h \
+    stdinrunner.h \
+    trace.h \
+    webpagepool.h \
+    workerpool.h
 SOURCES = main.cpp \
+    certificatecache.cpp \
+    commandline.cpp \
+    daemon.cpp \
+    httpconnection.cpp \
+    jobjournal.cpp \
+    jobqueue.cpp \
+    json.cpp \
+    metrics.cpp \
+    networkmanager.cpp \
     printhtml.cpp \
-    restserver.cpp
+    printercache.cpp \
+    printerregistry.cpp \
+    processmemory.cpp \
+    rasterwriter.cpp \
+    rendercache.cpp \
+    resourcepolicy.cpp \
+    restserver.cpp \
+    spooldirectory.cpp \
+    stdinrunner.cpp \
+    trace.cpp \
+    webpagepool.cpp \
+    workerpool.cpp
 FORMS =
 RESOURCES =
 
+# "make benchmark" builds the benchmark in bench/ and runs it against this build
+benchmark.commands = cd bench && $(QMAKE) bench.pro && $(MAKE) && ./printhtml-bench -o results.json
+benchmark.depends = $(TARGET)
+QMAKE_EXTRA_TARGETS += benchmark
+
 DISTFILES += \
     LICENSE \
     README.md \
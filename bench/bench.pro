@@ -0,0 +1,18 @@
+# -------------------------------------------------
+# QMake project for the PrintHtml benchmark
+# -------------------------------------------------
+TARGET = printhtml-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+QT += network
+
+INCLUDEPATH += ..
+
+HEADERS = fixtureserver.h \
+    loadrunner.h \
+    ../json.h
+SOURCES = main.cpp \
+    fixtureserver.cpp \
+    loadrunner.cpp \
+    ../json.cpp
@@ -0,0 +1,169 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "fixtureserver.h"
+#include <QTcpSocket>
+#include <QImage>
+#include <QPainter>
+#include <QBuffer>
+#include <QColor>
+#include <QLinearGradient>
+
+/*
+ * Build a gradient PNG standing in for a logo or product photo. The gradient
+ * keeps the image from compressing down to nothing.
+ */
+static QByteArray makeImage(
+    int width,
+    int height,
+    const QColor &color)
+{
+    QImage image(width, height, QImage::Format_RGB32);
+    QLinearGradient gradient(0, 0, width, height);
+    gradient.setColorAt(0, color);
+    gradient.setColorAt(1, Qt::white);
+    QPainter painter(&image);
+    painter.fillRect(image.rect(), gradient);
+    painter.end();
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "PNG");
+    return data;
+}
+
+/*
+ * Constructor for the fixture server. Builds all the pages up front.
+ */
+FixtureServer::FixtureServer(
+    QObject *parent)
+    : QObject(parent)
+{
+    connect(&server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+
+    addPage("/style.css", "text/css",
+            "body { font-family: sans-serif; font-size: 10pt; }\n"
+            "table { border-collapse: collapse; width: 100%; }\n"
+            "td, th { border: 1px solid #888; padding: 2px 4px; }\n"
+            ".grid img { width: 30%; margin: 1%; }\n");
+    addPage("/logo.png", "image/png", makeImage(240, 80, QColor(40, 80, 160)));
+
+    // Near empty page, so a command line run measures little but start up
+    addPage("/blank.html", "text/html", "<html><body>PrintHtml</body></html>");
+
+    // Simple packing slip
+    QByteArray slip = "<html><head><link rel='stylesheet' href='/style.css'></head><body>"
+                      "<img src='/logo.png'><h2>Packing Slip #100042</h2>"
+                      "<p>Ship to: Jane Doe, 1 Main Street, Springfield</p><table>"
+                      "<tr><th>SKU</th><th>Item</th><th>Qty</th></tr>";
+    for (int i = 1; i <= 5; i++)
+        slip += "<tr><td>SKU-" + QByteArray::number(i) + "</td><td>Item " + QByteArray::number(i) + "</td><td>1</td></tr>";
+    slip += "</table></body></html>";
+    addPage("/slip.html", "text/html", slip);
+
+    // Image heavy catalog page
+    QByteArray catalog = "<html><head><link rel='stylesheet' href='/style.css'></head><body>"
+                         "<img src='/logo.png'><h2>Catalog</h2><div class='grid'>";
+    for (int i = 0; i < 24; i++) {
+        QByteArray path = "/img/" + QByteArray::number(i) + ".png";
+        addPage(path, "image/png", makeImage(400, 400, QColor::fromHsv((i * 15) % 360, 160, 200)));
+        catalog += "<img src='" + path + "'>";
+    }
+    catalog += "</div></body></html>";
+    addPage("/catalog.html", "text/html", catalog);
+
+    // Multi page invoice
+    QByteArray invoice = "<html><head><link rel='stylesheet' href='/style.css'></head><body>"
+                         "<img src='/logo.png'><h2>Invoice #2024-0042</h2><table>"
+                         "<tr><th>Line</th><th>Description</th><th>Qty</th><th>Price</th></tr>";
+    for (int i = 1; i <= 300; i++) {
+        invoice += "<tr><td>" + QByteArray::number(i) + "</td><td>Part number " + QByteArray::number(1000 + i) +
+                   "</td><td>" + QByteArray::number(i % 7 + 1) + "</td><td>" + QByteArray::number(i * 1.25, 'f', 2) + "</td></tr>";
+    }
+    invoice += "</table></body></html>";
+    addPage("/invoice.html", "text/html", invoice);
+}
+
+/*
+ * Start listening on a free port on the loopback interface
+ */
+bool FixtureServer::start()
+{
+    return server.listen(QHostAddress::LocalHost, 0);
+}
+
+/*
+ * Full URL for one of our pages
+ */
+QString FixtureServer::url(
+    const QString &path) const
+{
+    return QString("http://127.0.0.1:%1%2").arg(server.serverPort()).arg(path);
+}
+
+void FixtureServer::addPage(
+    const QString &path,
+    const QByteArray &type,
+    const QByteArray &body)
+{
+    pages.insert(path, qMakePair(type, body));
+}
+
+void FixtureServer::newConnection()
+{
+    while (QTcpSocket *socket = server.nextPendingConnection()) {
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+/*
+ * Answer GET requests, one per connection. Requests are tiny, so we simply
+ * wait until the whole header has arrived.
+ */
+void FixtureServer::readRequest()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket)
+        return;
+    QByteArray request = socket->peek(socket->bytesAvailable());
+    if (!request.contains("\r\n\r\n"))
+        return;
+    socket->readAll();
+
+    QString path = QString::fromLatin1(request.split(' ').value(1)).section('?', 0, 0);
+    QByteArray resp;
+    if (pages.contains(path)) {
+        QPair<QByteArray, QByteArray> page = pages.value(path);
+        resp = "HTTP/1.1 200 OK\r\nContent-Type: " + page.first + "\r\n";
+        resp += "Cache-Control: no-cache\r\n";
+        resp += "Content-Length: " + QByteArray::number(page.second.size()) + "\r\n";
+        resp += "Connection: close\r\n\r\n" + page.second;
+    } else {
+        resp = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    socket->write(resp);
+    socket->disconnectFromHost();
+}
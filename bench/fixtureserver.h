@@ -0,0 +1,62 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FIXTURESERVER_H
+#define FIXTURESERVER_H
+
+#include <QTcpServer>
+#include <QHash>
+#include <QByteArray>
+
+/*
+ * Local HTTP server with the pages the benchmark prints, so it runs offline
+ * and every run sees exactly the same content:
+ *
+ *   /blank.html    - Near empty page, for measuring start up time
+ *   /slip.html     - Simple packing slip with a style sheet and a logo
+ *   /catalog.html  - Catalog page with 24 product images
+ *   /invoice.html  - Invoice long enough to span several pages
+ */
+class FixtureServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FixtureServer(QObject *parent = 0);
+
+    bool start();
+    QString url(const QString &path) const;
+
+private slots:
+    void newConnection();
+    void readRequest();
+
+private:
+    void addPage(const QString &path, const QByteArray &type, const QByteArray &body);
+
+    QTcpServer      server;
+    QHash<QString, QPair<QByteArray, QByteArray> > pages; // Content type and body, by path
+};
+
+#endif // FIXTURESERVER_H
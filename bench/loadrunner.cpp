@@ -0,0 +1,342 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "loadrunner.h"
+#include "json.h"
+#include <QProcess>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTimer>
+#include <QDir>
+#include <QFile>
+#include <QQueue>
+#include <QHash>
+#include <QNetworkAccessManager>
+#include <QNetworkRequest>
+#include <QNetworkReply>
+#include <QUrl>
+#include <QCoreApplication>
+#include <qalgorithms.h>
+
+/*
+ * Constructor for the load runner
+ *
+ * PARAMETERS:
+ * program  - Path to the PrintHtml binary to benchmark
+ */
+LoadRunner::LoadRunner(
+    const QString &program,
+    QObject *parent)
+    : QObject(parent), program(program), peakRss(0)
+{
+    network = new QNetworkAccessManager(this);
+}
+
+/*
+ * Resident memory of a process and all of its children, in KB. Only Linux
+ * exposes this cheaply, other platforms report zero.
+ */
+static qint64 processTreeRss(
+    qint64 pid)
+{
+#ifdef Q_OS_LINUX
+    qint64 total = 0;
+    QFile status(QString("/proc/%1/status").arg(pid));
+    if (status.open(QIODevice::ReadOnly)) {
+        foreach (const QByteArray &line, status.readAll().split('\n')) {
+            if (line.startsWith("VmRSS:"))
+                total += line.mid(6).trimmed().split(' ').value(0).toLongLong();
+        }
+    }
+    // Add worker processes started by a server
+    foreach (const QString &entry, QDir("/proc").entryList(QDir::Dirs)) {
+        bool isPid;
+        qint64 child = entry.toLongLong(&isPid);
+        if (!isPid || child == pid)
+            continue;
+        QFile stat(QString("/proc/%1/stat").arg(child));
+        if (!stat.open(QIODevice::ReadOnly))
+            continue;
+        QByteArray data = stat.readAll();
+        QList<QByteArray> fields = data.mid(data.lastIndexOf(')') + 2).split(' ');
+        if (fields.value(1).toLongLong() == pid)
+            total += processTreeRss(child);
+    }
+    return total;
+#else
+    Q_UNUSED(pid);
+    return 0;
+#endif
+}
+
+/*
+ * Record the combined memory of the running processes if it is a new peak
+ */
+void LoadRunner::sampleMemory(
+    const QList<qint64> &pids)
+{
+    qint64 total = 0;
+    foreach (qint64 pid, pids)
+        total += processTreeRss(pid);
+    peakRss = qMax(peakRss, total);
+}
+
+/*
+ * Turn the latencies of a run into the numbers we report
+ *
+ * PARAMETERS:
+ * latencies    - Seconds from submission to completion for each successful job
+ * failures     - Number of jobs that failed
+ * seconds      - Wall clock time for the whole run
+ */
+QVariantMap LoadRunner::summarize(
+    const QList<double> &latencies,
+    int failures,
+    double seconds) const
+{
+    QList<double> sorted = latencies;
+    qSort(sorted);
+    QVariantMap result;
+    result.insert("jobs", sorted.size() + failures);
+    result.insert("failures", failures);
+    result.insert("seconds", seconds);
+    result.insert("jobsPerSecond", seconds > 0 ? sorted.size() / seconds : 0.0);
+    static const int percentiles[] = { 50, 95, 99 };
+    for (int i = 0; i < 3; i++) {
+        double value = 0;
+        if (!sorted.isEmpty()) {
+            int rank = qMin(sorted.size() - 1, (sorted.size() * percentiles[i] + 99) / 100 - 1);
+            value = sorted.at(qMax(0, rank));
+        }
+        result.insert(QString("p%1").arg(percentiles[i]), value);
+    }
+    result.insert("peakRssKb", peakRss);
+    return result;
+}
+
+/*
+ * Run the given number of command line jobs, keeping up to concurrency
+ * PrintHtml processes running at once. Each process pays the full start up
+ * cost, which is what this mode measures. Every run passes -nodaemon so a
+ * resident daemon can't take the jobs over.
+ *
+ * PARAMETERS:
+ *     pdf      Print each job to a PDF file in a temporary spool directory
+ *              instead of running in test mode, so layout and printing are
+ *              measured too. The render cache is off so every job prints.
+ */
+QVariantMap LoadRunner::runCommandLine(
+    const QString &url,
+    int jobs,
+    int concurrency,
+    bool pdf)
+{
+    QStringList args;
+    args << "-nodaemon" << "-json";
+    QDir spool(QDir::temp().filePath(QString("printhtml-bench-spool-%1").arg(QCoreApplication::applicationPid())));
+    if (pdf) {
+        QDir::temp().mkpath(spool.dirName());
+        args << "-output" << "pdf" << "-spooldir" << spool.absolutePath() << "-rendercache" << "0";
+    } else {
+        args << "-test";
+    }
+    args << url;
+
+    peakRss = 0;
+    QList<double> latencies;
+    int failures = 0;
+    int started = 0;
+    QHash<QProcess*, qint64> running;   // Start time of each running process
+    QElapsedTimer clock;
+    clock.start();
+
+    while (started < jobs || !running.isEmpty()) {
+        while (started < jobs && running.size() < concurrency) {
+            QProcess *process = new QProcess(this);
+            process->start(program, args);
+            running.insert(process, clock.elapsed());
+            started++;
+        }
+
+        // Wait a little, sampling memory while the processes run
+        QEventLoop loop;
+        QTimer::singleShot(20, &loop, SLOT(quit()));
+        loop.exec();
+        QList<qint64> pids;
+        foreach (QProcess *process, running.keys())
+            pids.append(process->pid());
+        sampleMemory(pids);
+
+        foreach (QProcess *process, running.keys()) {
+            if (process->state() != QProcess::NotRunning)
+                continue;
+            double latency = (clock.elapsed() - running.take(process)) / 1000.0;
+            QVariantMap output = Json::parse(process->readAllStandardOutput()).toMap();
+            if (process->exitStatus() == QProcess::NormalExit && process->exitCode() == 0 &&
+                    output.value("error").toList().isEmpty())
+                latencies.append(latency);
+            else
+                failures++;
+            process->deleteLater();
+        }
+    }
+
+    if (pdf) {
+        foreach (const QString &file, spool.entryList(QDir::Files))
+            spool.remove(file);
+        QDir::temp().rmdir(spool.dirName());
+    }
+    return summarize(latencies, failures, clock.elapsed() / 1000.0);
+}
+
+/*
+ * Issue one request to the server under test and return the parsed JSON
+ * response. An empty map means the request failed.
+ */
+QVariantMap LoadRunner::request(
+    const QByteArray &method,
+    const QString &url,
+    const QByteArray &body)
+{
+    QNetworkRequest req(url);
+    req.setHeader(QNetworkRequest::ContentTypeHeader, "application/x-www-form-urlencoded");
+    QNetworkReply *reply = method == "POST" ? network->post(req, body) : network->get(req);
+    QEventLoop loop;
+    connect(reply, SIGNAL(finished()), &loop, SLOT(quit()));
+    loop.exec();
+    QVariantMap result;
+    if (reply->error() == QNetworkReply::NoError)
+        result = Json::parse(reply->readAll()).toMap();
+    reply->deleteLater();
+    return result;
+}
+
+/*
+ * Wait for a freshly started server to answer /status
+ */
+bool LoadRunner::waitForServer(
+    quint16 port,
+    int timeoutMs)
+{
+    QElapsedTimer clock;
+    clock.start();
+    while (clock.elapsed() < timeoutMs) {
+        if (!request("GET", QString("http://127.0.0.1:%1/status").arg(port)).isEmpty())
+            return true;
+        QEventLoop loop;
+        QTimer::singleShot(100, &loop, SLOT(quit()));
+        loop.exec();
+    }
+    return false;
+}
+
+/*
+ * Start PrintHtml as a REST server and push the given number of jobs through
+ * it, keeping up to concurrency jobs in flight. Every job goes to its own
+ * printer name so jobs are not serialized behind one printer.
+ */
+QVariantMap LoadRunner::runServer(
+    const QString &url,
+    int jobs,
+    int concurrency,
+    int workers,
+    bool journal)
+{
+    static quint16 port = 18080;
+    port++;
+    QStringList args;
+    args << "-server" << QString::number(port) << "-test"
+         << "-poolsize" << QString::number(concurrency);
+    if (workers > 0)
+        args << "-workers" << QString::number(workers);
+    QString journalFile = QDir::temp().filePath(QString("printhtml-bench-%1.journal").arg(port));
+    if (journal) {
+        QFile::remove(journalFile);
+        args << "-journal" << journalFile;
+    }
+    QProcess server;
+    server.setProcessChannelMode(QProcess::ForwardedChannels);
+    server.start(program, args);
+    if (!waitForServer(port, 30000)) {
+        server.kill();
+        server.waitForFinished();
+        QVariantMap result;
+        result.insert("error", "server did not start");
+        return result;
+    }
+
+    peakRss = 0;
+    QString base = QString("http://127.0.0.1:%1").arg(port);
+    QByteArray encodedUrl = QUrl::toPercentEncoding(url);
+    QList<double> latencies;
+    int failures = 0;
+    int submitted = 0;
+    QHash<int, qint64> inFlight;    // Submission time of each job id
+    QElapsedTimer clock;
+    clock.start();
+
+    while (submitted < jobs || !inFlight.isEmpty()) {
+        while (submitted < jobs && inFlight.size() < concurrency) {
+            QByteArray body = "url=" + encodedUrl + "&p=bench" + QByteArray::number(submitted % concurrency);
+            qint64 at = clock.elapsed();
+            QVariantMap job = request("POST", base + "/print", body);
+            submitted++;
+            if (job.contains("id"))
+                inFlight.insert(job.value("id").toInt(), at);
+            else
+                failures++;
+        }
+
+        QEventLoop loop;
+        QTimer::singleShot(20, &loop, SLOT(quit()));
+        loop.exec();
+        sampleMemory(QList<qint64>() << server.pid());
+
+        foreach (int id, inFlight.keys()) {
+            QVariantMap job = request("GET", base + "/jobs/" + QString::number(id));
+            QString status = job.value("status").toString();
+            if (status == "completed") {
+                latencies.append((clock.elapsed() - inFlight.take(id)) / 1000.0);
+            } else if (status == "failed" || job.isEmpty()) {
+                inFlight.remove(id);
+                failures++;
+            }
+        }
+    }
+    QVariantMap result = summarize(latencies, failures, clock.elapsed() / 1000.0);
+    if (journal) {
+        // What keeping the journal cost: how many commits, and how long they took
+        QVariantMap stats = request("GET", base + "/status").value("journal").toMap();
+        result.insert("journalCommits", stats.value("commits"));
+        result.insert("journalRecordsPerCommit", stats.value("recordsPerCommit"));
+        result.insert("journalCommitSeconds", stats.value("commitSeconds"));
+    }
+
+    server.kill();
+    server.waitForFinished();
+    if (journal)
+        QFile::remove(journalFile);
+    return result;
+}
@@ -0,0 +1,63 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LOADRUNNER_H
+#define LOADRUNNER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QVariantMap>
+#include <QList>
+
+class QProcess;
+class QNetworkAccessManager;
+
+/*
+ * Drives a PrintHtml binary with a fixed number of jobs at a given
+ * concurrency, and reports throughput, latency percentiles and peak memory.
+ * Jobs run in test mode or print to PDF files, so the benchmark needs no
+ * printer.
+ */
+class LoadRunner : public QObject
+{
+    Q_OBJECT
+public:
+    LoadRunner(const QString &program, QObject *parent = 0);
+
+    QVariantMap runCommandLine(const QString &url, int jobs, int concurrency, bool pdf = false);
+    QVariantMap runServer(const QString &url, int jobs, int concurrency, int workers, bool journal = false);
+
+private:
+    QVariantMap summarize(const QList<double> &latencies, int failures, double seconds) const;
+    void sampleMemory(const QList<qint64> &pids);
+    bool waitForServer(quint16 port, int timeoutMs);
+    QVariantMap request(const QByteArray &method, const QString &url, const QByteArray &body = QByteArray());
+
+    QString         program;        // PrintHtml binary under test
+    qint64          peakRss;        // Largest resident set seen so far, in KB
+    QNetworkAccessManager *network;
+};
+
+#endif // LOADRUNNER_H
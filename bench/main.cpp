@@ -0,0 +1,144 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <stdio.h>
+#include "fixtureserver.h"
+#include "loadrunner.h"
+#include "json.h"
+
+/*
+ * Find the PrintHtml binary next to the benchmark if we were not told where
+ * it is
+ */
+static QString defaultProgram()
+{
+    QDir dir(QCoreApplication::applicationDirPath());
+    QStringList candidates;
+    candidates << "../PrintHtml" << "../release/PrintHtml.exe" << "../debug/PrintHtml.exe"
+               << "../../PrintHtml" << "../../release/PrintHtml.exe";
+    foreach (const QString &candidate, candidates) {
+        if (QFileInfo(dir.filePath(candidate)).isExecutable())
+            return QFileInfo(dir.filePath(candidate)).canonicalFilePath();
+    }
+    return "PrintHtml";
+}
+
+/*
+ * Main entry point for the benchmark. Prints one JSON document with a result
+ * for every page, mode and concurrency level.
+ */
+int main(
+    int argc,
+    char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QString program = defaultProgram();
+    QString output;
+    QStringList modes;
+    modes << "cli" << "pdf" << "server" << "journal";
+    QStringList pages;
+    pages << "slip" << "catalog" << "invoice";
+    QList<int> levels;
+    levels << 1 << 4 << 8;
+    int jobs = 40;
+    int workers = 0;
+
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); i++) {
+        QString arg = args.at(i);
+        if (arg == "-printhtml" && i + 1 < args.size())
+            program = args.at(++i);
+        else if (arg == "-jobs" && i + 1 < args.size())
+            jobs = args.at(++i).toInt();
+        else if (arg == "-concurrency" && i + 1 < args.size()) {
+            levels.clear();
+            foreach (const QString &level, args.at(++i).split(',', QString::SkipEmptyParts))
+                levels << qMax(1, level.toInt());
+        } else if (arg == "-modes" && i + 1 < args.size())
+            modes = args.at(++i).split(',', QString::SkipEmptyParts);
+        else if (arg == "-pages" && i + 1 < args.size())
+            pages = args.at(++i).split(',', QString::SkipEmptyParts);
+        else if (arg == "-workers" && i + 1 < args.size())
+            workers = args.at(++i).toInt();
+        else if (arg == "-o" && i + 1 < args.size())
+            output = args.at(++i);
+        else {
+            fprintf(stderr,
+                    "Usage: printhtml-bench [-printhtml path] [-jobs number] [-concurrency 1,4,8]\n"
+                    "                       [-modes cli,pdf,server,journal] [-pages blank,slip,catalog,invoice]\n"
+                    "                       [-workers number] [-o results.json]\n");
+            return 1;
+        }
+    }
+
+    FixtureServer fixtures;
+    if (!fixtures.start()) {
+        fprintf(stderr, "Unable to start the fixture server\n");
+        return 1;
+    }
+
+    LoadRunner runner(program);
+    QVariantList results;
+    foreach (const QString &page, pages) {
+        QString url = fixtures.url("/" + page + ".html");
+        foreach (const QString &mode, modes) {
+            foreach (int concurrency, levels) {
+                fprintf(stderr, "%s %s x%d...\n", qPrintable(page), qPrintable(mode), concurrency);
+                QVariantMap result;
+                if (mode == "server" || mode == "journal")
+                    result = runner.runServer(url, jobs, concurrency, workers, mode == "journal");
+                else
+                    result = runner.runCommandLine(url, jobs, concurrency, mode == "pdf");
+                result.insert("page", page);
+                result.insert("mode", mode);
+                result.insert("concurrency", concurrency);
+                if (mode == "server" || mode == "journal")
+                    result.insert("workers", workers);
+                results.append(result);
+            }
+        }
+    }
+
+    QVariantMap report;
+    report.insert("printhtml", program);
+    report.insert("results", results);
+    QByteArray json = Json::stringify(report) + "\n";
+    if (output.isEmpty()) {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    } else {
+        QFile file(output);
+        if (!file.open(QIODevice::WriteOnly)) {
+            fprintf(stderr, "Unable to write %s\n", qPrintable(output));
+            return 1;
+        }
+        file.write(json);
+    }
+    return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "certificatecache.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QDataStream>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QCoreApplication>
+
+static const quint32 cacheMagic = 0x50484341;  // "PHCA"
+static const quint32 cacheVersion = 1;
+
+/*
+ * Load the certificates in a CA bundle, using the binary cache if it matches
+ * the bundle and rebuilding it if not
+ *
+ * PARAMETERS:
+ * bundlePath   - PEM bundle to load
+ * cachePath    - File to keep the binary copy in
+ */
+QList<QSslCertificate> CertificateCache::load(
+    const QString &bundlePath,
+    const QString &cachePath)
+{
+    QList<QSslCertificate> certificates;
+    QFile bundle(bundlePath);
+    if (!bundle.open(QIODevice::ReadOnly))
+        return certificates;
+    QByteArray pem = bundle.readAll();
+    bundle.close();
+
+    // Hashing the bundle is cheap next to parsing it
+    QDateTime modified = QFileInfo(bundlePath).lastModified();
+    QByteArray hash = QCryptographicHash::hash(pem, QCryptographicHash::Sha1);
+    if (readCache(cachePath, modified, hash, &certificates))
+        return certificates;
+
+    certificates = QSslCertificate::fromData(pem, QSsl::Pem);
+    writeCache(cachePath, modified, hash, certificates);
+    return certificates;
+}
+
+/*
+ * Read the binary cache, if it was made from this version of the bundle
+ */
+bool CertificateCache::readCache(
+    const QString &cachePath,
+    const QDateTime &modified,
+    const QByteArray &hash,
+    QList<QSslCertificate> *certificates)
+{
+    QFile file(cachePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_4_8);
+    quint32 magic, version;
+    QDateTime cachedModified;
+    QByteArray cachedHash;
+    QList<QByteArray> ders;
+    in >> magic >> version;
+    if (magic != cacheMagic || version != cacheVersion)
+        return false;
+    in >> cachedModified >> cachedHash >> ders;
+    if (in.status() != QDataStream::Ok || cachedModified != modified || cachedHash != hash)
+        return false;
+
+    certificates->clear();
+    foreach (const QByteArray &der, ders) {
+        QSslCertificate certificate(der, QSsl::Der);
+        if (certificate.isNull())
+            return false;
+        certificates->append(certificate);
+    }
+    return true;
+}
+
+/*
+ * Write the certificates out in DER form. The file is written under a
+ * temporary name and renamed, so a concurrent run never sees half a cache.
+ */
+void CertificateCache::writeCache(
+    const QString &cachePath,
+    const QDateTime &modified,
+    const QByteArray &hash,
+    const QList<QSslCertificate> &certificates)
+{
+    QDir().mkpath(QFileInfo(cachePath).absolutePath());
+    QString tempPath = cachePath + QString(".%1").arg(QCoreApplication::applicationPid());
+    QFile file(tempPath);
+    if (!file.open(QIODevice::WriteOnly))
+        return;
+    QList<QByteArray> ders;
+    foreach (const QSslCertificate &certificate, certificates)
+        ders.append(certificate.toDer());
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_4_8);
+    out << cacheMagic << cacheVersion << modified << hash << ders;
+    file.close();
+    if (out.status() != QDataStream::Ok) {
+        QFile::remove(tempPath);
+        return;
+    }
+    QFile::remove(cachePath);
+    if (!QFile::rename(tempPath, cachePath))
+        QFile::remove(tempPath);
+}
@@ -0,0 +1,49 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef CERTIFICATECACHE_H
+#define CERTIFICATECACHE_H
+
+#include <QList>
+#include <QString>
+#include <QSslCertificate>
+
+/*
+ * Loads the CA bundle through a binary cache. Parsing the PEM bundle is slow,
+ * so the certificates are also written out in DER form together with the
+ * bundle's modification time and hash. Later runs load the DER copy as long
+ * as the bundle has not changed.
+ */
+class CertificateCache
+{
+public:
+    static QList<QSslCertificate> load(const QString &bundlePath, const QString &cachePath);
+
+private:
+    static bool readCache(const QString &cachePath, const QDateTime &modified, const QByteArray &hash, QList<QSslCertificate> *certificates);
+    static void writeCache(const QString &cachePath, const QDateTime &modified, const QByteArray &hash, const QList<QSslCertificate> &certificates);
+};
+
+#endif // CERTIFICATECACHE_H
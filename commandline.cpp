@@ -0,0 +1,298 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "commandline.h"
+#include "json.h"
+#include <QFile>
+
+/*
+ * Constructor for the command line settings, with all the defaults
+ */
+CommandLine::CommandLine()
+    : testMode(false), json(false), serverMode(false), serverPort(8080), poolSize(2), concurrency(1),
+      useCache(true), cacheSize(50), cacheTtl(0), spoolKeep(1000), renderCacheSize(100), queueDepth(500),
+      maxRunning(8), maxConnections(256), maxWait(0), prewarmInterval(30), printerRefresh(60), recycle(50), maxRss(0), webkitCache(16), journalCommit(10), workers(0), workerTimeout(120), workerMode(false),
+      workerIndex(0), daemonMode(false), noDaemon(false), stdinMode(false)
+{
+}
+
+/*
+ * Parse the command line arguments, not including the program name. Returns
+ * false with errorTitle and errorText set if they are invalid.
+ */
+bool CommandLine::parse(
+    const QStringList &args)
+{
+    for (int i = 0; i < args.size(); i++) {
+        QString arg = args.at(i);
+        if (arg == "-p")
+            options.printer = args.value(++i);
+        else if (arg == "-test")
+            testMode = true;
+        else if (arg == "-l")
+            options.leftMargin = args.value(++i).toDouble();
+        else if (arg == "-t")
+            options.topMargin = args.value(++i).toDouble();
+        else if (arg == "-r")
+            options.rightMargin = args.value(++i).toDouble();
+        else if (arg == "-b")
+            options.bottomMargin = args.value(++i).toDouble();
+        else if (arg == "-a") {
+            options.paper = args.value(++i);
+            if (options.paper.contains(',')) {
+                QStringList dims = options.paper.split(',');
+                if (dims.size() == 2) {
+                    bool ok1, ok2;
+                    options.paperWidth = dims[0].toDouble(&ok1);
+                    options.paperHeight = dims[1].toDouble(&ok2);
+                    if (!ok1 || !ok2 || options.paperWidth <= 0 || options.paperHeight <= 0) {
+                        errorTitle = "Invalid Size";
+                        errorText = "Invalid custom paper size provided in -a.";
+                        return false;
+                    }
+                } else {
+                    errorTitle = "Invalid Format";
+                    errorText = "Custom size for -a should be in format width,height (e.g., 105,148).";
+                    return false;
+                }
+            }
+        } else if (arg == "-o")
+            options.orientation = args.value(++i);
+        else if (arg.toLower() == "-pagefrom")
+            options.pageFrom = args.value(++i).toInt();
+        else if (arg.toLower() == "-pageto")
+            options.pageTo = args.value(++i).toInt();
+        else if (arg.toLower() == "-coalesce")
+            options.coalesce = args.value(++i).toInt();
+        else if (arg.toLower() == "-output") {
+            options.output = args.value(++i).toLower();
+            if (!PrintOptions::knownOutput(options.output)) {
+                errorTitle = "Invalid Output";
+                errorText = "The -output should be printer, pdf, pbm or pwg.";
+                return false;
+            }
+        }
+        else if (arg.toLower() == "-dpi")
+            options.dpi = args.value(++i).toInt();
+        else if (arg.toLower() == "-copies")
+            options.copies = qMax(1, args.value(++i).toInt());
+        else if (arg.toLower() == "-rendercache") {
+            renderCacheSize = args.value(++i).toInt();
+            processFlags << arg.toLower();
+        }
+        else if (arg.toLower() == "-spooldir") {
+            spoolDir = args.value(++i);
+            processFlags << arg.toLower();
+        }
+        else if (arg.toLower() == "-spoolkeep") {
+            spoolKeep = args.value(++i).toInt();
+            processFlags << arg.toLower();
+        }
+        else if (arg == "-json")
+            json = true;
+        else if (arg == "-server") {
+            serverMode = true;
+            if (i + 1 < args.size() && !args.at(i + 1).startsWith('-'))
+                serverPort = args.at(++i).toInt();
+        }
+        else if (arg.toLower() == "-poolsize")
+            poolSize = args.value(++i).toInt();
+        else if (arg.toLower() == "-concurrency")
+            concurrency = args.value(++i).toInt();
+        else if (arg.toLower() == "-cachesize") {
+            cacheSize = args.value(++i).toInt();
+            processFlags << arg.toLower();
+        }
+        else if (arg.toLower() == "-cachettl") {
+            cacheTtl = args.value(++i).toInt();
+            processFlags << arg.toLower();
+        }
+        else if (arg.toLower() == "-nocache") {
+            useCache = false;
+            processFlags << arg.toLower();
+        }
+        else if (arg.toLower() == "-workers")
+            workers = args.value(++i).toInt();
+        else if (arg.toLower() == "-workertimeout")
+            workerTimeout = args.value(++i).toInt();
+        else if (arg.toLower() == "-maxrequest")
+            limits.maxBodySize = qint64(args.value(++i).toInt()) * 1024;
+        else if (arg.toLower() == "-idletimeout")
+            limits.idleTimeout = args.value(++i).toInt();
+        else if (arg.toLower() == "-queuedepth")
+            queueDepth = args.value(++i).toInt();
+        else if (arg.toLower() == "-maxrunning")
+            maxRunning = args.value(++i).toInt();
+        else if (arg.toLower() == "-maxconnections")
+            maxConnections = args.value(++i).toInt();
+        else if (arg.toLower() == "-maxwait")
+            maxWait = args.value(++i).toDouble();
+        else if (arg.toLower() == "-prewarm")
+            prewarm += args.value(++i).split(',', QString::SkipEmptyParts);
+        else if (arg.toLower() == "-prewarminterval")
+            prewarmInterval = args.value(++i).toInt();
+        else if (arg.toLower() == "-printerrefresh")
+            printerRefresh = args.value(++i).toInt();
+        else if (arg.toLower() == "-journal")
+            journalFile = args.value(++i);
+        else if (arg.toLower() == "-journalcommit")
+            journalCommit = args.value(++i).toInt();
+        else if (arg.toLower() == "-recycle")
+            recycle = args.value(++i).toInt();
+        else if (arg.toLower() == "-maxrss")
+            maxRss = args.value(++i).toInt();
+        else if (arg.toLower() == "-webkitcache")
+            webkitCache = args.value(++i).toInt();
+        else if (arg.toLower() == "-nojs")
+            policy.javascript = false;
+        else if (arg.toLower() == "-noimages")
+            policy.images = false;
+        else if (arg.toLower() == "-plugins")
+            policy.plugins = true;
+        else if (arg.toLower() == "-nothirdparty")
+            policy.thirdParty = false;
+        else if (arg.toLower() == "-allow")
+            policy.allowHosts += args.value(++i).split(',', QString::SkipEmptyParts);
+        else if (arg.toLower() == "-deny")
+            policy.denyHosts += args.value(++i).split(',', QString::SkipEmptyParts);
+        else if (arg.toLower() == "-deadline")
+            load.deadline = args.value(++i).toDouble();
+        else if (arg.toLower() == "-resourcetimeout")
+            load.resourceTimeout = args.value(++i).toDouble();
+        else if (arg.toLower() == "-ondeadline") {
+            QString onDeadline = args.value(++i).toLower();
+            if (onDeadline != "print" && onDeadline != "fail") {
+                errorTitle = "Invalid Deadline";
+                errorText = "The -ondeadline should be fail or print.";
+                return false;
+            }
+            load.printOnDeadline = onDeadline == "print";
+        }
+        else if (arg.toLower() == "-trigger") {
+            if (!LoadOptions::parseTrigger(args.value(++i), &load.trigger)) {
+                errorTitle = "Invalid Trigger";
+                errorText = "The -trigger should be load, domready or ready.";
+                return false;
+            }
+        }
+        else if (arg.toLower() == "-merge")
+            mergeFile = args.value(++i);
+        else if (arg.toLower() == "-trace")
+            traceFile = args.value(++i);
+        else if (arg.toLower() == "-daemon")
+            daemonMode = true;
+        else if (arg.toLower() == "-nodaemon")
+            noDaemon = true;
+        else if (arg.toLower() == "-stdin")
+            stdinMode = true;
+        else if (arg == "-worker" && i + 2 < args.size()) {
+            // Internal, used by the server to start its worker processes
+            workerMode = true;
+            workerServer = args.at(++i);
+            workerIndex = args.at(++i).toInt();
+        }
+        else
+            urls << arg;
+    }
+    if (stdinMode && !urls.isEmpty()) {
+        errorTitle = "Invalid Arguments";
+        errorText = "With -stdin the URLs to print are read from stdin.";
+        return false;
+    }
+    if (!mergeFile.isEmpty() && urls.size() != 1) {
+        errorTitle = "Invalid Merge";
+        errorText = "A merge needs exactly one template URL.";
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Read the records for a merge from the merge file, relative to the current
+ * directory. The file holds a JSON array of objects, or an object with such
+ * an array in 'records'.
+ */
+bool CommandLine::loadMergeRecords()
+{
+    QFile file(mergeFile);
+    if (!file.open(QIODevice::ReadOnly)) {
+        errorTitle = "Invalid Merge";
+        errorText = "Cannot read the merge file " + mergeFile + ".";
+        return false;
+    }
+    QString error;
+    QVariant data = Json::parse(file.readAll(), &error);
+    mergeRecords = data.type() == QVariant::Map ? data.toMap().value("records").toList() : data.toList();
+    if (!error.isEmpty() || mergeRecords.isEmpty()) {
+        errorTitle = "Invalid Merge";
+        errorText = error.isEmpty() ? "The merge file has no records." : "The merge file is not valid JSON: " + error;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * True if the option, without its dash, only changes how one run prints,
+ * as opposed to setting up the process or picking what it runs as
+ */
+bool CommandLine::isRunOption(
+    const QString &name)
+{
+    static const char *names[] = {
+        "p", "test", "json", "l", "t", "r", "b", "a", "o", "pagefrom", "pageto", "coalesce", "output",
+        "dpi", "copies", "concurrency", "nojs", "noimages", "plugins", "nothirdparty", "allow", "deny",
+        "deadline", "resourcetimeout", "ondeadline", "trigger", "merge", "trace", 0
+    };
+    for (int i = 0; names[i]; i++) {
+        if (name == names[i])
+            return true;
+    }
+    return false;
+}
+
+/*
+ * True if the option, without its dash, sets up the spool directory, render
+ * cache or resource cache for the whole process
+ */
+bool CommandLine::isProcessOption(
+    const QString &name)
+{
+    static const char *names[] = { "spooldir", "spoolkeep", "rendercache", "cachesize", "cachettl", "nocache", 0 };
+    for (int i = 0; names[i]; i++) {
+        if (name == names[i])
+            return true;
+    }
+    return false;
+}
+
+/*
+ * True if this is a plain print run that a resident daemon can do for us.
+ * Runs that set up the spool directory, render cache or resource cache are
+ * printed locally, as the daemon uses its own.
+ */
+bool CommandLine::canForward() const
+{
+    return !noDaemon && !daemonMode && !serverMode && !workerMode && !stdinMode && processFlags.isEmpty() && !urls.isEmpty();
+}
@@ -0,0 +1,96 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef COMMANDLINE_H
+#define COMMANDLINE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariantList>
+#include "printoptions.h"
+#include "resourcepolicy.h"
+#include "loadoptions.h"
+#include "httpconnection.h"
+
+/*
+ * Settings parsed from the command line. Parsing is kept apart from main()
+ * so the daemon can parse the arguments a client forwards to it exactly as
+ * if it had been started with them.
+ */
+struct CommandLine
+{
+    PrintOptions options;
+    ResourcePolicy policy;
+    LoadOptions load;
+    QStringList urls;
+    QString     mergeFile;      // JSON records to merge into the template URL, if any
+    QVariantList mergeRecords;  // Records read from the merge file
+    QString     traceFile;      // File to write a trace of the run to, if any
+    bool        testMode;
+    bool        json;
+    bool        serverMode;
+    int         serverPort;
+    int         poolSize;
+    int         concurrency;
+    bool        useCache;
+    int         cacheSize;      // Megabytes
+    int         cacheTtl;       // Seconds, 0 to follow HTTP
+    QString     spoolDir;       // Where output to files goes, empty for the default
+    int         spoolKeep;      // Number of output files to keep, 0 for all
+    int         renderCacheSize; // Megabytes of rendered files to keep for reprints, 0 for none
+    int         queueDepth;     // Jobs each priority lane may hold waiting, 0 for no limit
+    int         maxRunning;     // Jobs the server prints at once, 0 for one per printer
+    int         maxConnections; // Client connections the server takes at once, 0 for no limit
+    double      maxWait;        // Seconds jobs may wait to start, 0 for ever
+    QStringList prewarm;        // Origins to keep connections open to
+    int         prewarmInterval; // Seconds between requests keeping them open
+    int         printerRefresh; // Seconds between reading the installed printers again
+    QString     journalFile;    // Journal of accepted server jobs, empty for none
+    int         journalCommit;  // Milliseconds to gather journal records before syncing them
+    int         recycle;        // Jobs a web page prints before it is replaced, 0 for no limit
+    int         maxRss;         // Megabytes resident before pages and caches are thrown away, 0 for no limit
+    int         webkitCache;    // Megabytes of WebKit memory cache in resident processes
+    int         workers;
+    int         workerTimeout;
+    bool        workerMode;     // Internal, started by the server as a worker
+    QString     workerServer;
+    int         workerIndex;
+    HttpLimits  limits;
+    bool        daemonMode;     // Run as the resident daemon
+    bool        noDaemon;       // Never forward to a running daemon
+    bool        stdinMode;      // Read jobs from stdin and write their results to stdout
+    QStringList processFlags;   // Flags given that set up the whole process rather than one run
+    QString     errorTitle;     // Set if the arguments are invalid
+    QString     errorText;
+
+    CommandLine();
+    bool parse(const QStringList &args);
+    bool canForward() const;
+    static bool isRunOption(const QString &name);
+    static bool isProcessOption(const QString &name);
+    bool loadMergeRecords();
+};
+
+#endif // COMMANDLINE_H
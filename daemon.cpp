@@ -0,0 +1,382 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "daemon.h"
+#include "commandline.h"
+#include "printhtml.h"
+#include "workerpool.h"
+#include "trace.h"
+#include <QLocalSocket>
+#include <QDir>
+#include <QTimer>
+#include <QFileInfo>
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Constructor for the daemon
+ *
+ * PARAMETERS:
+ * poolSize - Number of warm web pages to keep ready
+ * parent   - Parent object
+ */
+Daemon::Daemon(
+    int poolSize,
+    QObject *parent)
+    : QObject(parent), engine(0), pagePool(poolSize)
+{
+    connect(&server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+}
+
+/*
+ * Name of the local socket the daemon listens on. Each user gets their own
+ * daemon, so jobs print with the right permissions and printers. On Unix
+ * the socket lives in a directory only the user can get into.
+ */
+QString Daemon::serverName()
+{
+#if defined(Q_OS_WIN)
+    QString user = QString::fromLocal8Bit(qgetenv("USERNAME"));
+    return "PrintHtml-daemon-" + user;
+#else
+    return QDir::tempPath() + "/PrintHtml-" + QString::number(getuid()) + "/daemon";
+#endif
+}
+
+/*
+ * Check the directory the socket lives in belongs to us and nobody else can
+ * get into it, creating it first if asked. Windows named pipes are only
+ * open to the user who created them, so there is nothing to check there.
+ *
+ * PARAMETERS:
+ * create   - True to create the directory if it doesn't exist
+ */
+bool Daemon::privateDirectory(
+    bool create)
+{
+#if defined(Q_OS_WIN)
+    Q_UNUSED(create);
+    return true;
+#else
+    QByteArray dir = QFile::encodeName(QFileInfo(serverName()).path());
+    if (create && mkdir(dir.constData(), 0700) != 0 && errno != EEXIST)
+        return false;
+    struct stat info;
+    if (lstat(dir.constData(), &info) != 0)
+        return false;
+    return S_ISDIR(info.st_mode) && info.st_uid == getuid() && (info.st_mode & 077) == 0;
+#endif
+}
+
+#if defined(Q_OS_WIN)
+#ifndef PROCESS_QUERY_LIMITED_INFORMATION
+#define PROCESS_QUERY_LIMITED_INFORMATION   0x1000
+#endif
+
+/*
+ * Return the user a process runs as, as a SID, or an empty array if we
+ * can't tell
+ */
+static QByteArray processUser(
+    DWORD pid)
+{
+    QByteArray sid;
+    HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    if (!process)
+        return sid;
+    HANDLE token;
+    if (OpenProcessToken(process, TOKEN_QUERY, &token)) {
+        DWORD size = 0;
+        GetTokenInformation(token, TokenUser, 0, 0, &size);
+        QByteArray buffer(int(size), 0);
+        if (size > 0 && GetTokenInformation(token, TokenUser, buffer.data(), size, &size)) {
+            PSID user = ((TOKEN_USER*)buffer.data())->User.Sid;
+            sid = QByteArray((const char*)user, int(GetLengthSid(user)));
+        }
+        CloseHandle(token);
+    }
+    CloseHandle(process);
+    return sid;
+}
+#endif
+
+/*
+ * Check the process at the other end of the socket runs as the same user
+ * as we do, so jobs are never handed to, or taken from, someone else
+ *
+ * PARAMETERS:
+ * socket       - Connected socket
+ * peerIsServer - True if the other end is the daemon, false if it is a client
+ */
+bool Daemon::sameUser(
+    QLocalSocket *socket,
+    bool peerIsServer)
+{
+#if defined(Q_OS_WIN)
+    // Only in Vista and later, so looked up when needed
+    typedef BOOL (WINAPI *PipeProcessId)(HANDLE, PULONG);
+    PipeProcessId pipeProcessId = (PipeProcessId)GetProcAddress(GetModuleHandleW(L"kernel32.dll"),
+        peerIsServer ? "GetNamedPipeServerProcessId" : "GetNamedPipeClientProcessId");
+    ULONG pid = 0;
+    if (!pipeProcessId || !pipeProcessId((HANDLE)socket->socketDescriptor(), &pid))
+        return false;
+    QByteArray peer = processUser(pid);
+    return !peer.isEmpty() && peer == processUser(GetCurrentProcessId());
+#elif defined(Q_OS_LINUX)
+    Q_UNUSED(peerIsServer);
+    struct ucred cred;
+    socklen_t size = sizeof(cred);
+    if (getsockopt(int(socket->socketDescriptor()), SOL_SOCKET, SO_PEERCRED, &cred, &size) != 0)
+        return false;
+    return cred.uid == getuid();
+#else
+    Q_UNUSED(peerIsServer);
+    uid_t uid;
+    gid_t gid;
+    if (getpeereid(int(socket->socketDescriptor()), &uid, &gid) != 0)
+        return false;
+    return uid == getuid();
+#endif
+}
+
+/*
+ * Start listening for command line runs, unless another daemon already is
+ */
+bool Daemon::listen()
+{
+    if (!privateDirectory(true))
+        return false;
+    QLocalSocket probe;
+    probe.connectToServer(serverName());
+    if (probe.waitForConnected(1000))
+        return false;
+
+    // Clean up after a daemon that crashed, then listen
+    QLocalServer::removeServer(serverName());
+    if (!server.listen(serverName()))
+        return false;
+    homeDir = QDir::currentPath();
+    pagePool.warm();
+    return true;
+}
+
+/*
+ * Called on the command line side. Hands the arguments to the daemon and
+ * waits for the result. Returns false if no daemon is running, in which case
+ * the caller prints the job itself. If the daemon goes away in the middle of
+ * the job the reply is left empty.
+ *
+ * PARAMETERS:
+ * args     - Command line arguments, not including the program name
+ * reply    - Output, exit code and message box of the job
+ */
+bool Daemon::forward(
+    const QStringList &args,
+    QVariantMap *reply)
+{
+    if (!privateDirectory(false))
+        return false;
+    QLocalSocket socket;
+    socket.connectToServer(serverName());
+    if (!socket.waitForConnected(1000))
+        return false;
+    if (!sameUser(&socket, true)) {
+        socket.abort();
+        return false;
+    }
+
+    QVariantMap request;
+    request.insert("type", "print");
+    request.insert("args", args);
+    request.insert("cwd", QDir::currentPath());
+    WorkerPool::writeMessage(&socket, request);
+    while (socket.bytesToWrite() > 0) {
+        if (!socket.waitForBytesWritten(5000))
+            return false;
+    }
+
+    // The daemon may have to finish other jobs first, so wait as long as it takes
+    reply->clear();
+    QByteArray buffer;
+    while (socket.waitForReadyRead(-1)) {
+        foreach (const QVariantMap &message, WorkerPool::readMessages(&socket, buffer)) {
+            if (message.value("type") == "result") {
+                *reply = message;
+                return true;
+            }
+        }
+    }
+    return true;
+}
+
+void Daemon::newConnection()
+{
+    while (QLocalSocket *socket = server.nextPendingConnection()) {
+        if (!sameUser(socket, false)) {
+            socket->abort();
+            socket->deleteLater();
+            continue;
+        }
+        buffers.insert(socket, QByteArray());
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(clientGone()));
+    }
+}
+
+/*
+ * Queue a print request from a command line run
+ */
+void Daemon::readRequest()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    if (!socket || !buffers.contains(socket))
+        return;
+    foreach (const QVariantMap &message, WorkerPool::readMessages(socket, buffers[socket])) {
+        if (message.value("type") != "print")
+            continue;
+        Request request;
+        request.socket = socket;
+        request.args = message.value("args").toStringList();
+        request.cwd = message.value("cwd").toString();
+        pending.enqueue(request);
+    }
+    startNext();
+}
+
+/*
+ * A client went away. Requests it was waiting on are dropped, except one
+ * that is already printing, which runs to the end.
+ */
+void Daemon::clientGone()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    if (!socket)
+        return;
+    buffers.remove(socket);
+    for (int i = pending.size() - 1; i >= 0; i--) {
+        if (pending.at(i).socket == socket)
+            pending.removeAt(i);
+    }
+    socket->deleteLater();
+}
+
+/*
+ * Start printing the next request if we are idle
+ */
+void Daemon::startNext()
+{
+    while (!engine && !pending.isEmpty()) {
+        current = pending.dequeue();
+        if (!current.socket)
+            continue;
+
+        CommandLine cmd;
+        if (!cmd.parse(current.args) || !cmd.canForward()) {
+            QVariantMap result;
+            result.insert("exitCode", -1);
+            result.insert("title", cmd.errorTitle.isEmpty() ? QString("Daemon Error") : cmd.errorTitle);
+            if (!cmd.errorText.isEmpty())
+                result.insert("message", cmd.errorText);
+            else if (!cmd.processFlags.isEmpty())
+                result.insert("message", "The daemon uses its own " + cmd.processFlags.join(", ") + ", so run with -nodaemon to set them.");
+            else
+                result.insert("message", QString("The daemon can only print URLs."));
+            reply(current.socket, result);
+            continue;
+        }
+
+        // Relative paths in the arguments are relative to the client
+        QDir::setCurrent(current.cwd);
+        if (!cmd.mergeFile.isEmpty() && !cmd.loadMergeRecords()) {
+            QDir::setCurrent(homeDir);
+            QVariantMap result;
+            result.insert("exitCode", -1);
+            result.insert("title", cmd.errorTitle);
+            result.insert("message", cmd.errorText);
+            reply(current.socket, result);
+            continue;
+        }
+        engine = new PrintHtml(cmd.testMode, cmd.json, cmd.urls, cmd.options, false);
+        engine->setInteractive(false);
+        engine->setPolicy(cmd.policy);
+        engine->setLoadOptions(cmd.load);
+        if (!cmd.mergeFile.isEmpty())
+            engine->setMergeRecords(cmd.mergeRecords);
+        if (!cmd.traceFile.isEmpty()) {
+            engine->setTracing(int(QCoreApplication::applicationPid()), "PrintHtml daemon");
+            traceFile = QFileInfo(cmd.traceFile).absoluteFilePath();
+        }
+        engine->setConcurrency(cmd.concurrency);
+        engine->setPagePool(&pagePool);
+        engine->setPrinterCache(&printerCache);
+        connect(engine, SIGNAL(finished()), this, SLOT(jobFinished()));
+        QTimer::singleShot(0, engine, SLOT(run()));
+    }
+}
+
+/*
+ * Send the client everything the job would have shown it
+ */
+void Daemon::jobFinished()
+{
+    if (!engine)
+        return;
+    if (!traceFile.isEmpty())
+        Trace::write(traceFile, engine->traceEvents());
+    traceFile.clear();
+    QVariantMap result;
+    result.insert("exitCode", engine->exitCode());
+    result.insert("output", engine->output());
+    if (!engine->messageText().isEmpty()) {
+        result.insert("title", engine->messageTitle());
+        result.insert("message", engine->messageText());
+    }
+    if (current.socket)
+        reply(current.socket, result);
+    QDir::setCurrent(homeDir);
+
+    // We are called from inside the engine, so let it unwind before it goes
+    engine->deleteLater();
+    engine = 0;
+    current = Request();
+    startNext();
+}
+
+void Daemon::reply(
+    QLocalSocket *socket,
+    const QVariantMap &result)
+{
+    QVariantMap message = result;
+    message.insert("type", "result");
+    WorkerPool::writeMessage(socket, message);
+    socket->flush();
+}
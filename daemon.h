@@ -0,0 +1,90 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QPointer>
+#include <QQueue>
+#include <QHash>
+#include <QVariantMap>
+#include "webpagepool.h"
+#include "printercache.h"
+
+class QLocalSocket;
+class PrintHtml;
+
+/*
+ * Resident daemon that prints on behalf of command line runs. A run that
+ * finds the daemon forwards its arguments and working directory over a
+ * local socket and gets back the output, exit code and any message box the
+ * job would have shown, so it never has to start WebKit itself. Jobs are
+ * printed one at a time in the order they arrive. Only the user who started
+ * the daemon can talk to it, and runs only hand their jobs to a daemon that
+ * user started.
+ */
+class Daemon : public QObject
+{
+    Q_OBJECT
+public:
+    explicit Daemon(int poolSize, QObject *parent = 0);
+
+    bool listen();
+
+    static QString serverName();
+    static bool forward(const QStringList &args, QVariantMap *reply);
+
+private slots:
+    void newConnection();
+    void readRequest();
+    void clientGone();
+    void jobFinished();
+
+private:
+    struct Request {
+        QPointer<QLocalSocket> socket;
+        QStringList args;
+        QString     cwd;        // Working directory of the client
+    };
+
+    void startNext();
+    void reply(QLocalSocket *socket, const QVariantMap &result);
+    static bool privateDirectory(bool create);
+    static bool sameUser(QLocalSocket *socket, bool peerIsServer);
+
+    QLocalServer    server;
+    QHash<QLocalSocket*, QByteArray> buffers; // Partially received requests
+    QQueue<Request> pending;    // Requests waiting for their turn
+    Request         current;    // Request being printed, if any
+    PrintHtml       *engine;
+    QString         homeDir;    // Working directory of the daemon itself
+    QString         traceFile;  // Where to write the trace of the current request, if asked for
+    WebPagePool     pagePool;
+    PrinterCache    printerCache;
+};
+
+#endif // DAEMON_H
@@ -0,0 +1,385 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "httpconnection.h"
+#include <QTcpSocket>
+#include <QTimer>
+
+/*
+ * True if the connection should stay open after the response. HTTP/1.1
+ * connections are persistent unless the client says otherwise, HTTP/1.0 ones
+ * only if the client asks for it.
+ */
+bool HttpRequest::keepAlive() const
+{
+    QByteArray connection = header("connection").toLower();
+    if (version == "HTTP/1.1")
+        return !connection.contains("close");
+    return connection.contains("keep-alive");
+}
+
+/*
+ * Constructor for an HTTP connection. The connection is owned by the socket
+ * and goes away with it.
+ *
+ * PARAMETERS:
+ * socket   - Socket connected to the client
+ * limits   - Request size and idle time limits
+ */
+HttpConnection::HttpConnection(
+    QTcpSocket *socket,
+    const HttpLimits &limits)
+    : QObject(socket), tcpSocket(socket), limits(limits), state(RequestLine), headerSize(0),
+      remaining(0), closing(false), chunked(false)
+{
+    idleTimer = new QTimer(this);
+    idleTimer->setSingleShot(true);
+    connect(idleTimer, SIGNAL(timeout()), this, SLOT(idleTimeout()));
+    connect(socket, SIGNAL(readyRead()), this, SLOT(readData()));
+    connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    idleTimer->start(limits.idleTimeout * 1000);
+
+    // Qt stops reading from the network once this much is waiting for us
+    socket->setReadBufferSize(limits.maxHeaderSize + limits.maxBodySize);
+}
+
+/*
+ * Called when more data has arrived from the client. While a request is
+ * waiting for its response the data is left in the socket, so a client
+ * pipelining requests is held back by TCP instead of filling our memory.
+ */
+void HttpConnection::readData()
+{
+    if (state == Waiting)
+        return;
+    buffer += tcpSocket->readAll();
+    idleTimer->start(limits.idleTimeout * 1000);
+    parse();
+}
+
+/*
+ * Parse as much of the buffered data as we can. Stops once a complete request
+ * has been handed on, until its response has been sent.
+ */
+void HttpConnection::parse()
+{
+    while (state != Waiting && !closing) {
+        if (state == RequestLine || state == Headers || state == ChunkSize || state == ChunkTrailer) {
+            int eol = buffer.indexOf('\n');
+            if (eol < 0) {
+                if (headerSize + buffer.size() > limits.maxHeaderSize)
+                    fail("431 Request Header Fields Too Large");
+                return;
+            }
+            QByteArray line = buffer.left(eol);
+            buffer.remove(0, eol + 1);
+            if (line.endsWith('\r'))
+                line.chop(1);
+
+            if (state == RequestLine) {
+                // Ignore empty lines between pipelined requests
+                if (line.isEmpty())
+                    continue;
+                headerSize = line.size();
+                if (!parseRequestLine(line))
+                    return;
+                state = Headers;
+            } else if (state == Headers) {
+                headerSize += line.size();
+                if (headerSize > limits.maxHeaderSize) {
+                    fail("431 Request Header Fields Too Large");
+                    return;
+                }
+                if (line.isEmpty()) {
+                    if (!startBody())
+                        return;
+                } else if (!parseHeader(line)) {
+                    return;
+                }
+            } else if (state == ChunkSize) {
+                bool ok;
+                remaining = line.split(';').first().trimmed().toLongLong(&ok, 16);
+                if (!ok || remaining < 0) {
+                    fail("400 Bad Request");
+                    return;
+                }
+                if (request.body.size() + remaining > limits.maxBodySize) {
+                    fail("413 Request Entity Too Large");
+                    return;
+                }
+                state = remaining > 0 ? ChunkData : ChunkTrailer;
+            } else {
+                // Trailer headers are ignored; an empty line ends the request
+                if (line.isEmpty())
+                    dispatch();
+            }
+        } else {
+            // Body or chunk data
+            int count = int(qMin<qint64>(remaining, buffer.size()));
+            request.body += buffer.left(count);
+            buffer.remove(0, count);
+            remaining -= count;
+            if (remaining > 0)
+                return;
+            if (state == Body) {
+                dispatch();
+            } else {
+                // Chunk data is followed by CRLF before the next chunk size
+                if (buffer.size() < 2 && !buffer.startsWith('\n'))
+                    return;
+                if (buffer.startsWith("\r\n"))
+                    buffer.remove(0, 2);
+                else if (buffer.startsWith('\n'))
+                    buffer.remove(0, 1);
+                else {
+                    fail("400 Bad Request");
+                    return;
+                }
+                state = ChunkSize;
+            }
+        }
+    }
+}
+
+/*
+ * Parse the request line, eg: GET /print?url=... HTTP/1.1
+ */
+bool HttpConnection::parseRequestLine(
+    const QByteArray &line)
+{
+    QList<QByteArray> parts = line.split(' ');
+    if (parts.size() != 3 || !parts[2].startsWith("HTTP/1.")) {
+        fail("400 Bad Request");
+        return false;
+    }
+    request = HttpRequest();
+    request.method = parts[0].toUpper();
+    QString target = QString::fromUtf8(parts[1]);
+    request.path = target.section('?', 0, 0);
+    request.query = target.section('?', 1);
+    request.version = parts[2];
+    return true;
+}
+
+/*
+ * Parse a header line, eg: Content-Length: 42
+ */
+bool HttpConnection::parseHeader(
+    const QByteArray &line)
+{
+    int colon = line.indexOf(':');
+    if (colon <= 0) {
+        fail("400 Bad Request");
+        return false;
+    }
+    QByteArray name = line.left(colon).trimmed().toLower();
+    QByteArray value = line.mid(colon + 1).trimmed();
+    if (request.headers.contains(name))
+        request.headers[name] += ", " + value;
+    else
+        request.headers.insert(name, value);
+    return true;
+}
+
+/*
+ * Called at the end of the headers to work out how the body is sent
+ */
+bool HttpConnection::startBody()
+{
+    if (request.header("expect").toLower() == "100-continue")
+        tcpSocket->write("HTTP/1.1 100 Continue\r\n\r\n");
+
+    if (request.header("transfer-encoding").toLower().contains("chunked")) {
+        state = ChunkSize;
+        return true;
+    }
+    QByteArray length = request.header("content-length");
+    if (length.isEmpty()) {
+        dispatch();
+        return true;
+    }
+    bool ok;
+    remaining = length.toLongLong(&ok);
+    if (!ok || remaining < 0) {
+        fail("400 Bad Request");
+        return false;
+    }
+    if (remaining > limits.maxBodySize) {
+        fail("413 Request Entity Too Large");
+        return false;
+    }
+    if (remaining == 0)
+        dispatch();
+    else
+        state = Body;
+    return true;
+}
+
+/*
+ * Hand a complete request on, and wait for its response before looking at
+ * the next one
+ */
+void HttpConnection::dispatch()
+{
+    state = Waiting;
+    idleTimer->stop();
+    requestTimer.start();
+    if (!request.keepAlive())
+        closing = true;
+    emit requestReceived(this, request);
+}
+
+/*
+ * Send the response to the current request
+ */
+void HttpConnection::respond(
+    const QByteArray &status,
+    const QByteArray &contentType,
+    const QByteArray &body,
+    const QByteArray &headers)
+{
+    QByteArray resp = "HTTP/1.1 " + status + "\r\n";
+    if (!contentType.isEmpty())
+        resp += "Content-Type: " + contentType + "\r\n";
+    resp += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    resp += closing ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+    resp += headers + "\r\n" + body;
+    tcpSocket->write(resp);
+    finishResponse(status);
+}
+
+/*
+ * Start a response whose body is sent a piece at a time as it becomes
+ * available. HTTP/1.1 clients get chunked transfer encoding, while HTTP/1.0
+ * clients get the body as is and the connection closed at the end.
+ */
+void HttpConnection::beginStream(
+    const QByteArray &status,
+    const QByteArray &contentType,
+    const QByteArray &headers)
+{
+    chunked = request.version != "HTTP/1.0";
+    if (!chunked)
+        closing = true;
+    streamStatus = status;
+    QByteArray resp = "HTTP/1.1 " + status + "\r\n";
+    if (!contentType.isEmpty())
+        resp += "Content-Type: " + contentType + "\r\n";
+    if (chunked)
+        resp += "Transfer-Encoding: chunked\r\n";
+    resp += closing ? "Connection: close\r\n" : "Connection: keep-alive\r\n";
+    resp += headers + "\r\n";
+    tcpSocket->write(resp);
+}
+
+/*
+ * Send the next piece of a streamed response
+ */
+void HttpConnection::writeStream(
+    const QByteArray &data)
+{
+    if (data.isEmpty())
+        return;
+    if (chunked)
+        tcpSocket->write(QByteArray::number(data.size(), 16) + "\r\n" + data + "\r\n");
+    else
+        tcpSocket->write(data);
+}
+
+/*
+ * Finish a streamed response
+ */
+void HttpConnection::endStream()
+{
+    if (chunked)
+        tcpSocket->write("0\r\n\r\n");
+    chunked = false;
+    finishResponse(streamStatus);
+}
+
+/*
+ * Called once a response has been sent. If the connection stays open we then
+ * carry on with any pipelined requests we already have.
+ */
+void HttpConnection::finishResponse(
+    const QByteArray &status)
+{
+    emit responseSent(status, requestTimer.isValid() ? requestTimer.nsecsElapsed() / 1e9 : 0.0);
+    requestTimer.invalidate();
+
+    if (closing) {
+        tcpSocket->disconnectFromHost();
+        return;
+    }
+    state = RequestLine;
+    headerSize = 0;
+    idleTimer->start(limits.idleTimeout * 1000);
+    if (!buffer.isEmpty() || tcpSocket->bytesAvailable() > 0)
+        QTimer::singleShot(0, this, SLOT(readData()));
+}
+
+/*
+ * Reject a request we can't parse and close the connection
+ */
+void HttpConnection::fail(
+    const QByteArray &status)
+{
+    closing = true;
+    state = Waiting;
+    buffer.clear();
+    QByteArray body = "{\"error\":\"" + status + "\"}";
+    respond(status, "application/json", body);
+}
+
+/*
+ * Turn the client away without reading its request, telling it when to try
+ * again, and close the connection
+ *
+ * PARAMETERS:
+ * status       - HTTP status to answer with
+ * message      - Why the client was turned away
+ * retryAfter   - Seconds the client should wait before trying again
+ */
+void HttpConnection::refuse(
+    const QByteArray &status,
+    const QByteArray &message,
+    int retryAfter)
+{
+    closing = true;
+    state = Waiting;
+    buffer.clear();
+    idleTimer->stop();
+    QByteArray body = "{\"error\":\"" + message + "\"}";
+    respond(status, "application/json", body, "Retry-After: " + QByteArray::number(retryAfter) + "\r\n");
+}
+
+/*
+ * Close connections that have been idle for too long
+ */
+void HttpConnection::idleTimeout()
+{
+    closing = true;
+    tcpSocket->disconnectFromHost();
+}
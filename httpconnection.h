@@ -0,0 +1,121 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef HTTPCONNECTION_H
+#define HTTPCONNECTION_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QHash>
+#include <QElapsedTimer>
+
+class QTcpSocket;
+class QTimer;
+
+/*
+ * An HTTP request received by the REST server. Header names are stored in
+ * lower case.
+ */
+struct HttpRequest
+{
+    QByteArray  method;
+    QString     path;       // Path without the query string
+    QString     query;      // Query string, without the '?'
+    QByteArray  version;    // HTTP/1.0 or HTTP/1.1
+    QHash<QByteArray, QByteArray> headers;
+    QByteArray  body;
+
+    QByteArray header(const QByteArray &name) const { return headers.value(name.toLower()); }
+    bool keepAlive() const;
+};
+
+/*
+ * Limits applied to every connection
+ */
+struct HttpLimits
+{
+    int     maxHeaderSize;  // Maximum size of the request line and headers
+    qint64  maxBodySize;    // Maximum size of a request body
+    int     idleTimeout;    // Seconds to keep an idle connection open
+
+    HttpLimits() : maxHeaderSize(16 * 1024), maxBodySize(8 * 1024 * 1024), idleTimeout(30) {}
+};
+
+/*
+ * HTTP/1.1 connection to a REST client. Requests are parsed incrementally as
+ * data arrives, including chunked request bodies. Pipelined requests are
+ * handled one at a time, so responses always go out in request order, and the
+ * connection is kept open between requests unless the client asks otherwise.
+ */
+class HttpConnection : public QObject
+{
+    Q_OBJECT
+public:
+    HttpConnection(QTcpSocket *socket, const HttpLimits &limits);
+
+    void respond(const QByteArray &status, const QByteArray &contentType, const QByteArray &body,
+                 const QByteArray &headers = QByteArray());
+    void beginStream(const QByteArray &status, const QByteArray &contentType,
+                     const QByteArray &headers = QByteArray());
+    void writeStream(const QByteArray &data);
+    void endStream();
+    void refuse(const QByteArray &status, const QByteArray &message, int retryAfter);
+    QTcpSocket *socket() const  { return tcpSocket; }
+
+signals:
+    void requestReceived(HttpConnection *connection, const HttpRequest &request);
+    void responseSent(const QByteArray &status, double seconds);
+
+private slots:
+    void readData();
+    void parse();
+    void idleTimeout();
+
+private:
+    enum State { RequestLine, Headers, Body, ChunkSize, ChunkData, ChunkTrailer, Waiting };
+
+    bool parseRequestLine(const QByteArray &line);
+    bool parseHeader(const QByteArray &line);
+    bool startBody();
+    void dispatch();
+    void fail(const QByteArray &status);
+    void finishResponse(const QByteArray &status);
+
+    QTcpSocket      *tcpSocket;
+    HttpLimits      limits;
+    QTimer          *idleTimer;
+    QByteArray      buffer;     // Data received but not parsed yet
+    State           state;
+    HttpRequest     request;    // Request being parsed
+    int             headerSize; // Bytes of request line and headers so far
+    qint64          remaining;  // Body or chunk bytes still to come
+    bool            closing;    // True once we will close after this response
+    bool            chunked;    // True while streaming a chunked response
+    QByteArray      streamStatus; // Status of the response being streamed
+    QElapsedTimer   requestTimer; // Started when a request is handed on
+};
+
+#endif // HTTPCONNECTION_H
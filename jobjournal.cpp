@@ -0,0 +1,339 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "jobjournal.h"
+#include "jobqueue.h"
+#include "metrics.h"
+#include "json.h"
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QDir>
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <io.h>
+#else
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
+// Most records to gather before committing them without waiting any longer
+#define MAX_BATCH           1000
+
+// Journal size in records below which it is never worth compacting
+#define MIN_COMPACT         1000
+
+/*
+ * Constructor for the job journal
+ *
+ * PARAMETERS:
+ * path         - Journal file
+ * commitDelay  - Milliseconds to gather records before committing them
+ * parent       - Parent object
+ */
+JobJournal::JobJournal(
+    const QString &path,
+    int commitDelay,
+    QObject *parent)
+    : QObject(parent), filePath(path), commitDelay(qMax(0, commitDelay)), torn(false), buffered(0), appended(0), committedSeq(0),
+      maxId(0), fileRecords(0), commits(0), recordsCommitted(0), commitSeconds(0), compactions(0), failures(0), skipped(0), metrics(0)
+{
+    commitTimer = new QTimer(this);
+    commitTimer->setSingleShot(true);
+    connect(commitTimer, SIGNAL(timeout()), this, SLOT(commit()));
+}
+
+/*
+ * Destructor. Commits anything still waiting.
+ */
+JobJournal::~JobJournal()
+{
+    commit();
+}
+
+/*
+ * Read the journal and return the jobs that were accepted but never
+ * finished, in the order they were submitted. The journal is then rewritten
+ * with just those jobs and kept open for new records. Records cut off by a
+ * crash are skipped. Returns false if the journal can't be written.
+ *
+ * PARAMETERS:
+ * unfinished   - Set to the records of the unfinished jobs
+ */
+bool JobJournal::open(
+    QList<QVariantMap> *unfinished)
+{
+    // A compaction that was cut short leaves the new journal next to where the old one was
+    if (!QFile::exists(filePath) && QFile::exists(filePath + ".new") && !QFile::rename(filePath + ".new", filePath))
+        return false;
+    QDir().mkpath(QFileInfo(filePath).absolutePath());
+
+    QFile existing(filePath);
+    if (existing.open(QIODevice::ReadOnly)) {
+        while (!existing.atEnd()) {
+            QByteArray line = existing.readLine().trimmed();
+            if (line.isEmpty())
+                continue;
+            QString error;
+            QVariantMap record = Json::parse(line, &error).toMap();
+            if (!error.isEmpty() || record.isEmpty()) {
+                skipped++;
+                continue;
+            }
+            apply(record);
+        }
+        existing.close();
+    }
+    *unfinished = pending.values();
+    return compact();
+}
+
+/*
+ * Record that a job was accepted
+ */
+void JobJournal::submitted(
+    const PrintJob *job)
+{
+    QVariantMap record;
+    record.insert("op", "submit");
+    record.insert("job", job->toRecord());
+    append(record);
+}
+
+/*
+ * Record that a job started printing. A job that started but never finished
+ * was cut short, and is printed again when the journal is replayed.
+ */
+void JobJournal::started(
+    int id)
+{
+    QVariantMap record;
+    record.insert("op", "start");
+    record.insert("id", id);
+    append(record);
+}
+
+/*
+ * Record that a job is done with, one way or another
+ */
+void JobJournal::finished(
+    int id,
+    const QString &status)
+{
+    QVariantMap record;
+    record.insert("op", "finish");
+    record.insert("id", id);
+    record.insert("status", status);
+    append(record);
+}
+
+/*
+ * Add a record to the next commit, and make sure a commit is coming
+ */
+void JobJournal::append(
+    const QVariantMap &record)
+{
+    apply(record);
+    buffer += Json::stringify(record) + "\n";
+    buffered++;
+    appended++;
+    if (metrics)
+        metrics->increment("journal_records_total", record.value("op").toString());
+    if (buffered >= MAX_BATCH)
+        commit();
+    else if (!commitTimer->isActive())
+        commitTimer->start(commitDelay);
+}
+
+/*
+ * Update our view of the unfinished jobs with a record
+ */
+void JobJournal::apply(
+    const QVariantMap &record)
+{
+    QString op = record.value("op").toString();
+    if (op == "submit") {
+        QVariantMap job = record.value("job").toMap();
+        int id = job.value("id").toInt();
+        pending.insert(id, job);
+        maxId = qMax(maxId, id);
+    } else if (op == "start") {
+        int id = record.value("id").toInt();
+        if (pending.contains(id))
+            pending[id].insert("started", true);
+    } else if (op == "finish") {
+        pending.remove(record.value("id").toInt());
+    }
+}
+
+/*
+ * Write and sync the records gathered since the last commit, then let the
+ * server answer the requests that were waiting on them. If they can't be
+ * written the records are given up on and the server is told, so it never
+ * answers for a job that is not on disk, and the next commit starts again
+ * with the journal opened afresh. The journal is compacted once finished
+ * jobs make up most of it.
+ */
+void JobJournal::commit()
+{
+    commitTimer->stop();
+    if (buffered == 0)
+        return;
+    QElapsedTimer clock;
+    clock.start();
+
+    // End any record a failed commit left half written, so replaying skips just that one
+    QByteArray data = torn ? "\n" + buffer : buffer;
+    bool ok = reopen() && file.write(data) == data.size() && sync(file);
+    double seconds = clock.nsecsElapsed() / 1e9;
+    commitSeconds += seconds;
+    if (metrics)
+        metrics->observe("commit", seconds);
+    int records = buffered;
+    qint64 sequence = appended;
+    buffer.clear();
+    buffered = 0;
+    if (!ok) {
+        failures++;
+        torn = true;
+        file.close();
+        emit failed(sequence);
+        return;
+    }
+    torn = false;
+    commits++;
+    recordsCommitted += records;
+    fileRecords += records;
+    committedSeq = sequence;
+    emit committed(committedSeq);
+
+    if (fileRecords > MIN_COMPACT && fileRecords > 4 * pending.size())
+        compact();
+}
+
+/*
+ * Rewrite the journal with just the unfinished jobs. The new journal is
+ * written and synced next to the old one before it takes its place, and if
+ * it can't, the old one is kept. Returns false if the journal can't be
+ * written.
+ */
+bool JobJournal::compact()
+{
+    QFile next(filePath + ".new");
+    if (!next.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    int records = 0;
+    foreach (const QVariantMap &job, pending) {
+        QVariantMap record;
+        record.insert("op", "submit");
+        QVariantMap saved = job;
+        saved.remove("started");
+        record.insert("job", saved);
+        next.write(Json::stringify(record) + "\n");
+        records++;
+        if (job.value("started").toBool()) {
+            record.clear();
+            record.insert("op", "start");
+            record.insert("id", job.value("id"));
+            next.write(Json::stringify(record) + "\n");
+            records++;
+        }
+    }
+    if (!sync(next))
+        return false;
+    next.close();
+
+    // Windows won't replace a file that is open, so close ours first
+    file.close();
+    if (!replace(filePath + ".new", filePath)) {
+        QFile::remove(filePath + ".new");
+        reopen();
+        return false;
+    }
+    fileRecords = records;
+    compactions++;
+    return reopen();
+}
+
+/*
+ * Open the journal for appending if a failed commit or compaction closed it
+ */
+bool JobJournal::reopen()
+{
+    if (file.isOpen())
+        return true;
+    file.setFileName(filePath);
+    return file.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+/*
+ * Move a file over another in one step, so there is never a moment without
+ * either of them
+ */
+bool JobJournal::replace(
+    const QString &from,
+    const QString &to)
+{
+#if defined(Q_OS_WIN)
+    return MoveFileExW((const wchar_t*)QDir::toNativeSeparators(from).utf16(), (const wchar_t*)QDir::toNativeSeparators(to).utf16(),
+        MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return ::rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#endif
+}
+
+/*
+ * Flush a file and make sure it has reached the disk
+ */
+bool JobJournal::sync(
+    QFile &file)
+{
+    if (!file.flush())
+        return false;
+#if defined(Q_OS_WIN)
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
+/*
+ * Return the journal counters for the status endpoint
+ */
+QVariantMap JobJournal::stats() const
+{
+    QVariantMap map;
+    map.insert("path", filePath);
+    map.insert("unfinished", pending.size());
+    map.insert("records", fileRecords);
+    map.insert("commits", commits);
+    map.insert("recordsCommitted", recordsCommitted);
+    map.insert("recordsPerCommit", commits > 0 ? double(recordsCommitted) / commits : 0.0);
+    map.insert("commitSeconds", commitSeconds);
+    map.insert("compactions", compactions);
+    map.insert("failures", failures);
+    map.insert("skipped", skipped);
+    return map;
+}
@@ -0,0 +1,102 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef JOBJOURNAL_H
+#define JOBJOURNAL_H
+
+#include <QObject>
+#include <QFile>
+#include <QMap>
+#include <QVariantMap>
+
+class QTimer;
+class Metrics;
+struct PrintJob;
+
+/*
+ * Append only journal of the jobs the REST server has accepted and what
+ * became of them, so jobs that were not printed survive a crash or restart.
+ * Records are written one JSON object per line. Syncing the file to disk is
+ * slow, so records are grouped and committed together a few milliseconds
+ * after the first of them, and the server holds back its answers until the
+ * records they depend on are committed. The journal is rewritten with just
+ * the unfinished jobs on startup and once finished jobs make up most of it.
+ */
+class JobJournal : public QObject
+{
+    Q_OBJECT
+public:
+    JobJournal(const QString &path, int commitDelay, QObject *parent = 0);
+    ~JobJournal();
+
+    bool open(QList<QVariantMap> *unfinished);
+    void setMetrics(Metrics *metrics) { this->metrics = metrics; }
+    void submitted(const PrintJob *job);
+    void started(int id);
+    void finished(int id, const QString &status);
+
+    QString path() const            { return filePath; }
+    int highestId() const           { return maxId; }
+    qint64 lastSequence() const     { return appended; }
+    qint64 committedSequence() const { return committedSeq; }
+    QVariantMap stats() const;
+
+signals:
+    void committed(qint64 sequence);
+    void failed(qint64 sequence);
+
+public slots:
+    void commit();
+
+private:
+    void append(const QVariantMap &record);
+    void apply(const QVariantMap &record);
+    bool compact();
+    bool reopen();
+    static bool sync(QFile &file);
+    static bool replace(const QString &from, const QString &to);
+
+    QString         filePath;
+    int             commitDelay;    // Milliseconds to gather records before committing them
+    QFile           file;           // Journal, open for appending
+    bool            torn;           // True if a failed commit may have left part of a record in the file
+    QByteArray      buffer;         // Records waiting to be committed
+    int             buffered;       // Number of records in the buffer
+    qint64          appended;       // Sequence number of the last record appended
+    qint64          committedSeq;   // Sequence number of the last record committed
+    QMap<int, QVariantMap> pending; // Records of the unfinished jobs, by job id
+    int             maxId;          // Highest job id ever journaled
+    int             fileRecords;    // Records in the journal file
+    int             commits;
+    qint64          recordsCommitted;
+    double          commitSeconds;  // Total time spent writing and syncing
+    int             compactions;
+    int             failures;       // Commits that could not be written
+    int             skipped;        // Damaged records skipped when replaying
+    QTimer          *commitTimer;
+    Metrics         *metrics;
+};
+
+#endif // JOBJOURNAL_H
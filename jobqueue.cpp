@@ -0,0 +1,636 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "jobqueue.h"
+#include "printhtml.h"
+#include "workerpool.h"
+#include "metrics.h"
+#include "trace.h"
+#include "jobjournal.h"
+#include <QTimer>
+
+/*
+ * Name of a job state as reported in the REST responses
+ */
+QString PrintJob::stateName(
+    State state)
+{
+    switch (state) {
+    case Queued:    return "queued";
+    case Running:   return "running";
+    case Completed: return "completed";
+    case Failed:    return "failed";
+    }
+    return "unknown";
+}
+
+/*
+ * Return the name of a priority lane
+ */
+QString PrintJob::priorityName(
+    Priority priority)
+{
+    return priority == Urgent ? "urgent" : "bulk";
+}
+
+/*
+ * Parse the name of a priority lane. Returns false if it is not one we know.
+ */
+bool PrintJob::parsePriority(
+    const QString &name,
+    Priority *priority)
+{
+    if (name.toLower() == "urgent")
+        *priority = Urgent;
+    else if (name.toLower() == "bulk")
+        *priority = Bulk;
+    else
+        return false;
+    return true;
+}
+
+/*
+ * Everything needed to run the job again, for the job journal
+ */
+QVariantMap PrintJob::toRecord() const
+{
+    QVariantMap record;
+    record.insert("id", id);
+    record.insert("priority", priorityName(priority));
+    record.insert("maxWait", maxWait);
+    record.insert("options", options.toMap());
+    record.insert("policy", policy.toMap());
+    record.insert("load", load.toMap());
+    record.insert("urls", urls);
+    if (!html.isEmpty()) {
+        QVariantMap documents;
+        QVariantMap bases;
+        foreach (int index, html.keys()) {
+            documents.insert(QString::number(index), html.value(index));
+            bases.insert(QString::number(index), baseUrls.value(index));
+        }
+        record.insert("html", documents);
+        record.insert("baseUrls", bases);
+    }
+    if (!records.isEmpty())
+        record.insert("records", records);
+    if (traced)
+        record.insert("trace", true);
+    record.insert("queuedAt", queuedAt);
+    return record;
+}
+
+/*
+ * Create a job from its record in the job journal
+ */
+PrintJob *PrintJob::fromRecord(
+    const QVariantMap &record)
+{
+    PrintJob *job = new PrintJob;
+    job->id = record.value("id").toInt();
+    parsePriority(record.value("priority").toString(), &job->priority);
+    job->maxWait = record.value("maxWait").toDouble();
+    job->options = PrintOptions::fromMap(record.value("options").toMap());
+    job->policy = ResourcePolicy::fromMap(record.value("policy").toMap());
+    job->load = LoadOptions::fromMap(record.value("load").toMap());
+    job->urls = record.value("urls").toStringList();
+    QVariantMap documents = record.value("html").toMap();
+    QVariantMap bases = record.value("baseUrls").toMap();
+    for (QVariantMap::const_iterator it = documents.constBegin(); it != documents.constEnd(); ++it) {
+        job->html.insert(it.key().toInt(), it.value().toString());
+        job->baseUrls.insert(it.key().toInt(), bases.value(it.key()).toString());
+    }
+    job->records = record.value("records").toList();
+    job->traced = record.value("trace").toBool();
+
+    // Times are written in UTC with a trailing Z
+    QDateTime queuedAt = QDateTime::fromString(record.value("queuedAt").toString().left(19), Qt::ISODate);
+    queuedAt.setTimeSpec(Qt::UTC);
+    job->queuedAt = queuedAt.isValid() ? queuedAt.toLocalTime() : QDateTime::currentDateTime();
+    return job;
+}
+
+/*
+ * Describe the job for the REST responses
+ */
+QVariantMap PrintJob::toMap() const
+{
+    QVariantMap map = options.toMap();
+    map.insert("id", id);
+    map.insert("status", stateName(state));
+    map.insert("priority", priorityName(priority));
+    map.insert("urls", urls);
+    if (!html.isEmpty()) {
+        map.insert("inline", true);
+        QStringList bases = baseUrls.values();
+        bases.removeAll(QString());
+        if (!bases.isEmpty())
+            map.insert("baseUrl", bases.first());
+    }
+    if (!records.isEmpty())
+        map.insert("records", records.size());
+    if (batch)
+        map.insert("batch", batch);
+    if (traced)
+        map.insert("trace", QString("/jobs/%1/trace").arg(id));
+    map.insert("queuedAt", queuedAt);
+    if (startedAt.isValid())
+        map.insert("startedAt", startedAt);
+    if (finishedAt.isValid()) {
+        map.insert("finishedAt", finishedAt);
+        map.insert("success", printed);
+        map.insert("error", failed);
+        if (!failures.isEmpty())
+            map.insert("failures", failures);
+        if (!files.isEmpty())
+            map.insert("files", files);
+        QVariantMap stats;
+        stats.insert("hits", cache.hits);
+        stats.insert("misses", cache.misses);
+        map.insert("cache", stats);
+        if (renders.hits + renders.misses > 0) {
+            QVariantMap renderStats;
+            renderStats.insert("hits", renders.hits);
+            renderStats.insert("misses", renders.misses);
+            map.insert("renders", renderStats);
+        }
+        map.insert("blocked", blocked);
+        if (!message.isEmpty())
+            map.insert("message", message);
+        if (!timings.isEmpty())
+            map.insert("timings", timings);
+    }
+    return map;
+}
+
+/*
+ * Constructor for the job queue
+ *
+ * PARAMETERS:
+ * pagePool     - Pool the jobs borrow their web pages from
+ * printerCache - Cache the jobs borrow their printers from
+ * parent       - Parent object
+ */
+JobQueue::JobQueue(
+    WebPagePool *pagePool,
+    PrinterCache *printerCache,
+    QObject *parent)
+    : QObject(parent), pagePool(pagePool), printerCache(printerCache), workerPool(0), metrics(0), journal(0), testMode(false), nextId(1), nextBatchId(1),
+      maxHistory(1000), maxQueued(0), maxRunning(0), dropped(0), averageRun(1)
+{
+    staleTimer = new QTimer(this);
+    staleTimer->setInterval(1000);
+    connect(staleTimer, SIGNAL(timeout()), this, SLOT(dropStale()));
+}
+
+/*
+ * Limit how much work we take on
+ *
+ * PARAMETERS:
+ * maxQueued    - Jobs each priority lane may hold waiting, 0 for no limit
+ * maxRunning   - Jobs that may print at the same time, 0 for one per printer
+ */
+void JobQueue::setLimits(
+    int maxQueued,
+    int maxRunning)
+{
+    this->maxQueued = qMax(0, maxQueued);
+    this->maxRunning = qMax(0, maxRunning);
+}
+
+/*
+ * True if the lane has room for the given number of new jobs
+ */
+bool JobQueue::hasRoom(
+    PrintJob::Priority priority,
+    int count) const
+{
+    return maxQueued <= 0 || queuedCount(priority) + count <= maxQueued;
+}
+
+/*
+ * Guess how many seconds a client turned away should wait before trying
+ * again, from how long it will take to work through the lane
+ */
+int JobQueue::retryAfter(
+    PrintJob::Priority priority) const
+{
+    int slots = maxRunning > 0 ? maxRunning : qMax(1, busy.size());
+    int seconds = int(queuedCount(priority) * averageRun / slots + 0.999);
+    return qBound(1, seconds, 300);
+}
+
+/*
+ * Print the jobs in worker processes rather than in this process
+ */
+void JobQueue::setWorkerPool(
+    WorkerPool *pool)
+{
+    workerPool = pool;
+    connect(pool, SIGNAL(jobFinished(int,QVariantMap)), this, SLOT(workerFinished(int,QVariantMap)));
+    connect(pool, SIGNAL(jobEvent(int,QVariantMap)), this, SIGNAL(jobEvent(int,QVariantMap)));
+}
+
+/*
+ * Destructor
+ */
+JobQueue::~JobQueue()
+{
+    foreach (PrintHtml *engine, engines.keys())
+        delete engine;
+    qDeleteAll(jobs);
+}
+
+/*
+ * Add a job to the queue for its printer and return the job id. The queue
+ * takes ownership of the job.
+ */
+int JobQueue::submit(
+    PrintJob *job)
+{
+    job->id = nextId++;
+    job->queuedAt = QDateTime::currentDateTime();
+    if (journal)
+        journal->submitted(job);
+    int id = job->id;
+    enqueue(job);
+    return id;
+}
+
+/*
+ * Queue a job again that was accepted before a restart, keeping its id and
+ * the time it was first queued
+ */
+void JobQueue::restore(
+    PrintJob *job)
+{
+    reserveIds(job->id);
+    enqueue(job);
+}
+
+/*
+ * Take back a job that has not started yet, failing it with the reason.
+ * Returns false if the job has already started or finished.
+ *
+ * PARAMETERS:
+ * id       - Job to take back
+ * reason   - Why it was taken back
+ */
+bool JobQueue::withdraw(
+    int id,
+    const QString &reason)
+{
+    PrintJob *job = jobs.value(id, 0);
+    if (!job || job->state != PrintJob::Queued)
+        return false;
+    queues[job->options.printer].removeAll(job);
+    job->state = PrintJob::Failed;
+    job->finishedAt = QDateTime::currentDateTime();
+    job->failed = job->urls;
+    job->message = reason;
+    if (journal)
+        journal->finished(job->id, "withdrawn");
+    if (metrics)
+        metrics->increment("jobs_total", "withdrawn");
+    retire(job);
+    emit jobFinished(job->id);
+    return true;
+}
+
+/*
+ * Add a job to its printer's queue and start it if we can
+ */
+void JobQueue::enqueue(
+    PrintJob *job)
+{
+    job->state = PrintJob::Queued;
+    if (job->traced)
+        job->tracedAt = Trace::now();
+    jobs.insert(job->id, job);
+
+    // Urgent jobs wait behind other urgent jobs for the printer, but ahead of bulk ones
+    QQueue<PrintJob*> &queue = queues[job->options.printer];
+    int pos = queue.size();
+    if (job->priority == PrintJob::Urgent) {
+        pos = 0;
+        while (pos < queue.size() && queue.at(pos)->priority == PrintJob::Urgent)
+            pos++;
+    }
+    queue.insert(pos, job);
+    if (job->maxWait > 0 && !staleTimer->isActive())
+        staleTimer->start();
+    startJobs();
+}
+
+/*
+ * Add an event to the trace of a job, if it is being traced
+ */
+void JobQueue::addTrace(
+    int id,
+    const QVariantMap &event)
+{
+    PrintJob *job = jobs.value(id, 0);
+    if (job && job->traced)
+        job->trace.append(event);
+}
+
+/*
+ * Group jobs submitted together so they can be looked up as a batch, and
+ * return the batch id
+ */
+int JobQueue::createBatch(
+    const QList<int> &jobIds)
+{
+    int id = nextBatchId++;
+    batches.insert(id, jobIds);
+    foreach (int jobId, jobIds) {
+        if (PrintJob *job = jobs.value(jobId, 0))
+            job->batch = id;
+    }
+    batchHistory.enqueue(id);
+    while (batchHistory.size() > maxHistory)
+        batches.remove(batchHistory.dequeue());
+    return id;
+}
+
+/*
+ * Look up a job by id, or return 0 if we don't know about it
+ */
+const PrintJob *JobQueue::job(
+    int id) const
+{
+    return jobs.value(id, 0);
+}
+
+/*
+ * Number of jobs waiting for their printer
+ */
+int JobQueue::queuedCount() const
+{
+    int count = 0;
+    foreach (const QQueue<PrintJob*> &queue, queues)
+        count += queue.size();
+    return count;
+}
+
+/*
+ * Number of jobs waiting in one priority lane
+ */
+int JobQueue::queuedCount(
+    PrintJob::Priority priority) const
+{
+    int count = 0;
+    foreach (const QQueue<PrintJob*> &queue, queues) {
+        foreach (const PrintJob *job, queue) {
+            if (job->priority == priority)
+                count++;
+        }
+    }
+    return count;
+}
+
+/*
+ * Drop waiting jobs that have waited longer than they may. By the time they
+ * printed, nobody would want them any more.
+ */
+void JobQueue::dropStale()
+{
+    QDateTime now = QDateTime::currentDateTime();
+    QList<PrintJob*> stale;
+    bool waiting = false;
+    for (QHash<QString, QQueue<PrintJob*> >::iterator it = queues.begin(); it != queues.end(); ++it) {
+        for (int i = it->size() - 1; i >= 0; i--) {
+            PrintJob *job = it->at(i);
+            if (job->maxWait <= 0)
+                continue;
+            if (job->queuedAt.msecsTo(now) >= job->maxWait * 1000)
+                stale.prepend(it->takeAt(i));
+            else
+                waiting = true;
+        }
+    }
+    if (!waiting)
+        staleTimer->stop();
+    foreach (PrintJob *job, stale) {
+        job->state = PrintJob::Failed;
+        job->finishedAt = now;
+        job->failed = job->urls;
+        job->message = "dropped after waiting too long to start";
+        if (job->traced) {
+            QVariantMap args;
+            args.insert("dropped", true);
+            job->trace.append(Trace::span(job->id, 0, "queued", job->tracedAt, Trace::now(), args));
+        }
+        dropped++;
+        if (journal)
+            journal->finished(job->id, "dropped");
+        if (metrics)
+            metrics->increment("jobs_total", "dropped");
+        retire(job);
+        emit jobFinished(job->id);
+    }
+}
+
+/*
+ * Start waiting jobs while we are allowed to run more. Printers that are
+ * already busy are skipped, urgent jobs go first and then the longest waiting.
+ */
+void JobQueue::startJobs()
+{
+    dropStale();
+    while (maxRunning <= 0 || busy.size() < maxRunning) {
+        PrintJob *next = 0;
+        for (QHash<QString, QQueue<PrintJob*> >::iterator it = queues.begin(); it != queues.end(); ) {
+            if (it->isEmpty()) {
+                it = queues.erase(it);
+                continue;
+            }
+            PrintJob *head = it->head();
+            if (!busy.contains(it.key())
+                && (!next || head->priority < next->priority || (head->priority == next->priority && head->id < next->id)))
+                next = head;
+            ++it;
+        }
+        if (!next)
+            return;
+        start(queues[next->options.printer].dequeue());
+    }
+}
+
+/*
+ * Start printing a job, in this process or in a worker
+ */
+void JobQueue::start(
+    PrintJob *job)
+{
+    QString printer = job->options.printer;
+    job->state = PrintJob::Running;
+    job->startedAt = QDateTime::currentDateTime();
+    busy.insert(printer, job);
+    if (journal)
+        journal->started(job->id);
+    if (metrics)
+        metrics->observe("queue", job->queuedAt.msecsTo(job->startedAt) / 1000.0);
+    if (job->traced) {
+        QVariantMap args;
+        args.insert("priority", PrintJob::priorityName(job->priority));
+        job->trace.append(Trace::span(job->id, 0, "queued", job->tracedAt, Trace::now(), args));
+    }
+    QVariantMap started;
+    started.insert("event", "started");
+    emit jobEvent(job->id, started);
+    if (workerPool) {
+        workerPool->dispatch(job, testMode);
+        return;
+    }
+
+    PrintHtml *engine = new PrintHtml(testMode, true, job->urls, job->options, false);
+    for (QMap<int, QString>::const_iterator it = job->html.constBegin(); it != job->html.constEnd(); ++it)
+        engine->setHtml(it.key(), it.value(), QUrl(job->baseUrls.value(it.key())));
+    if (!job->records.isEmpty())
+        engine->setMergeRecords(job->records);
+    engine->setPolicy(job->policy);
+    engine->setLoadOptions(job->load);
+    engine->setPagePool(pagePool);
+    engine->setPrinterCache(printerCache);
+    if (job->traced)
+        engine->setTracing(job->id, QString("job %1").arg(job->id));
+    engines.insert(engine, job);
+    connect(engine, SIGNAL(finished()), this, SLOT(engineFinished()));
+    connect(engine, SIGNAL(documentEvent(int,QString,QString)), this, SLOT(engineEvent(int,QString,QString)));
+    QTimer::singleShot(0, engine, SLOT(run()));
+}
+
+/*
+ * Pass on progress of one of the documents in a job printing in this process
+ */
+void JobQueue::engineEvent(
+    int index,
+    const QString &url,
+    const QString &event)
+{
+    PrintJob *job = engines.value(qobject_cast<PrintHtml*>(sender()), 0);
+    if (!job)
+        return;
+    QVariantMap map;
+    map.insert("index", index);
+    map.insert("url", url);
+    map.insert("event", event);
+    emit jobEvent(job->id, map);
+}
+
+/*
+ * Called when a job's print engine is done with all its URLs
+ */
+void JobQueue::engineFinished()
+{
+    PrintHtml *engine = qobject_cast<PrintHtml*>(sender());
+    PrintJob *job = engines.take(engine);
+    if (!job)
+        return;
+
+    // We are called from inside the engine, so let it unwind before it goes
+    engine->deleteLater();
+    job->printed = engine->printedUrls();
+    job->failed = engine->failedUrls();
+    job->failures = engine->failures();
+    job->files = engine->outputFiles();
+    job->cache = engine->cacheStats();
+    job->renders = engine->renderStats();
+    job->blocked = engine->blockedCount();
+    job->timings = engine->timings();
+    job->trace += engine->traceEvents();
+    complete(job);
+}
+
+/*
+ * Called when a worker process is done with a job
+ */
+void JobQueue::workerFinished(
+    int id,
+    const QVariantMap &result)
+{
+    PrintJob *job = jobs.value(id, 0);
+    if (!job || job->state != PrintJob::Running)
+        return;
+    job->printed = result.value("success").toStringList();
+    job->failed = result.value("error").toStringList();
+    job->cache.hits = result.value("cache").toMap().value("hits").toInt();
+    job->cache.misses = result.value("cache").toMap().value("misses").toInt();
+    job->renders.hits = result.value("renders").toMap().value("hits").toInt();
+    job->renders.misses = result.value("renders").toMap().value("misses").toInt();
+    job->blocked = result.value("blocked").toInt();
+    job->failures = result.value("failures").toList();
+    job->files = result.value("files").toList();
+    job->message = result.value("message").toString();
+    job->timings = result.value("timings").toList();
+    job->trace += result.value("trace").toList();
+    complete(job);
+}
+
+/*
+ * Mark the job as done and start the next one for its printer
+ */
+void JobQueue::complete(
+    PrintJob *job)
+{
+    job->state = job->failed.isEmpty() ? PrintJob::Completed : PrintJob::Failed;
+    job->finishedAt = QDateTime::currentDateTime();
+    busy.remove(job->options.printer);
+    renders += job->renders;
+    if (journal)
+        journal->finished(job->id, PrintJob::stateName(job->state));
+    if (metrics) {
+        metrics->increment("jobs_total", PrintJob::stateName(job->state));
+        metrics->increment("documents_total", "success", job->printed.size());
+        metrics->increment("documents_total", "error", job->failed.size());
+        metrics->increment("render_cache_total", "hit", job->renders.hits);
+        metrics->increment("render_cache_total", "miss", job->renders.misses);
+        static const char *phaseNames[] = { "load", "layout", "print" };
+        foreach (const QVariant &timing, job->timings) {
+            QVariantMap phases = timing.toMap();
+            for (int i = 0; i < 3; i++) {
+                if (phases.contains(phaseNames[i]))
+                    metrics->observe(phaseNames[i], phases.value(phaseNames[i]).toDouble());
+            }
+        }
+    }
+    if (job->startedAt.isValid())
+        averageRun = 0.8 * averageRun + 0.2 * job->startedAt.msecsTo(job->finishedAt) / 1000.0;
+    retire(job);
+    emit jobFinished(job->id);
+    startJobs();
+}
+
+/*
+ * Remember a finished job, forgetting the oldest ones once we have too many
+ */
+void JobQueue::retire(
+    PrintJob *job)
+{
+    history.enqueue(job->id);
+    while (history.size() > maxHistory)
+        delete jobs.take(history.dequeue());
+}
@@ -0,0 +1,174 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef JOBQUEUE_H
+#define JOBQUEUE_H
+
+#include <QObject>
+#include <QHash>
+#include <QMap>
+#include <QQueue>
+#include <QStringList>
+#include <QDateTime>
+#include <QVariantMap>
+#include "printoptions.h"
+#include "resourcepolicy.h"
+#include "loadoptions.h"
+#include "networkmanager.h"
+
+class QTimer;
+class PrintHtml;
+class WebPagePool;
+class PrinterCache;
+class WorkerPool;
+class Metrics;
+class JobJournal;
+
+/*
+ * A print job submitted to the REST server, and where it is up to
+ */
+struct PrintJob
+{
+    enum State { Queued, Running, Completed, Failed };
+    enum Priority { Urgent, Bulk };
+
+    int         id;
+    State       state;
+    Priority    priority;   // Lane the job waits in, urgent jobs go first
+    double      maxWait;    // Seconds the job may wait to start before it is dropped, 0 for ever
+    PrintOptions options;
+    ResourcePolicy policy;  // What the pages may load and run
+    LoadOptions load;       // When the pages print and how long the job may take
+    QStringList urls;       // URLs to print
+    QMap<int, QString> html; // HTML to print instead of loading the URL, by URL index
+    QMap<int, QString> baseUrls; // Base URL for relative links in the inline HTML
+    QVariantList records;   // Records to merge into the template, if a merge job
+    int         batch;      // Batch the job was submitted in, or 0
+    QStringList printed;    // URLs that were printed
+    QStringList failed;     // URLs that failed to load
+    QVariantList failures;  // Why each failed URL failed
+    QVariantList files;     // Files the pages were written to, if not printed
+    CacheStats  cache;      // Resource cache hits and misses
+    CacheStats  renders;    // Render cache hits and misses
+    int         blocked;    // Requests blocked by the resource policy
+    QString     message;    // Why the job failed, if it was not a page load
+    QVariantList timings;   // Seconds spent in each phase, for each URL
+    bool        traced;     // True to record a trace of the job
+    qint64      tracedAt;   // Trace clock when the job was queued
+    QVariantList trace;     // Trace events recorded so far
+    QDateTime   queuedAt;
+    QDateTime   startedAt;
+    QDateTime   finishedAt;
+
+    PrintJob() : id(0), state(Queued), priority(Bulk), maxWait(0), batch(0), blocked(0), traced(false), tracedAt(0) {}
+
+    static QString stateName(State state);
+    static QString priorityName(Priority priority);
+    static bool parsePriority(const QString &name, Priority *priority);
+    QVariantMap toMap() const;
+    QVariantMap toRecord() const;
+    static PrintJob *fromRecord(const QVariantMap &record);
+};
+
+/*
+ * Queue of print jobs. Every printer has its own FIFO queue and only ever has
+ * one job printing at a time, while jobs for different printers run side by
+ * side, up to a limit. Urgent jobs go ahead of bulk ones, and each lane only
+ * holds so many waiting jobs so the server can turn work away instead of
+ * running out of memory. Jobs that wait longer than they are allowed to are
+ * dropped. Finished jobs are kept for a while so their status can be looked
+ * up.
+ */
+class JobQueue : public QObject
+{
+    Q_OBJECT
+public:
+    JobQueue(WebPagePool *pagePool, PrinterCache *printerCache, QObject *parent = 0);
+    ~JobQueue();
+
+    void setWorkerPool(WorkerPool *pool);
+    void setMetrics(Metrics *metrics) { this->metrics = metrics; }
+    void setJournal(JobJournal *journal) { this->journal = journal; }
+    void setTestMode(bool testMode) { this->testMode = testMode; }
+    bool isTestMode() const { return testMode; }
+    void setLimits(int maxQueued, int maxRunning);
+    bool hasRoom(PrintJob::Priority priority, int count = 1) const;
+    int retryAfter(PrintJob::Priority priority) const;
+    int submit(PrintJob *job);
+    void restore(PrintJob *job);
+    bool withdraw(int id, const QString &reason);
+    void reserveIds(int highestId) { nextId = qMax(nextId, highestId + 1); }
+    int createBatch(const QList<int> &jobIds);
+    void addTrace(int id, const QVariantMap &event);
+    const PrintJob *job(int id) const;
+    QList<int> batch(int id) const { return batches.value(id); }
+    int queuedCount() const;
+    int queuedCount(PrintJob::Priority priority) const;
+    int droppedCount() const    { return dropped; }
+    int runningCount() const { return busy.size(); }
+    CacheStats renderStats() const { return renders; }
+
+signals:
+    void jobFinished(int id);
+    void jobEvent(int id, const QVariantMap &event);
+
+private slots:
+    void engineFinished();
+    void engineEvent(int index, const QString &url, const QString &event);
+    void workerFinished(int id, const QVariantMap &result);
+    void dropStale();
+
+private:
+    void startJobs();
+    void start(PrintJob *job);
+    void enqueue(PrintJob *job);
+    void complete(PrintJob *job);
+    void retire(PrintJob *job);
+
+    WebPagePool     *pagePool;
+    PrinterCache    *printerCache;
+    WorkerPool      *workerPool;    // Worker processes to print in, if any
+    Metrics         *metrics;       // Where to record job timings, if anywhere
+    JobJournal      *journal;       // Where accepted jobs are made durable, if anywhere
+    bool            testMode;       // True to load the pages without printing
+    int             nextId;
+    int             nextBatchId;
+    int             maxHistory;     // Number of finished jobs to remember
+    QHash<int, PrintJob*> jobs;     // All jobs we know about, by id
+    QHash<QString, QQueue<PrintJob*> > queues; // Waiting jobs, by printer
+    QHash<QString, PrintJob*> busy; // Job currently printing, by printer
+    QHash<PrintHtml*, PrintJob*> engines; // Running jobs, by their engine
+    QQueue<int>     history;        // Finished jobs, oldest first
+    QHash<int, QList<int> > batches; // Job ids of each batch
+    QQueue<int>     batchHistory;   // Batches, oldest first
+    CacheStats      renders;        // Render cache hits and misses of all jobs
+    int             maxQueued;      // Jobs each lane may hold waiting, 0 for no limit
+    int             maxRunning;     // Jobs that may print at once, 0 for one per printer
+    int             dropped;        // Jobs dropped for waiting too long
+    double          averageRun;     // Moving average of the seconds a job takes
+    QTimer          *staleTimer;    // Looks for jobs that have waited too long
+};
+
+#endif // JOBQUEUE_H
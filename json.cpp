@@ -0,0 +1,325 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "json.h"
+#include <QStringList>
+#include <QDateTime>
+
+/*
+ * Quote and escape a string for use in JSON
+ */
+QByteArray Json::quote(
+    const QString &str)
+{
+    QByteArray out;
+    out.reserve(str.size() + 2);
+    out += '"';
+    for (int i = 0; i < str.size(); i++) {
+        ushort c = str.at(i).unicode();
+        switch (c) {
+        case '"':   out += "\\\""; break;
+        case '\\':  out += "\\\\"; break;
+        case '\b':  out += "\\b"; break;
+        case '\f':  out += "\\f"; break;
+        case '\n':  out += "\\n"; break;
+        case '\r':  out += "\\r"; break;
+        case '\t':  out += "\\t"; break;
+        default:
+            if (c < 0x20 || c > 0x7e) {
+                char buf[8];
+                qsnprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += char(c);
+            }
+        }
+    }
+    out += '"';
+    return out;
+}
+
+/*
+ * Convert a variant into JSON text
+ */
+QByteArray Json::stringify(
+    const QVariant &value)
+{
+    switch (value.type()) {
+    case QVariant::Invalid:
+        return "null";
+    case QVariant::Bool:
+        return value.toBool() ? "true" : "false";
+    case QVariant::Int:
+    case QVariant::LongLong:
+        return QByteArray::number(value.toLongLong());
+    case QVariant::UInt:
+    case QVariant::ULongLong:
+        return QByteArray::number(value.toULongLong());
+    case QVariant::Double:
+        return QByteArray::number(value.toDouble(), 'g', 15);
+    case QVariant::DateTime:
+        return quote(value.toDateTime().toUTC().toString(Qt::ISODate) + "Z");
+    case QVariant::Map: {
+        QVariantMap map = value.toMap();
+        QByteArray out = "{";
+        for (QVariantMap::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+            if (it != map.constBegin())
+                out += ',';
+            out += quote(it.key());
+            out += ':';
+            out += stringify(it.value());
+        }
+        return out + "}";
+    }
+    case QVariant::List:
+    case QVariant::StringList: {
+        QVariantList list = value.toList();
+        QByteArray out = "[";
+        for (int i = 0; i < list.size(); i++) {
+            if (i > 0)
+                out += ',';
+            out += stringify(list.at(i));
+        }
+        return out + "]";
+    }
+    default:
+        return quote(value.toString());
+    }
+}
+
+/*
+ * Recursive descent parser for JSON text
+ */
+class JsonParser
+{
+public:
+    JsonParser(const QByteArray &json) : data(json), pos(0) {}
+
+    QVariant parseDocument(QString *error)
+    {
+        QVariant value = parseValue();
+        skipSpace();
+        if (errorMessage.isEmpty() && pos < data.size())
+            fail("unexpected data after JSON value");
+        if (error)
+            *error = errorMessage;
+        return errorMessage.isEmpty() ? value : QVariant();
+    }
+
+private:
+    void fail(const char *message)
+    {
+        if (errorMessage.isEmpty())
+            errorMessage = QString("%1 at offset %2").arg(message).arg(pos);
+    }
+
+    void skipSpace()
+    {
+        while (pos < data.size() && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\n' || data[pos] == '\r'))
+            pos++;
+    }
+
+    bool match(const char *word)
+    {
+        int len = qstrlen(word);
+        if (data.mid(pos, len) != word)
+            return false;
+        pos += len;
+        return true;
+    }
+
+    QVariant parseValue()
+    {
+        skipSpace();
+        if (pos >= data.size()) {
+            fail("unexpected end of JSON");
+            return QVariant();
+        }
+        char c = data[pos];
+        if (c == '{')
+            return parseObject();
+        if (c == '[')
+            return parseArray();
+        if (c == '"')
+            return parseString();
+        if (c == '-' || (c >= '0' && c <= '9'))
+            return parseNumber();
+        if (match("true"))
+            return true;
+        if (match("false"))
+            return false;
+        if (match("null"))
+            return QVariant();
+        fail("unexpected character");
+        return QVariant();
+    }
+
+    QVariant parseObject()
+    {
+        QVariantMap map;
+        pos++;
+        skipSpace();
+        if (pos < data.size() && data[pos] == '}') {
+            pos++;
+            return map;
+        }
+        while (errorMessage.isEmpty()) {
+            skipSpace();
+            if (pos >= data.size() || data[pos] != '"') {
+                fail("expected object key");
+                break;
+            }
+            QString key = parseString();
+            skipSpace();
+            if (pos >= data.size() || data[pos] != ':') {
+                fail("expected ':'");
+                break;
+            }
+            pos++;
+            map.insert(key, parseValue());
+            skipSpace();
+            if (pos < data.size() && data[pos] == ',') {
+                pos++;
+            } else if (pos < data.size() && data[pos] == '}') {
+                pos++;
+                break;
+            } else {
+                fail("expected ',' or '}'");
+            }
+        }
+        return map;
+    }
+
+    QVariant parseArray()
+    {
+        QVariantList list;
+        pos++;
+        skipSpace();
+        if (pos < data.size() && data[pos] == ']') {
+            pos++;
+            return list;
+        }
+        while (errorMessage.isEmpty()) {
+            list.append(parseValue());
+            skipSpace();
+            if (pos < data.size() && data[pos] == ',') {
+                pos++;
+            } else if (pos < data.size() && data[pos] == ']') {
+                pos++;
+                break;
+            } else {
+                fail("expected ',' or ']'");
+            }
+        }
+        return list;
+    }
+
+    QString parseString()
+    {
+        QByteArray utf8;
+        QString result;
+        pos++;
+        while (pos < data.size() && data[pos] != '"') {
+            char c = data[pos++];
+            if (c != '\\') {
+                utf8 += c;
+                continue;
+            }
+            if (pos >= data.size())
+                break;
+            c = data[pos++];
+            switch (c) {
+            case 'b':   utf8 += '\b'; break;
+            case 'f':   utf8 += '\f'; break;
+            case 'n':   utf8 += '\n'; break;
+            case 'r':   utf8 += '\r'; break;
+            case 't':   utf8 += '\t'; break;
+            case 'u': {
+                bool ok;
+                ushort code = data.mid(pos, 4).toUShort(&ok, 16);
+                if (!ok) {
+                    fail("invalid unicode escape");
+                    return result;
+                }
+                pos += 4;
+                result += QString::fromUtf8(utf8);
+                utf8.clear();
+                result += QChar(code);
+                break;
+            }
+            default:    utf8 += c; break;
+            }
+        }
+        if (pos >= data.size()) {
+            fail("unterminated string");
+            return result;
+        }
+        pos++;
+        return result + QString::fromUtf8(utf8);
+    }
+
+    QVariant parseNumber()
+    {
+        int start = pos;
+        bool integer = true;
+        if (data[pos] == '-')
+            pos++;
+        while (pos < data.size()) {
+            char c = data[pos];
+            if (c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+                integer = false;
+            else if (c < '0' || c > '9')
+                break;
+            pos++;
+        }
+        QByteArray text = data.mid(start, pos - start);
+        bool ok;
+        if (integer) {
+            qlonglong value = text.toLongLong(&ok);
+            if (ok)
+                return value;
+        }
+        double value = text.toDouble(&ok);
+        if (!ok)
+            fail("invalid number");
+        return value;
+    }
+
+    const QByteArray &data;
+    int         pos;
+    QString     errorMessage;
+};
+
+/*
+ * Parse JSON text into a variant. On error an invalid variant is returned
+ * and the error message is stored in error if given.
+ */
+QVariant Json::parse(
+    const QByteArray &json,
+    QString *error)
+{
+    JsonParser parser(json);
+    return parser.parseDocument(error);
+}
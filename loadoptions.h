@@ -0,0 +1,101 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef LOADOPTIONS_H
+#define LOADOPTIONS_H
+
+#include <QString>
+#include <QVariantMap>
+
+/*
+ * When a job's pages count as ready to print, and how long the job may
+ * take. Times are in seconds, 0 meaning no limit.
+ */
+struct LoadOptions
+{
+    enum Trigger {
+        Load,           // Print once the page and all its resources are loaded
+        DomReady,       // Print once the document is parsed (DOMContentLoaded)
+        Ready           // Print once the page sets window.printHtmlReady
+    };
+
+    Trigger trigger;
+    double  deadline;           // Seconds the whole job may take
+    double  resourceTimeout;    // Seconds any single request may take
+    bool    printOnDeadline;    // Print what has loaded at the deadline rather than fail
+
+    LoadOptions() : trigger(Load), deadline(0), resourceTimeout(0), printOnDeadline(false) {}
+
+    static QString triggerName(Trigger trigger)
+    {
+        switch (trigger) {
+        case DomReady:  return "domready";
+        case Ready:     return "ready";
+        default:        return "load";
+        }
+    }
+
+    /*
+     * Parse a trigger name, returning false if it is not one we know
+     */
+    static bool parseTrigger(const QString &name, Trigger *trigger)
+    {
+        QString lower = name.toLower();
+        if (lower == "load")
+            *trigger = Load;
+        else if (lower == "domready")
+            *trigger = DomReady;
+        else if (lower == "ready")
+            *trigger = Ready;
+        else
+            return false;
+        return true;
+    }
+
+    /*
+     * Convert to and from a variant map, used to hand jobs to worker processes
+     */
+    QVariantMap toMap() const
+    {
+        QVariantMap map;
+        map.insert("trigger", triggerName(trigger));
+        map.insert("deadline", deadline);
+        map.insert("resourceTimeout", resourceTimeout);
+        map.insert("onDeadline", printOnDeadline ? "print" : "fail");
+        return map;
+    }
+
+    static LoadOptions fromMap(const QVariantMap &map)
+    {
+        LoadOptions options;
+        parseTrigger(map.value("trigger").toString(), &options.trigger);
+        options.deadline = map.value("deadline", options.deadline).toDouble();
+        options.resourceTimeout = map.value("resourceTimeout", options.resourceTimeout).toDouble();
+        options.printOnDeadline = map.value("onDeadline").toString() == "print";
+        return options;
+    }
+};
+
+#endif // LOADOPTIONS_H
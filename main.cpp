@@ -25,6 +25,16 @@
 
 #include "printhtml.h"
 #include "restserver.h"
+#include "daemon.h"
+#include "stdinrunner.h"
+#include "commandline.h"
+#include "spooldirectory.h"
+#include "rendercache.h"
+#include "printerregistry.h"
+#include "trace.h"
+#include "processmemory.h"
+#include "webpagepool.h"
+#include "json.h"
 #include "globals.h"
 
 /*
@@ -38,34 +48,66 @@ int main(
     int argc,
     char *argv[])
 {
-    
-    double paperWidth = 0;
-    double paperHeight = 0;
+    // Parse the command line
+    QStringList args;
+    for (int i = 1; i < argc; i++)
+        args << QString::fromLocal8Bit(argv[i]);
+    CommandLine cmd;
+    bool valid = cmd.parse(args);
+
+    // If a resident daemon is running let it print for us, which saves
+    // starting up WebKit just to print one job
+    if (valid && cmd.canForward()) {
+        // The local socket needs an application for its event dispatcher
+        QVariantMap reply;
+        bool forwarded;
+        {
+            QCoreApplication core(argc, argv);
+            forwarded = Daemon::forward(args, &reply);
+        }
+        if (forwarded) {
+            QByteArray output = reply.value("output").toByteArray();
+            if (reply.isEmpty() && cmd.json) {
+                // Fail every URL, as a run that could not print them would
+                QVariantMap result;
+                QVariantList failures;
+                foreach (const QString &url, cmd.urls) {
+                    QVariantMap failure;
+                    failure.insert("url", url);
+                    failure.insert("reason", "lost connection to the daemon");
+                    failures.append(failure);
+                }
+                result.insert("error", cmd.urls);
+                result.insert("success", QStringList());
+                result.insert("failures", failures);
+                output = Json::stringify(result);
+            }
+            printf("%s", output.constData());
+            fflush(stdout);
+            QString title = reply.value("title").toString();
+            QString message = reply.value("message").toString();
+            if (reply.isEmpty() && !cmd.json) {
+                title = "Fatal Error";
+                message = "Lost connection to the PrintHtml daemon!";
+            }
+            if (!message.isEmpty()) {
+                QApplication app(argc, argv);
+                QMessageBox msgBox;
+                msgBox.setWindowTitle(title);
+                msgBox.setText(message);
+                msgBox.exec();
+            }
+            return reply.value("exitCode", -1).toInt();
+        }
+    }
 
     // Start the application. Must be a Windows app in order to use Qt WebKit
     QApplication app(argc, argv);
-    // Initialize QString for success and failed json array
-    QString succeeded = "";
-    QString failed = "";
-    // Parse the command line
-    QString printer = "Default";
-    double leftMargin = 0.5;
-    double topMargin = 0.5;
-    double rightMargin = 0.5;
-    double bottomMargin = 0.5;
-    QString paper = "A4";
-    QString orientation = "portrait";
-    int pageFrom = 0;
-    int pageTo = 0;
-    QStringList urls;
-
-    bool testMode = false;
-    bool json = false;
-    bool serverMode = false;
-    int serverPort = 8080;
+    app.setOrganizationName(SETTINGS_ORGANIZATION);
+    app.setApplicationName(SETTINGS_APPLICATION);
     if (argc < 2) {
         QString usage = "Usage: PrintHtml [-test] [-p printer] [-l left] [-t top] [-r right] [-b bottom] [-a paper] [-o orientation] [-pagefrom number] [-pageto number] [-server port] <url> [url2]\n\n";
-        usage += "-test                  \t - Don't print, just show what would have printed.\n \n";
+        usage += "-test                  \t - Don't print, just show what would have printed. In server mode, load jobs without printing them.\n \n";
         usage += "-p printer             \t - Printer to print to. Use 'Default' for default printer.\n \n";
         usage += "-json                  \t- Optional Stdout array of success and error without MsgBox. \n\n";
         usage += "-l left                \t - Optional left margin for page. (Default 0.5)\n \n";
@@ -75,8 +117,51 @@ int main(
         usage += "-a [A4|A5|Letter|width,height] \t - Optional paper type or custom size in mm. (Default A4)\n\n";
         usage += "-o [Portrait|Landscape]\t - Optional orientation type. (Default Portrait)\n \n";
         usage += "-server [port]        \t - Run as REST server on given port (default 8080).\n \n";
+        usage += "-workers number        \t - Optional. Print in this many worker processes in server mode. (Default 0, print in the server process)\n \n";
+        usage += "-workertimeout seconds \t - Optional. Restart a worker that takes longer than this over one job. (Default 120)\n \n";
+        usage += "-maxrequest kilobytes  \t - Optional. Largest request body the server accepts. (Default 8192)\n \n";
+        usage += "-idletimeout seconds   \t - Optional. Close server connections that are idle for this long. (Default 30)\n \n";
+        usage += "-queuedepth number     \t - Optional. Jobs each priority lane holds waiting before the server answers 429. (Default 500, 0 for no limit)\n \n";
+        usage += "-maxrunning number     \t - Optional. Jobs the server prints at the same time. (Default 8, 0 for one per printer)\n \n";
+        usage += "-maxconnections number \t - Optional. Client connections the server takes before answering 503. (Default 256, 0 for no limit)\n \n";
+        usage += "-maxwait seconds       \t - Optional. Drop server jobs that have waited this long to start. (Default 0, wait for ever)\n \n";
+        usage += "-prewarm host[,host]   \t - Optional. In server and daemon mode, keep connections open to these origins. (Default none)\n \n";
+        usage += "-prewarminterval seconds\t - Optional. How often to touch the -prewarm origins to keep the connections open. (Default 30)\n \n";
+        usage += "-printerrefresh seconds\t - Optional. In server and daemon mode, how often to read the installed printers again. (Default 60, 0 for never)\n \n";
+        usage += "-journal file          \t - Optional. In server mode, keep accepted jobs in this file so they survive a crash or restart. (Default none)\n \n";
+        usage += "-journalcommit ms      \t - Optional. Milliseconds to gather journal records before writing them to disk together. (Default 10)\n \n";
+        usage += "-recycle number        \t - Optional. In server and daemon mode, replace a web page after it has printed this many jobs. (Default 50, 0 for never)\n \n";
+        usage += "-maxrss megabytes      \t - Optional. In server and daemon mode, throw away the warm pages and WebKit's memory caches when the process grows past this. (Default 0, no limit)\n \n";
+        usage += "-webkitcache megabytes \t - Optional. In server and daemon mode, size of WebKit's memory cache. (Default 16)\n \n";
+        usage += "-poolsize number       \t - Optional. Number of warm web pages kept ready in server mode. (Default 2)\n \n";
         usage += "-pagefrom number       \t - Optional. Use for setting up the range of pages for printing. Corresponds to the first page in the page range for printing. (Must be used with \"-pageto\" parameter)\n \n";
         usage += "-pageto number         \t - Optional. Use for setting up the range of pages for printing. Corresponds to the last page in the page range for printing. (Must be used with \"-pagefrom\" parameter)\n \n";
+        usage += "-coalesce number       \t - Optional. Print up to this many documents as one spool job, each starting on a new page. (Default 0, one job per document)\n \n";
+        usage += "-output [printer|pdf|pbm|pwg]\t - Optional. Print, or write PDF or black and white PBM or PWG raster files to the spool directory. (Default printer)\n \n";
+        usage += "-dpi number            \t - Optional. Resolution of PBM and PWG output. (Default 203)\n \n";
+        usage += "-copies number         \t - Optional. Copies of each document, rendered once. (Default 1)\n \n";
+        usage += "-rendercache megabytes \t - Optional. Keep files rendered by -output for reprints, up to this size. (Default 100, 0 turns it off)\n \n";
+        usage += "-spooldir path         \t - Optional. Directory files are written to. (Default spool in the application data directory)\n \n";
+        usage += "-spoolkeep number      \t - Optional. Number of files kept in the spool directory, the oldest are deleted. (Default 1000, 0 keeps all)\n \n";
+        usage += "-concurrency number    \t - Optional. Number of URLs to load at the same time. Pages still print in order. (Default 1)\n \n";
+        usage += "-cachesize megabytes   \t - Optional. Maximum size of the shared resource cache. (Default 50)\n \n";
+        usage += "-cachettl seconds      \t - Optional. Keep static assets (CSS, scripts, images, fonts) cached this long regardless of HTTP headers. (Default 0, follow HTTP)\n \n";
+        usage += "-nocache               \t - Optional. Don't use the shared resource cache.\n \n";
+        usage += "-nojs                  \t - Optional. Don't run JavaScript in the pages.\n \n";
+        usage += "-noimages              \t - Optional. Don't load images.\n \n";
+        usage += "-plugins               \t - Optional. Allow plugins such as Flash.\n \n";
+        usage += "-nothirdparty          \t - Optional. Only load resources from the site of the page being printed.\n \n";
+        usage += "-allow host[,host]     \t - Optional. Only load resources from these hosts and their subdomains.\n \n";
+        usage += "-deny host[,host]      \t - Optional. Never load resources from these hosts and their subdomains.\n \n";
+        usage += "-trigger [load|domready|ready] \t - Optional. Print once the page has fully loaded, once its document is parsed, or once it sets window.printHtmlReady. (Default load)\n \n";
+        usage += "-deadline seconds      \t - Optional. Time the whole run may take. (Default 0, no limit)\n \n";
+        usage += "-ondeadline [fail|print]\t - Optional. At the deadline fail the pages still loading, or print what they have. (Default fail)\n \n";
+        usage += "-resourcetimeout seconds\t - Optional. Give up on any request a page makes that takes longer than this. (Default 0, no limit)\n \n";
+        usage += "-merge file.json       \t - Optional. Load the URL once as a template and print it for every record in the JSON array in the file.\n \n";
+        usage += "-trace file.json       \t - Optional. Write a timeline of the run that chrome://tracing and Perfetto open.\n \n";
+        usage += "-daemon                \t - Stay resident and print the jobs of later PrintHtml runs, which then skip starting up.\n \n";
+        usage += "-nodaemon              \t - Optional. Print in this process even if a daemon is running.\n \n";
+        usage += "-stdin                 \t - Read jobs from stdin, one JSON object per line, and write a JSON result line to stdout for each.\n \n";
         usage += "url                    \t - Defines the list of URLs to print, one after the other.\n \n \n";
         usage += "Note: Pages in a document are numbered according to the convention that the first page is page 1. However, if from and to are both set to 0, the whole document will be printed.";
 
@@ -86,52 +171,9 @@ int main(
         msgBox.exec();
         return -1;
     }
-    for (int i = 1; i < argc; i++) {
-        QString arg = argv[i];
-        if (arg == "-p")
-            printer = argv[++i];
-        else if (arg == "-test")
-            testMode = true;
-        else if (arg == "-l")
-            leftMargin = atof(argv[++i]);
-        else if (arg == "-t")
-            topMargin = atof(argv[++i]);
-        else if (arg == "-r")
-            rightMargin = atof(argv[++i]);
-        else if (arg == "-b")
-            bottomMargin = atof(argv[++i]);
-        else if (arg == "-a") {
-            paper = argv[++i];
-            if (paper.contains(',')) {
-                QStringList dims = paper.split(',');
-                if (dims.size() == 2) {
-                    bool ok1, ok2;
-                    paperWidth = dims[0].toDouble(&ok1);
-                    paperHeight = dims[1].toDouble(&ok2);
-                    if (!ok1 || !ok2 || paperWidth <= 0 || paperHeight <= 0) {
-                        QMessageBox::critical(0, "Invalid Size", "Invalid custom paper size provided in -a.");
-                        return -1;
-                    }
-                } else {
-                    QMessageBox::critical(0, "Invalid Format", "Custom size for -a should be in format width,height (e.g., 105,148).");
-                    return -1;
-                }
-            }
-        }else if (arg == "-o")
-            orientation = argv[++i];
-        else if (arg.toLower() == "-pagefrom")
-            pageFrom = atoi(argv[++i]);
-        else if (arg.toLower() == "-pageto")
-            pageTo = atoi(argv[++i]);
-        else if (arg == "-json")
-            json = true;
-        else if (arg == "-server") {
-            serverMode = true;
-            if (i + 1 < argc && QString(argv[i+1]).at(0) != '-')
-                serverPort = atoi(argv[++i]);
-        }
-        else
-            urls << arg;
+    if (!valid) {
+        QMessageBox::critical(0, cmd.errorTitle, cmd.errorText);
+        return -1;
     }
 
     // Find the application directory and store it in our global variable. Note
@@ -144,36 +186,118 @@ int main(
     // to look for them back one directory from the build directory. Confused yet!?
     QString dataPath = qApp->applicationDirPath();
 
-    // Now set the default SSL socket certificates for this program to our own CA bundle
-    QFile* caBundle = new QFile(dataPath + "/ca-bundle.crt");
-    if (caBundle->open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QSslSocket::setDefaultCaCertificates(QSslCertificate::fromDevice(caBundle));
-        caBundle->close();
-        delete caBundle;
-    } else {
+    // Use our own CA bundle for SSL. It is only parsed once the first HTTPS
+    // request is made, and then from a binary copy cached between runs.
+    QString caBundle = dataPath + "/ca-bundle.crt";
+    if (!QFile::exists(caBundle)) {
         QMessageBox msgBox;
         msgBox.setWindowTitle("Fatal Error");
         msgBox.setText("Cannot find SSL certificates bundle!");
         msgBox.exec();
         return -1;
     }
+    QString appData = QDesktopServices::storageLocation(QDesktopServices::DataLocation);
+    NetworkManager::instance()->setCaBundle(caBundle, appData + "/ca-bundle.cache");
 
     // Make sure we can find plugins relative to the current directory
     QStringList paths(app.libraryPaths());
     paths.prepend(dataPath + "/plugins");
     app.setLibraryPaths(paths);
 
-    if (serverMode) {
-        RestServer server;
-        if (!server.listen(serverPort)) {
+    // Share one resource cache between all the jobs and all runs of the program
+    if (cmd.useCache) {
+        NetworkManager::instance()->enableCache(appData + "/cache", qint64(cmd.cacheSize) * 1024 * 1024, cmd.cacheTtl);
+    }
+
+    // Pages rendered to files go to the spool directory, which only keeps the newest
+    SpoolDirectory::setPath(cmd.spoolDir.isEmpty() ? appData + "/spool" : cmd.spoolDir, cmd.spoolKeep);
+    RenderCache::enable(appData + "/renders", qint64(cmd.renderCacheSize) * 1024 * 1024);
+
+    // Resident processes connect to the origins their pages come from up front
+    if (!cmd.prewarm.isEmpty() && (cmd.serverMode || cmd.daemonMode || cmd.workerMode || cmd.stdinMode))
+        NetworkManager::instance()->prewarm(cmd.prewarm, cmd.prewarmInterval);
+
+    // Resident processes check jobs against a list of printers kept up to date
+    if (cmd.serverMode || cmd.daemonMode || cmd.workerMode || cmd.stdinMode)
+        PrinterRegistry::instance()->setRefreshInterval(cmd.printerRefresh);
+
+    // Keep the memory of resident processes flat however long they run
+    if (cmd.serverMode || cmd.daemonMode || cmd.workerMode || cmd.stdinMode) {
+        ProcessMemory::setWebKitCache(qint64(cmd.webkitCache) * 1024 * 1024);
+        WebPagePool::setRecycling(cmd.recycle, qint64(cmd.maxRss) * 1024 * 1024);
+    }
+
+    if (cmd.workerMode) {
+        Worker worker(cmd.workerServer, cmd.workerIndex, cmd.poolSize);
+        if (!worker.start())
+            return -1;
+        return app.exec();
+    }
+
+    if (cmd.daemonMode) {
+        Daemon daemon(cmd.poolSize);
+        if (!daemon.listen()) {
+            QMessageBox::critical(0, "Daemon Error", "Unable to start the daemon. Is one already running?");
+            return -1;
+        }
+        return app.exec();
+    }
+
+    if (cmd.stdinMode) {
+        StdinRunner runner(args, cmd.poolSize);
+        runner.start();
+        return app.exec();
+    }
+
+    if (cmd.serverMode) {
+        RestServer server(cmd.poolSize);
+        server.setLimits(cmd.limits);
+        server.setTestMode(cmd.testMode);
+        server.setPolicy(cmd.policy);
+        server.setLoadOptions(cmd.load);
+        server.setAdmission(cmd.queueDepth, cmd.maxRunning, cmd.maxConnections, cmd.maxWait);
+        if (cmd.workers > 0) {
+            // Workers use the same engine settings as the server
+            QStringList workerArgs;
+            workerArgs << "-poolsize" << QString::number(cmd.poolSize);
+            if (cmd.useCache)
+                workerArgs << "-cachesize" << QString::number(cmd.cacheSize) << "-cachettl" << QString::number(cmd.cacheTtl);
+            else
+                workerArgs << "-nocache";
+            workerArgs << "-spooldir" << SpoolDirectory::path() << "-spoolkeep" << QString::number(cmd.spoolKeep);
+            workerArgs << "-rendercache" << QString::number(cmd.renderCacheSize);
+            workerArgs << "-printerrefresh" << QString::number(cmd.printerRefresh);
+            workerArgs << "-recycle" << QString::number(cmd.recycle) << "-maxrss" << QString::number(cmd.maxRss);
+            workerArgs << "-webkitcache" << QString::number(cmd.webkitCache);
+            if (!cmd.prewarm.isEmpty())
+                workerArgs << "-prewarm" << cmd.prewarm.join(",") << "-prewarminterval" << QString::number(cmd.prewarmInterval);
+            server.setWorkers(cmd.workers, workerArgs, cmd.workerTimeout);
+        }
+        if (!cmd.journalFile.isEmpty() && !server.setJournal(cmd.journalFile, cmd.journalCommit)) {
+            QMessageBox::critical(0, "Server Error", "Unable to write the job journal " + cmd.journalFile);
+            return -1;
+        }
+        if (!server.listen(cmd.serverPort)) {
             QMessageBox::critical(0, "Server Error", "Unable to start server");
             return -1;
         }
         return app.exec();
     }
 
+    if (!cmd.mergeFile.isEmpty() && !cmd.loadMergeRecords()) {
+        QMessageBox::critical(0, cmd.errorTitle, cmd.errorText);
+        return -1;
+    }
+
     // Create the HTML printer class
-    PrintHtml printHtml(testMode, json, urls, printer, leftMargin, topMargin, rightMargin, bottomMargin, paper, orientation, pageFrom, pageTo, paperWidth, paperHeight, true);
+    PrintHtml printHtml(cmd.testMode, cmd.json, cmd.urls, cmd.options, true);
+    printHtml.setConcurrency(cmd.concurrency);
+    printHtml.setPolicy(cmd.policy);
+    printHtml.setLoadOptions(cmd.load);
+    if (!cmd.mergeFile.isEmpty())
+        printHtml.setMergeRecords(cmd.mergeRecords);
+    if (!cmd.traceFile.isEmpty())
+        printHtml.setTracing(int(QCoreApplication::applicationPid()), "PrintHtml");
 
     // Connect up the signals
     QObject::connect(&printHtml, SIGNAL(finished()), &app, SLOT(quit()));
@@ -182,5 +306,8 @@ int main(
     // This code will start the messaging engine in QT and in
     // 10ms it will start the execution in the PrintHtml.run routine;
     QTimer::singleShot(10, &printHtml, SLOT(run()));
-    return app.exec();
+    int exitCode = app.exec();
+    if (!cmd.traceFile.isEmpty())
+        Trace::write(cmd.traceFile, printHtml.traceEvents());
+    return exitCode;
 }
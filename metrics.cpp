@@ -0,0 +1,163 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "metrics.h"
+#include <QStringList>
+
+// Prefix for all the metric names
+#define METRICS_PREFIX      "printhtml_"
+
+/*
+ * Constructor for the metrics. The histogram buckets cover everything from
+ * a quick layout to a page load that hits the timeout.
+ */
+Metrics::Metrics()
+{
+    static const double buckets[] = { 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60 };
+    for (unsigned i = 0; i < sizeof(buckets) / sizeof(buckets[0]); i++)
+        bounds.append(buckets[i]);
+}
+
+/*
+ * Record how long a phase of a job took
+ *
+ * PARAMETERS:
+ * phase    - Name of the phase (queue, load, layout, print, response)
+ * seconds  - Time the phase took
+ */
+void Metrics::observe(
+    const QString &phase,
+    double seconds)
+{
+    QMap<QString, Histogram>::iterator it = phases.find(phase);
+    if (it == phases.end()) {
+        Histogram histogram;
+        histogram.counts.fill(0, bounds.size());
+        histogram.count = 0;
+        histogram.sum = 0;
+        it = phases.insert(phase, histogram);
+    }
+    for (int i = 0; i < bounds.size(); i++) {
+        if (seconds <= bounds[i])
+            it->counts[i]++;
+    }
+    it->count++;
+    it->sum += seconds;
+}
+
+/*
+ * Set the help text and label name for a counter family
+ */
+void Metrics::describe(
+    const QString &family,
+    const QString &labelName,
+    const QString &help)
+{
+    counters[family].labelName = labelName;
+    counters[family].help = help;
+}
+
+/*
+ * Add to a counter
+ *
+ * PARAMETERS:
+ * family   - Name of the counter family, without the prefix
+ * label    - Value of the family's label for this counter
+ * count    - Amount to add
+ */
+void Metrics::increment(
+    const QString &family,
+    const QString &label,
+    qint64 count)
+{
+    counters[family].values[label] += count;
+}
+
+/*
+ * Set a counter without a label that is counted elsewhere
+ *
+ * PARAMETERS:
+ * family   - Name of the counter, without the prefix
+ * value    - Total so far
+ */
+void Metrics::setCounter(
+    const QString &family,
+    qint64 value)
+{
+    counters[family].values[QString()] = value;
+}
+
+/*
+ * Set the current value of a gauge
+ */
+void Metrics::setGauge(
+    const QString &name,
+    double value)
+{
+    gauges[name] = value;
+}
+
+/*
+ * Write out all the metrics in the Prometheus text format
+ */
+QByteArray Metrics::text() const
+{
+    QStringList lines;
+    lines << "# HELP " METRICS_PREFIX "phase_seconds Time spent in each phase of a print job."
+          << "# TYPE " METRICS_PREFIX "phase_seconds histogram";
+    for (QMap<QString, Histogram>::const_iterator it = phases.constBegin(); it != phases.constEnd(); ++it) {
+        for (int i = 0; i < bounds.size(); i++) {
+            lines << QString(METRICS_PREFIX "phase_seconds_bucket{phase=\"%1\",le=\"%2\"} %3")
+                     .arg(it.key()).arg(bounds[i]).arg(it->counts[i]);
+        }
+        lines << QString(METRICS_PREFIX "phase_seconds_bucket{phase=\"%1\",le=\"+Inf\"} %2").arg(it.key()).arg(it->count);
+        lines << QString(METRICS_PREFIX "phase_seconds_sum{phase=\"%1\"} %2").arg(it.key()).arg(it->sum, 0, 'f', 6);
+        lines << QString(METRICS_PREFIX "phase_seconds_count{phase=\"%1\"} %2").arg(it.key()).arg(it->count);
+    }
+
+    for (QMap<QString, Family>::const_iterator it = counters.constBegin(); it != counters.constEnd(); ++it) {
+        QString name = METRICS_PREFIX + it.key();
+        if (!it->help.isEmpty())
+            lines << QString("# HELP %1 %2").arg(name, it->help);
+        lines << QString("# TYPE %1 counter").arg(name);
+        for (QMap<QString, qint64>::const_iterator value = it->values.constBegin(); value != it->values.constEnd(); ++value) {
+            if (it->labelName.isEmpty())
+                lines << QString("%1 %2").arg(name).arg(value.value());
+            else
+                lines << QString("%1{%2=\"%3\"} %4").arg(name, it->labelName, value.key()).arg(value.value());
+        }
+    }
+
+    for (QMap<QString, double>::const_iterator it = gauges.constBegin(); it != gauges.constEnd(); ++it) {
+        lines << QString("# TYPE " METRICS_PREFIX "%1 gauge").arg(it.key());
+        // Whole numbers such as byte counts are written out in full, not rounded to six digits
+        double value = it.value();
+        if (value == qint64(value))
+            lines << QString(METRICS_PREFIX "%1 %2").arg(it.key()).arg(qint64(value));
+        else
+            lines << QString(METRICS_PREFIX "%1 %2").arg(it.key()).arg(value, 0, 'g', 15);
+    }
+    return lines.join("\n").toUtf8() + "\n";
+}
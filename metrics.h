@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QByteArray>
+#include <QString>
+#include <QMap>
+#include <QVector>
+
+/*
+ * Latency histograms and counters for the REST server, written out in the
+ * Prometheus text exposition format. Each histogram and counter family has a
+ * single label (eg: phase="load" or status="completed"), except counters
+ * kept elsewhere and set as a whole, which have none.
+ */
+class Metrics
+{
+public:
+    Metrics();
+
+    void observe(const QString &phase, double seconds);
+    void increment(const QString &family, const QString &label, qint64 count = 1);
+    void setCounter(const QString &family, qint64 value);
+    void setGauge(const QString &name, double value);
+    void describe(const QString &family, const QString &labelName, const QString &help);
+    QByteArray text() const;
+
+private:
+    struct Histogram {
+        QVector<quint64> counts;    // Observations at or below each bucket bound
+        quint64     count;
+        double      sum;
+    };
+    struct Family {
+        QString     labelName;
+        QString     help;
+        QMap<QString, qint64> values;
+    };
+
+    QVector<double> bounds;         // Upper bounds of the histogram buckets
+    QMap<QString, Histogram> phases;
+    QMap<QString, Family> counters;
+    QMap<QString, double> gauges;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,429 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "networkmanager.h"
+#include "certificatecache.h"
+#include "trace.h"
+#include <QNetworkReply>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QWebPage>
+#include <QWebFrame>
+#include <QSslSocket>
+#include <QTimer>
+
+/*
+ * Constructor for the disk cache
+ */
+DiskCache::DiskCache(
+    QObject *parent)
+    : QNetworkDiskCache(parent), forcedTtl(0)
+{
+}
+
+/*
+ * True if the URL looks like a static asset that is safe to keep for the
+ * forced time to live
+ */
+bool DiskCache::isStaticAsset(
+    const QUrl &url)
+{
+    static const char *suffixes[] = {
+        "css", "js", "png", "jpg", "jpeg", "gif", "svg", "ico", "bmp", "webp",
+        "woff", "woff2", "ttf", "otf", "eot", 0
+    };
+    QString suffix = QFileInfo(url.path()).suffix().toLower();
+    for (int i = 0; suffixes[i]; i++) {
+        if (suffix == suffixes[i])
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Called before a response is written to the cache. When a forced time to
+ * live is set, static assets are stored with that expiry and without the
+ * headers that would make us revalidate them.
+ */
+QIODevice *DiskCache::prepare(
+    const QNetworkCacheMetaData &metaData)
+{
+    if (forcedTtl <= 0 || !isStaticAsset(metaData.url()))
+        return QNetworkDiskCache::prepare(metaData);
+
+    QNetworkCacheMetaData forced = metaData;
+    QNetworkCacheMetaData::RawHeaderList headers;
+    foreach (const QNetworkCacheMetaData::RawHeader &header, metaData.rawHeaders()) {
+        QByteArray name = header.first.toLower();
+        if (name != "cache-control" && name != "pragma" && name != "expires")
+            headers.append(header);
+    }
+    forced.setRawHeaders(headers);
+    forced.setExpirationDate(QDateTime::currentDateTime().addSecs(forcedTtl));
+    forced.setSaveToDisk(true);
+    return QNetworkDiskCache::prepare(forced);
+}
+
+/*
+ * Constructor for a blocked reply. The error is reported once we are back in
+ * the event loop, as the caller has to connect to the reply first.
+ */
+BlockedReply::BlockedReply(
+    QNetworkAccessManager::Operation op,
+    const QNetworkRequest &request,
+    QObject *parent)
+    : QNetworkReply(parent)
+{
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(op);
+    setError(ContentAccessDenied, "Blocked by the resource policy");
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+    QTimer::singleShot(0, this, SLOT(fail()));
+}
+
+void BlockedReply::fail()
+{
+    emit error(ContentAccessDenied);
+    emit finished();
+}
+
+/*
+ * Constructor for a reply timeout. The timeout goes away with the reply.
+ */
+ReplyTimeout::ReplyTimeout(
+    QNetworkReply *reply,
+    int msecs)
+    : QObject(reply), reply(reply)
+{
+    QTimer::singleShot(msecs, this, SLOT(expire()));
+}
+
+void ReplyTimeout::expire()
+{
+    if (!reply->isRunning())
+        return;
+    emit timedOut(reply);
+    reply->abort();
+}
+
+/*
+ * Return the network manager shared by all the web pages in the process
+ */
+NetworkManager *NetworkManager::instance()
+{
+    static NetworkManager *manager = 0;
+    if (!manager)
+        manager = new NetworkManager(QCoreApplication::instance());
+    return manager;
+}
+
+/*
+ * Constructor for the network manager
+ */
+NetworkManager::NetworkManager(
+    QObject *parent)
+    : QNetworkAccessManager(parent), diskCache_(0), caLoaded(false), totalBlocked(0), requestIds(0), warmTimer(0)
+{
+    connect(this, SIGNAL(finished(QNetworkReply*)), this, SLOT(replyFinished(QNetworkReply*)));
+}
+
+/*
+ * Turn on the shared disk cache
+ *
+ * PARAMETERS:
+ * directory    - Directory to keep the cache in
+ * maxSize      - Maximum size of the cache in bytes
+ * forcedTtl    - Seconds to keep static assets regardless of their HTTP
+ *                headers, or 0 to follow the HTTP caching rules
+ */
+void NetworkManager::enableCache(
+    const QString &directory,
+    qint64 maxSize,
+    int forcedTtl)
+{
+    diskCache_ = new DiskCache(this);
+    diskCache_->setCacheDirectory(directory);
+    diskCache_->setMaximumCacheSize(maxSize);
+    diskCache_->setForcedTtl(forcedTtl);
+    setCache(diskCache_);
+}
+
+/*
+ * Set the CA bundle to trust. The bundle is not loaded until the first HTTPS
+ * request, so runs that only print http and file URLs never pay for it.
+ *
+ * PARAMETERS:
+ * bundlePath   - PEM bundle with the trusted CA certificates
+ * cachePath    - File to keep a binary copy of the bundle in
+ */
+void NetworkManager::setCaBundle(
+    const QString &bundlePath,
+    const QString &cachePath)
+{
+    caBundlePath = bundlePath;
+    caCachePath = cachePath;
+    caLoaded = false;
+}
+
+/*
+ * Make our CA bundle the default for every SSL socket
+ */
+void NetworkManager::loadCertificates()
+{
+    caLoaded = true;
+    if (!caBundlePath.isEmpty())
+        QSslSocket::setDefaultCaCertificates(CertificateCache::load(caBundlePath, caCachePath));
+}
+
+/*
+ * Filter the page's requests through a resource policy until it is attached
+ * again
+ *
+ * PARAMETERS:
+ * page         - Page the policy is for
+ * policy       - Hosts the page may load resources from
+ * documentUrl  - Document the page is printing, which is never blocked
+ */
+void NetworkManager::setPolicy(
+    QWebPage *page,
+    const ResourcePolicy &policy,
+    const QUrl &documentUrl)
+{
+    if (!policy.filtersRequests()) {
+        policies.remove(page);
+        return;
+    }
+    PagePolicy pagePolicy;
+    pagePolicy.policy = policy;
+    pagePolicy.documentUrl = documentUrl;
+    policies.insert(page, pagePolicy);
+}
+
+/*
+ * Turn away requests the page's resource policy does not allow, load the CA
+ * bundle just before the first HTTPS request goes out and time requests
+ * against the page's resource timeout
+ */
+QNetworkReply *NetworkManager::createRequest(
+    Operation op,
+    const QNetworkRequest &request,
+    QIODevice *outgoingData)
+{
+    QWebFrame *frame = qobject_cast<QWebFrame*>(request.originatingObject());
+    QWebPage *page = frame ? frame->page() : 0;
+    if (page && policies.contains(page)) {
+        const PagePolicy &pagePolicy = policies[page];
+        if (request.url() != pagePolicy.documentUrl && !pagePolicy.policy.allows(request.url(), pagePolicy.documentUrl)) {
+            blockedCounts[page]++;
+            totalBlocked++;
+            // Blocked replies never reach replyFinished(), so they are traced here
+            if (tracedPages.contains(page)) {
+                QVariantMap args;
+                args.insert("blocked", true);
+                qint64 now = Trace::now();
+                pageTraces[page] += Trace::request(++requestIds, request.url().toString(), now, now, args);
+            }
+            return new BlockedReply(op, request, this);
+        }
+    }
+    if (!caLoaded && request.url().scheme() == "https")
+        loadCertificates();
+    QNetworkReply *reply = QNetworkAccessManager::createRequest(op, request, outgoingData);
+    if (page && tracedPages.contains(page))
+        requestStarts.insert(reply, Trace::now());
+    int timeout = page ? resourceTimeouts.value(page) : 0;
+    if (timeout > 0) {
+        ReplyTimeout *replyTimeout = new ReplyTimeout(reply, timeout);
+        connect(replyTimeout, SIGNAL(timedOut(QNetworkReply*)), this, SLOT(replyTimedOut(QNetworkReply*)));
+    }
+    return reply;
+}
+
+/*
+ * Give up on any request the page makes that takes longer than this, until
+ * the page is attached again
+ *
+ * PARAMETERS:
+ * page     - Page the timeout is for
+ * msecs    - Milliseconds any one request may take, 0 for no limit
+ */
+void NetworkManager::setResourceTimeout(
+    QWebPage *page,
+    int msecs)
+{
+    if (msecs > 0)
+        resourceTimeouts.insert(page, msecs);
+    else
+        resourceTimeouts.remove(page);
+}
+
+/*
+ * Count a request that was given up on against the page that made it
+ */
+void NetworkManager::replyTimedOut(
+    QNetworkReply *reply)
+{
+    QWebFrame *frame = qobject_cast<QWebFrame*>(reply->request().originatingObject());
+    if (frame && frame->page())
+        timeoutCounts[frame->page()]++;
+}
+
+/*
+ * Make the web page load everything through the shared manager, and start
+ * counting its cache hits from zero
+ */
+void NetworkManager::attach(
+    QWebPage *page)
+{
+    if (page->networkAccessManager() != this)
+        page->setNetworkAccessManager(this);
+    connect(page, SIGNAL(destroyed(QObject*)), this, SLOT(pageDestroyed(QObject*)), Qt::UniqueConnection);
+    pageStats.remove(page);
+    policies.remove(page);
+    blockedCounts.remove(page);
+    resourceTimeouts.remove(page);
+    timeoutCounts.remove(page);
+    tracedPages.remove(page);
+    pageTraces.remove(page);
+}
+
+/*
+ * Forget everything we hold for a page that has been destroyed, so recycled
+ * pages don't leave anything behind in a long running process
+ */
+void NetworkManager::pageDestroyed(
+    QObject *object)
+{
+    QWebPage *page = static_cast<QWebPage*>(object);
+    pageStats.remove(page);
+    policies.remove(page);
+    blockedCounts.remove(page);
+    resourceTimeouts.remove(page);
+    timeoutCounts.remove(page);
+    tracedPages.remove(page);
+    pageTraces.remove(page);
+}
+
+/*
+ * Record a trace event for every request the page makes from now on, until
+ * it is attached again. The events are collected with takeTrace().
+ */
+void NetworkManager::setTracing(
+    QWebPage *page,
+    bool on)
+{
+    if (on)
+        tracedPages.insert(page);
+    else
+        tracedPages.remove(page);
+}
+
+/*
+ * Return the cache counters for the page since it was attached or last
+ * asked, and reset them
+ */
+CacheStats NetworkManager::takeStats(
+    QWebPage *page)
+{
+    return pageStats.take(page);
+}
+
+/*
+ * Count every HTTP response as either a cache hit or a miss, both overall
+ * and for the page that asked for it
+ */
+void NetworkManager::replyFinished(
+    QNetworkReply *reply)
+{
+    QWebFrame *frame = qobject_cast<QWebFrame*>(reply->request().originatingObject());
+    if (requestStarts.contains(reply)) {
+        qint64 start = requestStarts.take(reply);
+        if (frame && tracedPages.contains(frame->page())) {
+            QVariantMap args;
+            args.insert("status", reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt());
+            args.insert("fromCache", reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool());
+            if (reply->error() != QNetworkReply::NoError)
+                args.insert("error", reply->errorString());
+            pageTraces[frame->page()] += Trace::request(++requestIds, reply->url().toString(), start, Trace::now(), args);
+        }
+    }
+
+    QString scheme = reply->url().scheme();
+    if ((scheme != "http" && scheme != "https") || reply->operation() != GetOperation)
+        return;
+
+    bool fromCache = reply->attribute(QNetworkRequest::SourceIsFromCacheAttribute).toBool();
+    CacheStats *counters[2] = { &totals, 0 };
+    if (frame && frame->page())
+        counters[1] = &pageStats[frame->page()];
+    for (int i = 0; i < 2 && counters[i]; i++) {
+        if (fromCache)
+            counters[i]->hits++;
+        else
+            counters[i]->misses++;
+    }
+}
+
+/*
+ * Keep connections open to the origins the pages come from. Every job shares
+ * this network manager, and with it Qt's pool of keep-alive connections for
+ * each host and its cache of DNS lookups, so only the first request to an
+ * origin pays for the DNS lookup, the TCP connect and the TLS handshake. A
+ * HEAD request to each origin does that up front, and is repeated every so
+ * often so the connection doesn't go idle and get closed by the server.
+ *
+ * PARAMETERS:
+ * origins  - Origins to connect to, as URLs or host names (https assumed)
+ * interval - Seconds between requests to keep the connections open, 0 to
+ *            only connect once
+ */
+void NetworkManager::prewarm(
+    const QStringList &origins,
+    int interval)
+{
+    warmOrigins.clear();
+    foreach (const QString &origin, origins)
+        warmOrigins.append(QUrl(origin.contains("://") ? origin : "https://" + origin + "/"));
+    warmConnections();
+    if (interval > 0 && !warmOrigins.isEmpty()) {
+        if (!warmTimer) {
+            warmTimer = new QTimer(this);
+            connect(warmTimer, SIGNAL(timeout()), this, SLOT(warmConnections()));
+        }
+        warmTimer->start(interval * 1000);
+    }
+}
+
+/*
+ * Make a request to each origin we keep connections open to
+ */
+void NetworkManager::warmConnections()
+{
+    foreach (const QUrl &origin, warmOrigins) {
+        QNetworkReply *reply = head(QNetworkRequest(origin));
+        connect(reply, SIGNAL(finished()), reply, SLOT(deleteLater()));
+    }
+}
@@ -0,0 +1,180 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef NETWORKMANAGER_H
+#define NETWORKMANAGER_H
+
+#include <QNetworkAccessManager>
+#include <QNetworkDiskCache>
+#include <QNetworkReply>
+#include <QHash>
+#include <QSet>
+#include <QUrl>
+#include "resourcepolicy.h"
+
+class QWebPage;
+class QTimer;
+
+/*
+ * Disk cache for page resources. Normally follows the HTTP caching rules,
+ * but can be told to keep static assets (style sheets, scripts, images and
+ * fonts) for a fixed time no matter what the server says.
+ */
+class DiskCache : public QNetworkDiskCache
+{
+    Q_OBJECT
+public:
+    explicit DiskCache(QObject *parent = 0);
+
+    void setForcedTtl(int seconds)  { forcedTtl = seconds; }
+    QIODevice *prepare(const QNetworkCacheMetaData &metaData);
+
+private:
+    static bool isStaticAsset(const QUrl &url);
+
+    int forcedTtl;                  // Seconds to keep static assets, 0 to follow HTTP
+};
+
+/*
+ * Reply for a request the page's resource policy does not allow. It fails
+ * straight away without touching the network.
+ */
+class BlockedReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    BlockedReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent = 0);
+
+    void abort() {}
+    qint64 bytesAvailable() const   { return 0; }
+
+protected:
+    qint64 readData(char *, qint64) { return -1; }
+
+private slots:
+    void fail();
+};
+
+/*
+ * Aborts a reply that is still running when its time is up
+ */
+class ReplyTimeout : public QObject
+{
+    Q_OBJECT
+public:
+    ReplyTimeout(QNetworkReply *reply, int msecs);
+
+signals:
+    void timedOut(QNetworkReply *reply);
+
+private slots:
+    void expire();
+
+private:
+    QNetworkReply   *reply;
+};
+
+/*
+ * Counters for requests served from the cache and from the network
+ */
+struct CacheStats
+{
+    int hits;
+    int misses;
+
+    CacheStats() : hits(0), misses(0) {}
+    CacheStats &operator+=(const CacheStats &other)
+    {
+        hits += other.hits;
+        misses += other.misses;
+        return *this;
+    }
+};
+
+/*
+ * Network access manager shared by every web page in the process, so all
+ * jobs share the same resource cache. Cache hits are counted per page so
+ * each job can report its own.
+ */
+class NetworkManager : public QNetworkAccessManager
+{
+    Q_OBJECT
+public:
+    static NetworkManager *instance();
+
+    void enableCache(const QString &directory, qint64 maxSize, int forcedTtl);
+    DiskCache *diskCache() const    { return diskCache_; }
+    void attach(QWebPage *page);
+    CacheStats takeStats(QWebPage *page);
+    CacheStats stats() const        { return totals; }
+    void setCaBundle(const QString &bundlePath, const QString &cachePath);
+    void setPolicy(QWebPage *page, const ResourcePolicy &policy, const QUrl &documentUrl);
+    int takeBlocked(QWebPage *page) { return blockedCounts.take(page); }
+    int blocked() const             { return totalBlocked; }
+    void setResourceTimeout(QWebPage *page, int msecs);
+    int takeTimeouts(QWebPage *page) { return timeoutCounts.take(page); }
+    void prewarm(const QStringList &origins, int interval);
+    void setTracing(QWebPage *page, bool on);
+    QVariantList takeTrace(QWebPage *page) { return pageTraces.take(page); }
+
+protected:
+    QNetworkReply *createRequest(Operation op, const QNetworkRequest &request, QIODevice *outgoingData = 0);
+
+private slots:
+    void replyFinished(QNetworkReply *reply);
+    void replyTimedOut(QNetworkReply *reply);
+    void warmConnections();
+    void pageDestroyed(QObject *page);
+
+private:
+    explicit NetworkManager(QObject *parent = 0);
+
+    void loadCertificates();
+
+    struct PagePolicy {
+        ResourcePolicy policy;
+        QUrl        documentUrl;    // Document the page is loading, always allowed
+    };
+
+    DiskCache       *diskCache_;
+    QString         caBundlePath;   // CA bundle to load before the first HTTPS request
+    QString         caCachePath;    // Binary copy of the CA bundle
+    bool            caLoaded;
+    CacheStats      totals;
+    QHash<QWebPage*, CacheStats> pageStats;
+    QHash<QWebPage*, PagePolicy> policies; // Pages with requests to filter
+    QHash<QWebPage*, int> blockedCounts; // Requests blocked, by page
+    QHash<QWebPage*, int> resourceTimeouts; // Milliseconds any request may take, by page
+    QHash<QWebPage*, int> timeoutCounts; // Requests that timed out, by page
+    int             totalBlocked;
+    QSet<QWebPage*> tracedPages;    // Pages whose requests are traced
+    QHash<QWebPage*, QVariantList> pageTraces; // Trace events of finished requests, by page
+    QHash<QNetworkReply*, qint64> requestStarts; // When each traced request was made
+    int             requestIds;     // Number of the last traced request
+    QList<QUrl>     warmOrigins;    // Origins to keep connections open to
+    QTimer          *warmTimer;
+};
+
+#endif // NETWORKMANAGER_H
@@ -0,0 +1,140 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "printercache.h"
+#include "printerregistry.h"
+#include <QPrinter>
+
+/*
+ * Constructor for the printer cache
+ *
+ * PARAMETERS:
+ * maxEntries   - Maximum number of idle printer configurations to keep
+ */
+PrinterCache::PrinterCache(
+    int maxEntries)
+    : maxEntries(maxEntries), useCounter(0), cacheHits(0), cacheMisses(0)
+{
+}
+
+/*
+ * Destructor. Deletes all the cached printers.
+ */
+PrinterCache::~PrinterCache()
+{
+    foreach (const Entry &entry, entries)
+        delete entry.printer;
+}
+
+/*
+ * Create a new printer configured for the given page setup. The page range is
+ * left for the caller to set as it changes from job to job.
+ */
+QPrinter *PrinterCache::createPrinter(
+    const PrintOptions &options)
+{
+    QPrinter *printer = new QPrinter(QPrinter::HighResolution);
+    if (options.toFile()) {
+        // Rendered to files, so the page geometry comes from Qt's PDF engine
+        printer->setOutputFormat(QPrinter::PdfFormat);
+    } else if (options.printer != "Default") {
+        printer->setPrinterName(options.printer);
+    }
+
+    if (options.orientation == "Landscape") {
+        printer->setOrientation(QPrinter::Landscape);
+    }
+    else {
+        printer->setOrientation(QPrinter::Portrait);
+    }
+
+    if (options.customSize()) {
+        printer->setPaperSize(QSizeF(options.paperWidth, options.paperHeight), QPrinter::Millimeter);
+    } else {
+        printer->setPaperSize(PrinterRegistry::paperSize(options.paper));
+    }
+
+    printer->setPageMargins(options.leftMargin, options.topMargin, options.rightMargin, options.bottomMargin, QPrinter::Inch);
+    return printer;
+}
+
+/*
+ * Borrow a printer configured for the given page setup, creating and caching
+ * one if we have not seen this configuration before.
+ */
+QPrinter *PrinterCache::acquire(
+    const PrintOptions &options)
+{
+    QString key = options.printerKey();
+    QHash<QString, Entry>::iterator it = entries.find(key);
+    if (it != entries.end()) {
+        cacheHits++;
+    } else {
+        cacheMisses++;
+        Entry entry;
+        entry.printer = createPrinter(options);
+        entry.refs = 0;
+        it = entries.insert(key, entry);
+    }
+    it->refs++;
+    it->lastUsed = ++useCounter;
+    QPrinter *printer = it->printer;
+    evict();
+    return printer;
+}
+
+/*
+ * Give a printer back to the cache
+ */
+void PrinterCache::release(
+    QPrinter *printer)
+{
+    for (QHash<QString, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+        if (it->printer == printer) {
+            if (it->refs > 0)
+                it->refs--;
+            break;
+        }
+    }
+    evict();
+}
+
+/*
+ * Drop the least recently used idle printers until we are within our limit
+ */
+void PrinterCache::evict()
+{
+    while (entries.size() > maxEntries) {
+        QHash<QString, Entry>::iterator oldest = entries.end();
+        for (QHash<QString, Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+            if (it->refs == 0 && (oldest == entries.end() || it->lastUsed < oldest->lastUsed))
+                oldest = it;
+        }
+        if (oldest == entries.end())
+            return;
+        delete oldest->printer;
+        entries.erase(oldest);
+    }
+}
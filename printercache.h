@@ -0,0 +1,72 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PRINTERCACHE_H
+#define PRINTERCACHE_H
+
+#include <QHash>
+#include <QString>
+#include "printoptions.h"
+
+class QPrinter;
+
+/*
+ * Cache of configured printers keyed by their page setup. Setting the printer
+ * name, paper size, orientation and margins all go back to the system print
+ * backend, so repeat jobs borrow an already configured printer instead. Only
+ * printers that are not in use are ever evicted.
+ */
+class PrinterCache
+{
+public:
+    explicit PrinterCache(int maxEntries = 16);
+    ~PrinterCache();
+
+    QPrinter *acquire(const PrintOptions &options);
+    void release(QPrinter *printer);
+
+    static QPrinter *createPrinter(const PrintOptions &options);
+
+    int hits() const        { return cacheHits; }
+    int misses() const      { return cacheMisses; }
+    int count() const       { return entries.size(); }
+
+private:
+    struct Entry {
+        QPrinter    *printer;
+        int         refs;       // Number of jobs currently using the printer
+        quint64     lastUsed;   // Value of useCounter when last acquired
+    };
+
+    void evict();
+
+    QHash<QString, Entry> entries;
+    int             maxEntries;
+    quint64         useCounter;
+    int             cacheHits;
+    int             cacheMisses;
+};
+
+#endif // PRINTERCACHE_H
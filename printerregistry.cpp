@@ -0,0 +1,201 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "printerregistry.h"
+#include <QPrinterInfo>
+#include <QTimer>
+#include <QCoreApplication>
+
+/*
+ * Names of Qt's paper sizes, in the order of the QPrinter::PaperSize enum
+ */
+static const char *paperNames[] = {
+    "A4", "B5", "Letter", "Legal", "Executive", "A0", "A1", "A2", "A3", "A5",
+    "A6", "A7", "A8", "A9", "B0", "B1", "B10", "B2", "B3", "B4", "B6", "B7",
+    "B8", "B9", "C5E", "Comm10E", "DLE", "Folio", "Ledger", "Tabloid", "Custom"
+};
+
+/*
+ * Return the registry shared by the whole process
+ */
+PrinterRegistry *PrinterRegistry::instance()
+{
+    static PrinterRegistry *registry = 0;
+    if (!registry)
+        registry = new PrinterRegistry(QCoreApplication::instance());
+    return registry;
+}
+
+/*
+ * Constructor for the printer registry. The printers are not read until they
+ * are first needed.
+ */
+PrinterRegistry::PrinterRegistry(
+    QObject *parent)
+    : QObject(parent), refreshTimer(0)
+{
+}
+
+/*
+ * Read the printers again every so often, so printers added or removed while
+ * we run are picked up without every job asking the print backend
+ *
+ * PARAMETERS:
+ * seconds  - Seconds between refreshes, 0 to only read them once
+ */
+void PrinterRegistry::setRefreshInterval(
+    int seconds)
+{
+    if (seconds <= 0) {
+        if (refreshTimer)
+            refreshTimer->stop();
+        return;
+    }
+    if (!refreshTimer) {
+        refreshTimer = new QTimer(this);
+        connect(refreshTimer, SIGNAL(timeout()), this, SLOT(refresh()));
+    }
+    refreshTimer->start(seconds * 1000);
+}
+
+/*
+ * Read the list of printers and their paper sizes from the print backend
+ */
+void PrinterRegistry::refresh()
+{
+    QList<Printer> printers;
+    foreach (const QPrinterInfo &info, QPrinterInfo::availablePrinters()) {
+        Printer printer;
+        printer.name = info.printerName();
+        printer.isDefault = info.isDefault();
+        printer.paperSizes = info.supportedPaperSizes();
+        printers.append(printer);
+    }
+    list = printers;
+    refreshedAt = QDateTime::currentDateTime();
+}
+
+/*
+ * Find a printer by name. 'Default' finds the default printer, if the
+ * backend has one.
+ */
+const PrinterRegistry::Printer *PrinterRegistry::find(
+    const QString &name) const
+{
+    for (int i = 0; i < list.size(); i++) {
+        if (name == "Default" ? list.at(i).isDefault : list.at(i).name == name)
+            return &list.at(i);
+    }
+    return 0;
+}
+
+/*
+ * Check a job can be printed before loading any of it: the printer has to be
+ * installed and take the paper size. Custom paper sizes are left to the
+ * driver, as backends don't list the sizes they can cut. A printer we don't
+ * know makes us read the list again first, in case it has just been added.
+ * Only printers named by the job are checked. The default printer, and any
+ * printer when Qt can't list them, are left to QPrinter to find as they
+ * always were. Jobs written to files can always be printed.
+ *
+ * PARAMETERS:
+ * options  - Page setup of the job
+ * error    - Set to why the job can't be printed
+ */
+bool PrinterRegistry::check(
+    const PrintOptions &options,
+    QString *error)
+{
+    if (options.toFile() || options.printer.isEmpty() || options.printer == "Default")
+        return true;
+    if (refreshedAt.isNull())
+        refresh();
+    const Printer *printer = find(options.printer);
+    if (!printer && refreshedAt.secsTo(QDateTime::currentDateTime()) > 5) {
+        refresh();
+        printer = find(options.printer);
+    }
+    if (!printer) {
+        if (list.isEmpty())
+            return true;
+        *error = QString("unknown printer '%1'").arg(options.printer);
+        return false;
+    }
+    if (!options.customSize() && !printer->paperSizes.isEmpty()) {
+        QPrinter::PaperSize size = paperSize(options.paper);
+        if (!printer->paperSizes.contains(size)) {
+            *error = QString("printer '%1' does not take %2 paper").arg(printer->name, paperName(size));
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Return the printers and the paper sizes they take, for the /printers
+ * endpoint
+ */
+QVariantList PrinterRegistry::printers()
+{
+    if (refreshedAt.isNull())
+        refresh();
+    QVariantList result;
+    foreach (const Printer &printer, list) {
+        QStringList sizes;
+        foreach (QPrinter::PaperSize size, printer.paperSizes)
+            sizes << paperName(size);
+        QVariantMap map;
+        map.insert("name", printer.name);
+        map.insert("default", printer.isDefault);
+        map.insert("paperSizes", sizes);
+        result.append(map);
+    }
+    return result;
+}
+
+/*
+ * Return the paper size for a paper name given in a job. Anything we don't
+ * know prints on Letter.
+ */
+QPrinter::PaperSize PrinterRegistry::paperSize(
+    const QString &paper)
+{
+    if (paper == "A4")
+        return QPrinter::A4;
+    if (paper == "A5")
+        return QPrinter::A5;
+    return QPrinter::Letter;
+}
+
+/*
+ * Return the name of a paper size
+ */
+QString PrinterRegistry::paperName(
+    QPrinter::PaperSize size)
+{
+    if (size < 0 || size >= int(sizeof(paperNames) / sizeof(paperNames[0])))
+        return "Custom";
+    return paperNames[size];
+}
@@ -0,0 +1,77 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PRINTERREGISTRY_H
+#define PRINTERREGISTRY_H
+
+#include <QObject>
+#include <QList>
+#include <QDateTime>
+#include <QPrinter>
+#include <QVariantList>
+#include "printoptions.h"
+
+class QTimer;
+
+/*
+ * The printers installed on the system and the paper sizes they take. Asking
+ * the print backend is slow, so the list is read once and refreshed on a
+ * timer, and jobs are checked against it before any page is loaded. Shared by
+ * everything in the process.
+ */
+class PrinterRegistry : public QObject
+{
+    Q_OBJECT
+public:
+    static PrinterRegistry *instance();
+
+    void setRefreshInterval(int seconds);
+    bool check(const PrintOptions &options, QString *error);
+    QVariantList printers();
+    QDateTime refreshed() const     { return refreshedAt; }
+
+    static QPrinter::PaperSize paperSize(const QString &paper);
+    static QString paperName(QPrinter::PaperSize size);
+
+public slots:
+    void refresh();
+
+private:
+    explicit PrinterRegistry(QObject *parent = 0);
+
+    struct Printer {
+        QString     name;
+        bool        isDefault;
+        QList<QPrinter::PaperSize> paperSizes; // Empty if the backend doesn't say
+    };
+
+    const Printer *find(const QString &name) const;
+
+    QList<Printer>  list;
+    QDateTime       refreshedAt;    // When the list was last read, null if never
+    QTimer          *refreshTimer;
+};
+
+#endif // PRINTERREGISTRY_H
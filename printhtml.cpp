@@ -29,66 +29,174 @@
 #include <QDebug>
 
 
-#include "restserver.h"
+#include "json.h"
+#include "webpagepool.h"
+#include "printercache.h"
+#include "printerregistry.h"
 #include <QUrl>
 #include <QTimer>
+#include <QRegExp>
+#include <QWebElement>
+#include <QTextDocument>
+#include <QPainter>
+#include <QFileInfo>
+#include "rasterwriter.h"
+#include "spooldirectory.h"
+#include "rendercache.h"
+#include "trace.h"
+#include <QCryptographicHash>
+#include <QNetworkReply>
 /*
  * Constructor for the HTML printing class
  */
-PrintHtml::PrintHtml(bool testMode, bool json, QStringList urls, QString selectedPrinter, double leftMargin, double topMargin,
-                     double rightMargin, double bottomMargin, QString paper, QString orientation, int pageFrom, int pageTo,
-                     double paperWidth, double paperHeight, bool exitOnCompletion, QTcpSocket *client, QByteArray resp)
+PrintHtml::PrintHtml(bool testMode, bool json, QStringList urls, const PrintOptions &options, bool exitOnCompletion)
 {
     // Get the instance of the main application
     app = QCoreApplication::instance();
 
-    // Create our printer and set the defaults
-    printer = new QPrinter(QPrinter::HighResolution);
-    if (selectedPrinter != "Default") {
-        printer->setPrinterName(selectedPrinter);
-    }
-
-    if(orientation == "Landscape") {
-        printer->setOrientation(QPrinter::Landscape);
-    }
-    else {
-        printer->setOrientation(QPrinter::Portrait);
-    }
-
-    if (paperWidth > 0 && paperHeight > 0) {
-        printer->setPaperSize(QSizeF(paperWidth, paperHeight), QPrinter::Millimeter);
-    } else if (paper == "A4") {
-        printer->setPaperSize(QPrinter::A4);
-    } else if (paper == "A5") {
-        printer->setPaperSize(QPrinter::A5);
-    } else {
-        printer->setPaperSize(QPrinter::Letter);
-    }
-
-
-    printer->setPageMargins(leftMargin, topMargin, rightMargin, bottomMargin, QPrinter::Inch);
+    // Save the page setup. The printer is created (or borrowed from the
+    // cache) when we start running
+    this->options = options;
+    printer = 0;
+    printerCache = 0;
+    spool = 0;
+    raster = 0;
+    spoolSheets = 0;
 
-    if(pageFrom > 0 && pageTo > 0) {
-        printer->setPrintRange(QPrinter::PageRange);
-        printer->setFromTo(pageFrom,pageTo);
-    }
-
-    // Create our web page
-    webPage = new QWebPage();
+    // Web pages are created (or borrowed from the pool) as we load the URLs
+    pagePool = 0;
 
     // Save the URL
     this->urls = urls;
+    nextToLoad = 0;
+    nextToPrint = 0;
+    concurrency = 1;
+    finishedAll = false;
 
     // Save test mode
     this->testMode = testMode;
     this->json = json;
-    // Store custom paper size inputs
-    this->paperWidth = paperWidth;
-    this->paperHeight = paperHeight;
-    this->paperSizeName = paper;
     this->exitOnCompletion = exitOnCompletion;
-    this->client = client;
-    this->resp = resp;
+    interactive = true;
+    exitCode_ = 0;
+    blocked = 0;
+    mergeMode = false;
+    mergePage = 0;
+    mergeLoaded = false;
+    tracing = false;
+    traceProcess = 0;
+    traceStart = 0;
+
+    // Timers for the job deadline and for polling the print trigger
+    deadlinePassed = false;
+    deadlineTimer = new QTimer(this);
+    deadlineTimer->setSingleShot(true);
+    connect(deadlineTimer, SIGNAL(timeout()), this, SLOT(deadlineExpired()));
+    readyTimer = new QTimer(this);
+    readyTimer->setInterval(50);
+    connect(readyTimer, SIGNAL(timeout()), this, SLOT(checkReady()));
+}
+
+/*
+ * Print the first URL as a template once for every record, instead of
+ * printing the URLs. Each record is reported as the template URL followed
+ * by #n, counting from 1.
+ *
+ * PARAMETERS:
+ * records  - Data to merge into the template, one map per document
+ */
+void PrintHtml::setMergeRecords(
+    const QVariantList &records)
+{
+    mergeMode = true;
+    mergeRecords = records;
+    mergeTemplate = urls.value(0);
+    urls.clear();
+    for (int i = 0; i < records.size(); i++)
+        urls << QString("%1#%2").arg(mergeTemplate).arg(i + 1);
+}
+
+/*
+ * Record a trace of the job: how long each document took to load, lay out
+ * and print, and every request its page made
+ *
+ * PARAMETERS:
+ * process  - Process the events go in, the job id in the server
+ * name     - Name of the process in the trace viewer
+ */
+void PrintHtml::setTracing(
+    int process,
+    const QString &name)
+{
+    tracing = true;
+    traceProcess = process;
+    trace.append(Trace::processName(process, name));
+}
+
+/*
+ * Add a span to the trace, from the given time on our clock until now
+ *
+ * PARAMETERS:
+ * thread   - Document index plus one, or 0 for the job itself
+ * name     - What took the time
+ * start    - Seconds on our clock when it started
+ * args     - Details shown with the span
+ */
+void PrintHtml::traceSpan(
+    int thread,
+    const QString &name,
+    double start,
+    const QVariantMap &args)
+{
+    if (tracing)
+        trace.append(Trace::span(traceProcess, thread, name, traceStart + qint64(start * 1e6), traceStart + qint64(elapsed() * 1e6), args));
+}
+
+/*
+ * Set when pages count as ready to print and how long the job may take
+ */
+void PrintHtml::setLoadOptions(
+    const LoadOptions &loadOptions)
+{
+    this->loadOptions = loadOptions;
+}
+
+/*
+ * Turn off message boxes and stdout for a job run on behalf of someone else.
+ * Whatever the job would have shown or written is kept so it can be passed
+ * on instead.
+ */
+void PrintHtml::setInteractive(
+    bool interactive)
+{
+    this->interactive = interactive;
+}
+
+/*
+ * Set how many URLs may be loading (or loaded and waiting for their turn to
+ * print) at the same time. Pages are always printed in the original order.
+ */
+void PrintHtml::setConcurrency(
+    int count)
+{
+    concurrency = qMax(1, count);
+}
+
+/*
+ * Print the given HTML for the URL at the index instead of loading the URL.
+ * The URL is then only used as the document's name in the results.
+ *
+ * PARAMETERS:
+ * index    - Index of the document in the URL list
+ * html     - HTML to print
+ * baseUrl  - URL relative links in the HTML are resolved against
+ */
+void PrintHtml::setHtml(
+    int index,
+    const QString &html,
+    const QUrl &baseUrl)
+{
+    inlineHtml.insert(index, qMakePair(html, baseUrl));
 }
 
 /*
@@ -98,7 +206,36 @@ PrintHtml::PrintHtml(bool testMode, bool json, QStringList urls, QString selecte
  */
 void PrintHtml::run()
 {
-    loadNextUrl();
+    clock.start();
+    traceStart = Trace::now();
+    if (loadOptions.deadline > 0)
+        deadlineTimer->start(int(loadOptions.deadline * 1000));
+
+    // Turn the job down before loading anything if it can't be printed
+    QString reason;
+    if (!this->testMode && !PrinterRegistry::instance()->check(options, &reason)) {
+        reject(reason);
+        return;
+    }
+
+    // Create our printer, borrowing an already configured one if we can
+    if (!printer)
+        printer = printerCache ? printerCache->acquire(options) : PrinterCache::createPrinter(options);
+
+    // Start loading the first batch of URLs
+    while (loadNextUrl())
+        ;
+    if (urls.isEmpty())
+        finish(true);
+}
+
+/*
+ * Destructor for the HTML printing class. Gives the web pages back to the
+ * pool if they were borrowed from one.
+ */
+PrintHtml::~PrintHtml()
+{
+    aboutToQuitApp();
 }
 
 /*
@@ -110,116 +247,902 @@ void PrintHtml::quit()
 }
 
 /*
- * 10ms after the application starts this method will run
- * all QT messaging is running at this point so threads, signals and slots
- * will all work as expected.
+ * Start loading the next URL if we have not loaded them all yet, and we are
+ * not already loading as many as we are allowed to at once. Returns true if
+ * we started loading another URL.
  */
 bool PrintHtml::loadNextUrl()
 {
     // Grab the URL to print. If there are none left, return false
-    if (this->urls.isEmpty()) {
+    if (nextToLoad >= urls.size() || loading.size() + loaded.size() + probes.size() >= concurrency) {
         return false;
     }
-    this->url = this->urls.takeFirst();
 
-    // Load the HTML into the web page
-    webPage->mainFrame()->load(this->url);
-    webPage->disconnect();
-    connect(webPage, SIGNAL(loadFinished(bool)), this, SLOT(htmlLoaded(bool)));
+    // A merge only ever loads the template
+    if (mergeMode && nextToLoad > 0)
+        return false;
+    int index = nextToLoad++;
+
+    // Once the job is out of time the rest of the URLs fail straight away
+    if (deadlinePassed) {
+        expire(index);
+        return true;
+    }
+
+    // Documents we have rendered before are copied from the render cache
+    if (RenderCache::isEnabled() && !this->testMode && options.toFile() && options.coalesce == 0 && !mergeMode)
+        probeRender(index);
+    else
+        startLoad(index);
 
     // Return true indicating we loaded it
     return true;
 }
 
 /*
- * Function called when the web page for the HTML has finished loading
+ * Fail a document that had not finished loading when the job ran out of time
  */
-void PrintHtml::htmlLoaded(
-        bool ok)
+void PrintHtml::expire(
+    int index)
 {
-    if (this->json) {
-        if (ok) {
-            // Print the page if not in test mode
-            if (!this->testMode) {
-                webPage->mainFrame()->print(printer);
-            }
-            printed << this->url;
-            if (!loadNextUrl()) {
-                // Bail if that was the last one
-                if (this->testMode) {
-                    printf("{\"success\":\"" + this->url.toLatin1() + "\"}");
-                }
-                // Start making the STDOUT JSON when hit the last url
-                for (QStringList::Iterator S =  printed.begin(); S != printed.end(); S++) {
-                    succeeded += "\"" + *S + "\"";
-                    if (S != printed.end() && succeeded.lastIndexOf(QChar(',')) != succeeded.length() - 1) {
-                        succeeded += ",";
-                    }
-
-                }
-                for (QStringList::Iterator S = error.begin(); S != error.end(); S++) {
-                    failed += "\"" + *S + "\"";
-                    if (S != error.end() && failed.lastIndexOf(QChar(',')) != failed.length() - 1) {
-                        failed += ",";
-                    }
-
-                }
-                printf("{\"error\":[" + failed.left(failed.length() - 1).toLatin1() + "],\"success\":[" + succeeded.left(succeeded.length() - 1).toLatin1() + "]}");
-                if (exitOnCompletion)
-                    QCoreApplication::exit(0);
+    phases[index].insert("url", urls.at(index));
+    reasons.insert(index, "deadline exceeded");
+    loaded.insert(index, qMakePair((QWebPage*)0, false));
+    emit documentEvent(index, urls.at(index), "failed");
+}
+
+/*
+ * Work out which version of the document we are about to print, to look it
+ * up in the render cache. Inline HTML is identified by a hash of the HTML,
+ * local files by their modification time and size, and web pages by the ETag
+ * and Last-Modified headers from a HEAD request. Documents that can't be
+ * identified are always loaded.
+ */
+void PrintHtml::probeRender(
+    int index)
+{
+    QString url = urls.at(index);
+    if (inlineHtml.contains(index)) {
+        QPair<QString, QUrl> document = inlineHtml.value(index);
+        QByteArray hash = QCryptographicHash::hash((document.second.toString() + "\n" + document.first).toUtf8(), QCryptographicHash::Sha1);
+        renderFound(index, "html:" + hash.toHex());
+        return;
+    }
+    QUrl location(url);
+    if (location.scheme() == "file") {
+        QFileInfo info(location.toLocalFile());
+        renderFound(index, info.exists() ? QString("%1|%2|%3").arg(url, info.lastModified().toString(Qt::ISODate)).arg(info.size()) : QString());
+    } else if (location.scheme() == "http" || location.scheme() == "https") {
+        QNetworkReply *reply = NetworkManager::instance()->head(QNetworkRequest(location));
+        probes.insert(reply, index);
+        connect(reply, SIGNAL(finished()), this, SLOT(probeFinished()));
+    } else {
+        renderFound(index, QString());
+    }
+}
+
+/*
+ * The HEAD request for a document is done, so we know which version of it
+ * the server has
+ */
+void PrintHtml::probeFinished()
+{
+    QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || !probes.contains(reply))
+        return;
+    int index = probes.take(reply);
+    reply->deleteLater();
+    if (finishedAll)
+        return;
+    QString document;
+    QByteArray etag = reply->rawHeader("ETag");
+    QByteArray modified = reply->rawHeader("Last-Modified");
+    if (reply->error() == QNetworkReply::NoError && (!etag.isEmpty() || !modified.isEmpty()))
+        document = urls.at(index) + "|" + etag + "|" + modified;
+    renderFound(index, document);
+}
+
+/*
+ * Print the document from the render cache if it is there, otherwise load
+ * it and remember the key to store it under once it has been rendered.
+ *
+ * PARAMETERS:
+ * index    - Index of the document in the URL list
+ * document - Identifies the version of the document, empty if we can't tell
+ */
+void PrintHtml::renderFound(
+    int index,
+    const QString &document)
+{
+    if (document.isEmpty()) {
+        startLoad(index);
+        return;
+    }
+    QString key = RenderCache::key(document, options, policy, loadOptions);
+    QString file = RenderCache::lookup(key, options.output);
+    if (file.isEmpty()) {
+        renders.misses++;
+        renderKeys.insert(index, key);
+        startLoad(index);
+        return;
+    }
+
+    // We may be inside loadNextUrl(), so print it once we are back in the event loop
+    renders.hits++;
+    cachedFiles.insert(index, file);
+    phases[index].insert("url", urls.at(index));
+    phases[index].insert("trigger", "cache");
+    loaded.insert(index, qMakePair((QWebPage*)0, true));
+    emit documentEvent(index, urls.at(index), "loaded");
+    QTimer::singleShot(0, this, SLOT(printQueued()));
+}
+
+/*
+ * Print whatever is ready once we are back in the event loop
+ */
+void PrintHtml::printQueued()
+{
+    if (!finishedAll)
+        printReady();
+}
+
+/*
+ * Start loading the document into a web page, borrowing a warm one if we can
+ */
+void PrintHtml::startLoad(
+    int index)
+{
+    QWebPage *page;
+    if (!spare.isEmpty())
+        page = spare.takeFirst();
+    else
+        page = pagePool ? pagePool->acquire() : new QWebPage();
+    page->disconnect(this);
+    page->mainFrame()->disconnect(this);
+    NetworkManager::instance()->attach(page);
+    NetworkManager::instance()->setResourceTimeout(page, int(loadOptions.resourceTimeout * 1000));
+    if (tracing) {
+        NetworkManager::instance()->setTracing(page, true);
+        trace.append(Trace::threadName(traceProcess, index + 1, urls.at(index)));
+    }
+    bool isInline = inlineHtml.contains(index);
+    policy.apply(page);
+    QString url = mergeMode ? mergeTemplate : urls.at(index);
+    NetworkManager::instance()->setPolicy(page, policy, isInline ? inlineHtml.value(index).second : QUrl(url));
+    loading.insert(page, index);
+    phases[index].insert("url", urls.at(index));
+    phases[index].insert("start", elapsed());
+    connect(page, SIGNAL(loadFinished(bool)), this, SLOT(htmlLoaded(bool)));
+    if (loadOptions.trigger != LoadOptions::Load) {
+        connect(page->mainFrame(), SIGNAL(javaScriptWindowObjectCleared()), this, SLOT(pageCommitted()));
+        if (!readyTimer->isActive())
+            readyTimer->start();
+    }
+    emit documentEvent(index, urls.at(index), "loading");
+    if (isInline) {
+        QPair<QString, QUrl> document = inlineHtml.value(index);
+        page->mainFrame()->setHtml(document.first, document.second);
+    } else {
+        page->mainFrame()->load(url);
+    }
+}
+
+/*
+ * Print the loaded page. The page range and copies are set here rather than
+ * when the printer is created, as cached printers are shared between jobs.
+ * QWebFrame::print() lays the document out once and prints the copies itself
+ * if the printer can't.
+ */
+void PrintHtml::printPage(
+    QWebPage *page)
+{
+    if (options.pageFrom > 0 && options.pageTo > 0) {
+        printer->setPrintRange(QPrinter::PageRange);
+        printer->setFromTo(options.pageFrom, options.pageTo);
+    } else {
+        printer->setPrintRange(QPrinter::AllPages);
+        printer->setFromTo(0, 0);
+    }
+    printer->setCopyCount(qMax(1, options.copies));
+    page->mainFrame()->print(printer);
+}
+
+/*
+ * Print a loaded document and record it as printed. When coalescing, the
+ * document goes into the open spool job, which is sent once it holds as many
+ * documents as we are allowed to put in one job, so the printer only sets up
+ * a job once for all of them. Raster output is always written through a
+ * spool job, holding just the one document when not coalescing.
+ *
+ * PARAMETERS:
+ * page     - Page holding the document
+ * index    - Index of the document in the URL list
+ */
+void PrintHtml::printDocument(
+    QWebPage *page,
+    int index)
+{
+    QString url = urls.at(index);
+    QString file;
+    double start = elapsed();
+    if (cachedFiles.contains(index)) {
+        // Rendered before, so just copy the file
+        file = SpoolDirectory::newFile(options.output);
+        if (!QFile::copy(cachedFiles.take(index), file)) {
+            error << url;
+            reasons.insert(index, "output failed");
+            emit documentEvent(index, url, "failed");
+            return;
+        }
+        traceSpan(index + 1, "copy rendered", start);
+    } else if (!this->testMode) {
+        if (options.raster()) {
+            if (!rasterPage(page)) {
+                error << url;
+                reasons.insert(index, "output failed");
+                emit documentEvent(index, url, "failed");
+                return;
             }
+        } else if (options.coalesce > 0) {
+            spoolPage(page, index);
         } else {
-            error << this->url;
-            if (!loadNextUrl()) {
-                 // Start making the STDOUT JSON when hit the last url
-                for (QStringList::Iterator S = printed.begin(); S != printed.end(); S++) {
-                    succeeded += "\"" + *S + "\"";
-                    if (S != printed.end() && succeeded.lastIndexOf(QChar(',')) != succeeded.length() - 1) {
-                        succeeded += ",";
-                    }
-                }
-                for (QStringList::Iterator S = error.begin(); S != error.end(); S++) {
-                    failed += "\"" + *S + "\"";
-                    if (S != error.end() && failed.lastIndexOf(QChar(',')) != failed.length() - 1) {
-                        failed += ",";
-                    }
-
-                }
-                resp +=",{\"error\":[" + failed.left(failed.length()-1).toLatin1() + "],\"success\":[" + succeeded.left(succeeded.length() - 1).toLatin1() + "]}";
-                if (exitOnCompletion)
-                    QCoreApplication::exit(0);
+            if (options.toFile()) {
+                file = SpoolDirectory::newFile(options.output);
+                printer->setOutputFileName(file);
             }
+            printPage(page);
         }
+        phases[index].insert("print", elapsed() - start);
+        QVariantMap args;
+        args.insert("output", options.output);
+        traceSpan(index + 1, "print", start, args);
+    }
+    printed << url;
+    if (spool || raster) {
+        spoolDocs << index;
+        if (spoolDocs.size() >= qMax(1, options.coalesce))
+            endSpool();
     } else {
-        if (ok) {
+        if (!file.isEmpty())
+            addFile(file, QList<int>() << index, -1);
+        emit documentEvent(index, url, "spooled");
+    }
+}
+
+/*
+ * Lay the page out at the given width and return the parts of it that go on
+ * each page, in CSS pixels. WebKit only paginates inside QWebFrame::print(),
+ * which always ends the spool job, so documents in a spool job we keep open
+ * are simply cut into pages of the printable height. Only the pages in the
+ * page range are returned. The caller restores the viewport size.
+ */
+QList<QRect> PrintHtml::layoutPages(
+    QWebPage *page,
+    const QSize &size)
+{
+    QWebFrame *frame = page->mainFrame();
+    page->setViewportSize(size);
+    page->setViewportSize(QSize(size.width(), frame->contentsSize().height()));
+    frame->setScrollPosition(QPoint(0, 0));
+
+    int count = qMax(1, (frame->contentsSize().height() + size.height() - 1) / size.height());
+    int from = 1;
+    int to = count;
+    if (options.pageFrom > 0 && options.pageTo > 0) {
+        from = options.pageFrom;
+        to = qMin(count, options.pageTo);
+    }
+    QList<QRect> pages;
+    for (int i = from; i <= to; i++)
+        pages << QRect(0, (i - 1) * size.height(), size.width(), size.height());
+    return pages;
+}
+
+/*
+ * Paint one page of the document, scaled from CSS pixels to the device
+ */
+void PrintHtml::paintPage(
+    QPainter *painter,
+    QWebFrame *frame,
+    const QRect &clip,
+    qreal zoom)
+{
+    painter->save();
+    painter->scale(zoom, zoom);
+    painter->translate(0, -clip.top());
+    frame->render(painter, QWebFrame::ContentsLayer, QRegion(clip));
+    painter->restore();
+}
+
+/*
+ * Add the page to the open spool job, starting one if need be, with the
+ * document starting on a new sheet. If a spool job for the printer cannot be
+ * started the page is printed on its own.
+ */
+void PrintHtml::spoolPage(
+    QWebPage *page,
+    int index)
+{
+    if (!spool) {
+        if (options.toFile()) {
+            spoolFile = SpoolDirectory::newFile(options.output);
+            printer->setOutputFileName(spoolFile);
+        }
+        printer->setCopyCount(1);
+        spool = new QPainter;
+        if (!spool->begin(printer)) {
+            delete spool;
+            spool = 0;
+            printPage(page);
+            if (!spoolFile.isEmpty())
+                addFile(spoolFile, QList<int>() << index, -1);
+            spoolFile.clear();
+            return;
+        }
+        spoolSheets = 0;
+    }
+
+    // Work in CSS pixels, as QWebFrame::print() does
+    QRect printable = printer->pageRect();
+    qreal zoom = printer->logicalDpiX() / 96.0;
+    QSize viewport = page->viewportSize();
+    QList<QRect> pages = layoutPages(page, QSize(int(printable.width() / zoom), int(printable.height() / zoom)));
+    for (int copy = 0; copy < qMax(1, options.copies); copy++) {
+        foreach (const QRect &clip, pages) {
+            if (spoolSheets++ > 0)
+                printer->newPage();
+            paintPage(spool, page->mainFrame(), clip, zoom);
+        }
+    }
+    page->setViewportSize(viewport);
+}
+
+/*
+ * Render the page at the output resolution and add it to the open raster
+ * file, which dithers it to black and white, starting one if need be. The paper size and
+ * margins come from the printer set up for the job. Returns false if the
+ * file could not be written.
+ */
+bool PrintHtml::rasterPage(
+    QWebPage *page)
+{
+    if (!raster) {
+        spoolFile = SpoolDirectory::newFile(options.output);
+        raster = new RasterWriter(options.output == "pwg" ? RasterWriter::Pwg : RasterWriter::Pbm, options.dpi);
+        if (!raster->open(spoolFile)) {
+            delete raster;
+            raster = 0;
+            spoolFile.clear();
+            return false;
+        }
+    }
+
+    int dpi = qMax(1, options.dpi);
+    QRectF paper = printer->paperRect(QPrinter::Inch);
+    QRectF printable = printer->pageRect(QPrinter::Inch);
+    QSize pixels(qRound(paper.width() * dpi), qRound(paper.height() * dpi));
+    QPointF origin = printable.topLeft() * dpi;
+    QSize viewport = page->viewportSize();
+    QList<QRect> pages = layoutPages(page, QSize(int(printable.width() * 96), int(printable.height() * 96)));
+    QList<QImage> images;
+    foreach (const QRect &clip, pages) {
+        QImage image(pixels, QImage::Format_RGB32);
+        image.fill(qRgb(255, 255, 255));
+        QPainter painter(&image);
+        painter.translate(origin);
+        paintPage(&painter, page->mainFrame(), clip, dpi / 96.0);
+        painter.end();
+        images << image;
+    }
+    page->setViewportSize(viewport);
+
+    // Every copy is written from the one rendering
+    bool ok = true;
+    for (int copy = 0; copy < qMax(1, options.copies); copy++) {
+        foreach (const QImage &image, images) {
+            if (!raster->writePage(image))
+                ok = false;
+            spoolSheets++;
+        }
+    }
+    return ok;
+}
+
+/*
+ * Send the open spool job to the printer, or finish writing its file, if
+ * there is one
+ */
+void PrintHtml::endSpool()
+{
+    if (!spool && !raster)
+        return;
+    double start = elapsed();
+    if (spool) {
+        spool->end();
+        delete spool;
+        spool = 0;
+    }
+    if (raster) {
+        raster->close();
+        delete raster;
+        raster = 0;
+    }
+    QVariantMap args;
+    args.insert("documents", spoolDocs.size());
+    traceSpan(0, "end spool job", start, args);
+    if (!spoolFile.isEmpty())
+        addFile(spoolFile, spoolDocs, spoolSheets);
+    spoolFile.clear();
+    spoolSheets = 0;
+    foreach (int index, spoolDocs)
+        emit documentEvent(index, urls.at(index), "spooled");
+    spoolDocs.clear();
+}
+
+/*
+ * Record a file we wrote and make room for it in the spool directory
+ *
+ * PARAMETERS:
+ * path     - File written
+ * indexes  - Documents in the file
+ * pages    - Pages in the file, or -1 if we don't know
+ */
+void PrintHtml::addFile(
+    const QString &path,
+    const QList<int> &indexes,
+    int pages)
+{
+    QVariantMap file;
+    file.insert("path", path);
+    file.insert("bytes", QFileInfo(path).size());
+    if (pages >= 0)
+        file.insert("pages", pages);
+    QStringList documents;
+    foreach (int index, indexes)
+        documents << urls.at(index);
+    file.insert("urls", documents);
+    files.append(file);
+    if (indexes.size() == 1 && renderKeys.contains(indexes.first()))
+        RenderCache::store(renderKeys.take(indexes.first()), options.output, path);
+    SpoolDirectory::rotate();
+}
+
+/*
+ * Function called when a web page has finished loading. A page that is
+ * waiting for its ready flag keeps waiting, as long as there is a deadline
+ * to stop it waiting forever.
+ */
+void PrintHtml::htmlLoaded(
+        bool ok)
+{
+    QWebPage *page = qobject_cast<QWebPage*>(sender());
+    if (!page || !loading.contains(page) || finishedAll)
+        return;
+    if (ok && loadOptions.trigger == LoadOptions::Ready && loadOptions.deadline > 0 && !isReady(page))
+        return;
+    documentReady(page, ok, "load");
+}
+
+/*
+ * Called when a new document replaces the old one in a page, so from now on
+ * its ready state is that of the document we asked for
+ */
+void PrintHtml::pageCommitted()
+{
+    QWebFrame *frame = qobject_cast<QWebFrame*>(sender());
+    if (frame && loading.contains(frame->page()))
+        committed.insert(frame->page());
+}
+
+/*
+ * True if the page has reached the point it should print at, for the
+ * triggers that don't wait for the full load
+ */
+bool PrintHtml::isReady(
+    QWebPage *page)
+{
+    if (!committed.contains(page))
+        return false;
+    QString script = loadOptions.trigger == LoadOptions::DomReady ? "document.readyState != 'loading'" : "!!window.printHtmlReady";
+    return page->mainFrame()->evaluateJavaScript(script).toBool();
+}
+
+/*
+ * Look for pages that are ready to print before they have finished loading.
+ * Whatever they are still loading is stopped.
+ */
+void PrintHtml::checkReady()
+{
+    foreach (QWebPage *page, loading.keys()) {
+        if (finishedAll || !loading.contains(page) || !isReady(page))
+            continue;
+        page->disconnect(this);
+        page->triggerAction(QWebPage::Stop);
+        documentReady(page, true, LoadOptions::triggerName(loadOptions.trigger));
+    }
+    if (loading.isEmpty() || finishedAll)
+        readyTimer->stop();
+}
+
+/*
+ * The job has run out of time. Pages still loading are stopped and either
+ * printed as they are or failed, and URLs not started yet fail.
+ */
+void PrintHtml::deadlineExpired()
+{
+    if (finishedAll)
+        return;
+    deadlinePassed = true;
+    readyTimer->stop();
+    foreach (int index, probes.values())
+        expire(index);
+    foreach (QNetworkReply *reply, probes.keys())
+        reply->deleteLater();
+    probes.clear();
+    QList<int> indexes = loading.values();
+    qSort(indexes);
+    foreach (int index, indexes) {
+        QWebPage *page = loading.key(index, 0);
+        if (finishedAll || !page)
+            continue;
+        page->disconnect(this);
+        page->triggerAction(QWebPage::Stop);
+        documentReady(page, loadOptions.printOnDeadline && committed.contains(page), "deadline");
+    }
+    printReady();
+}
+
+/*
+ * Record that a page is done loading, one way or another, and print whatever
+ * is ready
+ *
+ * PARAMETERS:
+ * page     - Page that is done
+ * ok       - True if the page is to be printed
+ * trigger  - What made the page done: load, domready, ready or deadline
+ */
+void PrintHtml::documentReady(
+    QWebPage *page,
+    bool ok,
+    const QString &trigger)
+{
+    page->disconnect(this);
+    page->mainFrame()->disconnect(this);
+    committed.remove(page);
+    int index = loading.take(page);
+    loaded.insert(index, qMakePair(page, ok));
+    QVariantMap &phase = phases[index];
+    double loadStart = phase.take("start").toDouble();
+    phase.insert("load", elapsed() - loadStart);
+    QVariantMap args;
+    args.insert("trigger", trigger);
+    args.insert("ok", ok);
+    traceSpan(index + 1, "load", loadStart, args);
+    if (ok) {
+        // Asking for the contents size makes WebKit finish laying out the page
+        double start = elapsed();
+        page->mainFrame()->contentsSize();
+        phase.insert("layout", elapsed() - start);
+        phase.insert("trigger", trigger);
+        traceSpan(index + 1, "layout", start);
+    }
+    if (tracing) {
+        trace += Trace::place(NetworkManager::instance()->takeTrace(page), traceProcess, index + 1);
+        NetworkManager::instance()->setTracing(page, false);
+    }
+    cache += NetworkManager::instance()->takeStats(page);
+    int pageBlocked = NetworkManager::instance()->takeBlocked(page);
+    blocked += pageBlocked;
+    int timeouts = NetworkManager::instance()->takeTimeouts(page);
+
+    // A page printed before it was complete must not be reprinted from the render cache
+    if (trigger == "deadline" || pageBlocked > 0 || timeouts > 0)
+        renderKeys.remove(index);
+    if (!ok) {
+        if (trigger == "deadline")
+            reasons.insert(index, "deadline exceeded");
+        else if (timeouts > 0)
+            reasons.insert(index, "resource timed out");
+        else
+            reasons.insert(index, "load failed");
+    }
+    emit documentEvent(index, urls.at(index), ok ? "loaded" : "failed");
+    printReady();
+}
+
+/*
+ * Print everything that is now ready, in order
+ */
+void PrintHtml::printReady()
+{
+    if (mergeMode) {
+        // The template is loaded, now print it once for every record
+        if (!loaded.contains(0))
+            return;
+        QPair<QWebPage*, bool> result = loaded.take(0);
+        mergePage = result.first;
+        mergeLoaded = result.second;
+        if (mergeLoaded)
+            mergeBody = mergePage->mainFrame()->findFirstElement("body").toInnerXml();
+        QTimer::singleShot(0, this, SLOT(mergeNext()));
+        return;
+    }
+    while (!finishedAll && loaded.contains(nextToPrint)) {
+        QPair<QWebPage*, bool> result = loaded.take(nextToPrint);
+        QString url = urls.at(nextToPrint++);
+        if (result.second) {
             // Print the page if not in test mode
-            if (!this->testMode) {
-                webPage->mainFrame()->print(printer);
-            }
-            printed << this->url;
-            if (!loadNextUrl()) {
-                // Bail if that was the last one
-                if (this->testMode) {
-                    QMessageBox msgBox;
-                    msgBox.setWindowTitle("Successly loaded URLs");
-                    msgBox.setText(printed.join("\n"));
-                    msgBox.exec();
-                }
-                if (exitOnCompletion)
-                    QCoreApplication::exit(0);
-            }
+            printDocument(result.first, nextToPrint - 1);
         } else {
-            QMessageBox msgBox;
-            msgBox.setWindowTitle("Fatal Error");
-            msgBox.setText("HTML page failed to load!");
-            msgBox.exec();
-                if (exitOnCompletion)
-                    QCoreApplication::exit(-1);
+            error << url;
         }
+
+        // The page is free again for the next URL
+        if (result.first)
+            spare.append(result.first);
+        if (!result.second && !this->json) {
+            showMessage("Fatal Error", "HTML page failed to load!");
+            finishedAll = true;
+            done(-1);
+            return;
+        }
+        while (loadNextUrl())
+            ;
+        if (nextToPrint >= urls.size())
+            finish(result.second);
     }
-        resp += "]";
-        client->write(resp);
-        client->disconnectFromHost();
+}
+
+/*
+ * Print the merge template with the next record. Records are done one per
+ * pass through the event loop, so a long run doesn't hold up everything else.
+ */
+void PrintHtml::mergeNext()
+{
+    if (finishedAll || nextToPrint >= urls.size())
+        return;
+    int index = nextToPrint++;
+    QString label = urls.at(index);
+    QVariantMap &phase = phases[index];
+    phase.insert("url", label);
+    if (tracing && index > 0)
+        trace.append(Trace::threadName(traceProcess, index + 1, label));
+
+    QString reason;
+    if (!mergeLoaded)
+        reason = "template " + reasons.value(0, "load failed");
+    else if (deadlinePassed)
+        reason = "deadline exceeded";
+    else {
+        double start = elapsed();
+        reason = mergeRecord(mergeRecords.at(index).toMap());
+        phase.insert("merge", elapsed() - start);
+        traceSpan(index + 1, "merge", start);
+    }
+
+    if (reason.isEmpty()) {
+        // Lay out the page again with the new data and print it
+        double start = elapsed();
+        mergePage->mainFrame()->contentsSize();
+        phase.insert("layout", elapsed() - start);
+        traceSpan(index + 1, "layout", start);
+        printDocument(mergePage, index);
+    } else {
+        error << label;
+        reasons.insert(index, reason);
+        emit documentEvent(index, label, "failed");
+        if (!this->json) {
+            showMessage("Fatal Error", "HTML page failed to load!");
+            finishedAll = true;
+            done(-1);
+            return;
+        }
+    }
+
+    if (nextToPrint >= urls.size())
+        finish(reason.isEmpty());
+    else
+        QTimer::singleShot(0, this, SLOT(mergeNext()));
+}
+
+/*
+ * Put a record's data into the template. If the template has a
+ * window.printHtmlMerge(record) function it is called with the record,
+ * otherwise every {{name}} in the original body is replaced with the HTML
+ * escaped value of that field (use {{a.b}} for nested fields). Returns why
+ * the merge failed, or an empty string if it worked.
+ */
+QString PrintHtml::mergeRecord(
+    const QVariantMap &record)
+{
+    QWebFrame *frame = mergePage->mainFrame();
+    if (frame->evaluateJavaScript("typeof window.printHtmlMerge == 'function'").toBool()) {
+        QString script = "(function(record) { try { window.printHtmlMerge(record); return ''; } "
+                         "catch (e) { return 'merge failed: ' + e; } })(" + QString::fromUtf8(Json::stringify(record)) + ")";
+        return frame->evaluateJavaScript(script).toString();
+    }
+
+    static const QRegExp field("\\{\\{\\s*([A-Za-z0-9_.\\-]+)\\s*\\}\\}");
+    QRegExp rx = field;
+    QString html;
+    int last = 0;
+    for (int pos = rx.indexIn(mergeBody); pos >= 0; pos = rx.indexIn(mergeBody, pos + rx.matchedLength())) {
+        QVariant value = record;
+        foreach (const QString &key, rx.cap(1).split('.'))
+            value = value.toMap().value(key);
+        html += mergeBody.mid(last, pos - last) + Qt::escape(value.toString());
+        last = pos + rx.matchedLength();
+    }
+    html += mergeBody.mid(last);
+    frame->findFirstElement("body").setInnerXml(html);
+    return QString();
+}
+
+/*
+ * Called once every URL has been loaded and printed
+ *
+ * PARAMETERS:
+ * lastOk   - True if the last URL was printed successfully
+ */
+void PrintHtml::finish(
+    bool lastOk)
+{
+    finishedAll = true;
+    deadlineTimer->stop();
+    readyTimer->stop();
+    if (this->json) {
+        if (exitOnCompletion || !interactive) {
+            if (lastOk && this->testMode && !printed.isEmpty()) {
+                writeOutput("{\"success\":\"" + printed.last().toLatin1() + "\"}");
+            }
+            writeJsonResult();
+        }
+    } else if (this->testMode) {
+        showMessage("Successly loaded URLs", printed.join("\n"));
+    }
+    done(0);
+}
+
+/*
+ * Fail every URL without loading any of them, as the job can't be printed
+ *
+ * PARAMETERS:
+ * reason   - Why the job can't be printed
+ */
+void PrintHtml::reject(
+    const QString &reason)
+{
+    finishedAll = true;
+    deadlineTimer->stop();
+    for (int i = 0; i < urls.size(); i++) {
+        phases[i].insert("url", urls.at(i));
+        reasons.insert(i, reason);
+        error << urls.at(i);
+        emit documentEvent(i, urls.at(i), "failed");
+    }
+    if (this->json) {
+        if (exitOnCompletion || !interactive)
+            writeJsonResult();
+    } else {
+        showMessage("Printer Error", reason);
+    }
+    done(-1);
+}
+
+/*
+ * Return the seconds spent loading, laying out and printing each URL, in the
+ * order of the URLs
+ */
+QVariantList PrintHtml::timings() const
+{
+    QVariantList list;
+    foreach (const QVariantMap &phase, phases)
+        list.append(phase);
+    return list;
+}
+
+/*
+ * Return why each URL that failed did so, in the order of the URLs
+ */
+QVariantList PrintHtml::failures() const
+{
+    QVariantList list;
+    for (QMap<int, QString>::const_iterator it = reasons.constBegin(); it != reasons.constEnd(); ++it) {
+        QVariantMap failure;
+        failure.insert("url", urls.at(it.key()));
+        failure.insert("reason", it.value());
+        list.append(failure);
+    }
+    return list;
+}
+
+/*
+ * Write the lists of printed and failed URLs to stdout as JSON
+ */
+void PrintHtml::writeJsonResult()
+{
+    QVariantMap result;
+    result.insert("error", error);
+    result.insert("success", printed);
+    QVariantMap stats;
+    stats.insert("hits", cache.hits);
+    stats.insert("misses", cache.misses);
+    result.insert("cache", stats);
+    if (renders.hits + renders.misses > 0) {
+        QVariantMap renderStats;
+        renderStats.insert("hits", renders.hits);
+        renderStats.insert("misses", renders.misses);
+        result.insert("renders", renderStats);
+    }
+    result.insert("blocked", blocked);
+    if (!reasons.isEmpty())
+        result.insert("failures", failures());
+    if (!files.isEmpty())
+        result.insert("files", files);
+    writeOutput(Json::stringify(result));
+}
+
+/*
+ * Write to stdout, or keep the text for later when not interactive
+ */
+void PrintHtml::writeOutput(
+    const QByteArray &text)
+{
+    if (!interactive) {
+        output_ += text;
+        return;
+    }
+    printf("%s", text.constData());
+    fflush(stdout);
+}
+
+/*
+ * Show a message box, or keep the message for later when not interactive
+ */
+void PrintHtml::showMessage(
+    const QString &title,
+    const QString &text)
+{
+    if (!interactive) {
+        messageTitle_ = title;
+        messageText_ = text;
+        return;
+    }
+    QMessageBox msgBox;
+    msgBox.setWindowTitle(title);
+    msgBox.setText(text);
+    msgBox.exec();
+}
+
+/*
+ * Called when all the URLs have been handled. On the command line we exit the
+ * application, in server mode we let the owner of the job know we are done.
+ */
+void PrintHtml::done(
+    int exitCode)
+{
+    endSpool();
+    traceSpan(0, "run", 0);
+    exitCode_ = exitCode;
+    if (exitOnCompletion)
+        QCoreApplication::exit(exitCode);
+    else
+        quit();
+}
+
+/*
+ * Hand a web page back to the pool it came from, or delete it
+ */
+void PrintHtml::releasePage(
+    QWebPage *page)
+{
+    if (!page)
+        return;
+    page->disconnect(this);
+    if (pagePool)
+        pagePool->release(page);
+    else
+        page->deleteLater();
 }
 
 /*
@@ -229,6 +1152,35 @@ void PrintHtml::htmlLoaded(
  */
 void PrintHtml::aboutToQuitApp()
 {
-    delete printer;
-    delete webPage;
+    deadlineTimer->stop();
+    readyTimer->stop();
+    committed.clear();
+    foreach (QNetworkReply *reply, probes.keys())
+        reply->deleteLater();
+    probes.clear();
+    if (spool) {
+        spool->end();
+        delete spool;
+        spool = 0;
+    }
+    delete raster;
+    raster = 0;
+    if (printerCache)
+        printerCache->release(printer);
+    else
+        delete printer;
+    printer = 0;
+    foreach (QWebPage *page, loading.keys())
+        releasePage(page);
+    loading.clear();
+    typedef QPair<QWebPage*, bool> LoadedPage;
+    foreach (const LoadedPage &result, loaded)
+        releasePage(result.first);
+    loaded.clear();
+    foreach (QWebPage *page, spare)
+        releasePage(page);
+    spare.clear();
+    if (mergePage)
+        releasePage(mergePage);
+    mergePage = 0;
 }
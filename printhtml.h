@@ -26,11 +26,25 @@
 #ifndef PRINTHTML_H
 #define PRINTHTML_H
 
-#include <QTcpServer>
-#include <QTcpSocket>
-
 #include <QObject>
 #include <QCoreApplication>
+#include <QHash>
+#include <QSet>
+#include <QMap>
+#include <QPair>
+#include <QUrl>
+#include <QElapsedTimer>
+#include <QVariantList>
+#include "printoptions.h"
+#include "networkmanager.h"
+#include "resourcepolicy.h"
+#include "loadoptions.h"
+
+class QTimer;
+class QPainter;
+class RasterWriter;
+class WebPagePool;
+class PrinterCache;
 
 class PrintHtml : public QObject
 {
@@ -39,22 +53,65 @@ private:
     QCoreApplication *app;
 
 public:
-    PrintHtml(bool testMode, bool json, QStringList urls, QString selectedPrinter, double leftMargin, double topMargin,
-          double rightMargin, double bottomMargin, QString paper, QString orientation, int pageFrom, int pageTo,
-          double paperWidth = 0, double paperHeight = 0, bool exitOnCompletion = true, QTcpSocket *client =0, QByteArray resp="");
+    PrintHtml(bool testMode, bool json, QStringList urls, const PrintOptions &options, bool exitOnCompletion = true);
+    ~PrintHtml();
     void quit();
+    void setPagePool(WebPagePool *pool) { pagePool = pool; }
+    void setPrinterCache(PrinterCache *cache) { printerCache = cache; }
+    void setConcurrency(int count);
+    void setHtml(int index, const QString &html, const QUrl &baseUrl = QUrl());
+    void setInteractive(bool interactive);
+    void setPolicy(const ResourcePolicy &policy) { this->policy = policy; }
+    void setLoadOptions(const LoadOptions &loadOptions);
+    void setMergeRecords(const QVariantList &records);
+    void setTracing(int process, const QString &name);
+    QVariantList traceEvents() const { return trace; }
+    QStringList printedUrls() const { return printed; }
+    QStringList failedUrls() const { return error; }
+    CacheStats cacheStats() const { return cache; }
+    CacheStats renderStats() const { return renders; }
+    int blockedCount() const { return blocked; }
+    QVariantList timings() const;
+    QVariantList failures() const;
+    QVariantList outputFiles() const { return files; }
+    int exitCode() const { return exitCode_; }
+    QByteArray output() const { return output_; }
+    QString messageTitle() const { return messageTitle_; }
+    QString messageText() const { return messageText_; }
 
 private:
     bool loadNextUrl();
+    void startLoad(int index);
+    void expire(int index);
+    void probeRender(int index);
+    void renderFound(int index, const QString &document);
+    void printPage(QWebPage *page);
+    void printDocument(QWebPage *page, int index);
+    QList<QRect> layoutPages(QWebPage *page, const QSize &size);
+    void paintPage(QPainter *painter, QWebFrame *frame, const QRect &clip, qreal zoom);
+    void spoolPage(QWebPage *page, int index);
+    bool rasterPage(QWebPage *page);
+    void endSpool();
+    void addFile(const QString &path, const QList<int> &indexes, int pages);
+    bool isReady(QWebPage *page);
+    void documentReady(QWebPage *page, bool ok, const QString &trigger);
+    void printReady();
+    QString mergeRecord(const QVariantMap &record);
+    void finish(bool lastOk);
+    void reject(const QString &reason);
+    void writeJsonResult();
+    void writeOutput(const QByteArray &text);
+    void showMessage(const QString &title, const QString &text);
+    void done(int exitCode);
+    void releasePage(QWebPage *page);
+    double elapsed() const { return clock.nsecsElapsed() / 1e9; }
+    void traceSpan(int thread, const QString &name, double start, const QVariantMap &args = QVariantMap());
     QStringList error;
-    QString succeeded;
-    QString failed;
-    double paperWidth;
-    double paperHeight;
-    QString paperSizeName;
+    PrintOptions options;
 
 signals:
     void finished();
+    void documentEvent(int index, const QString &url, const QString &event);
 
 public slots:
     void run();
@@ -62,18 +119,66 @@ public slots:
 
 private slots:
     void htmlLoaded(bool ok);
+    void pageCommitted();
+    void checkReady();
+    void deadlineExpired();
+    void mergeNext();
+    void probeFinished();
+    void printQueued();
 
 private:
-    QTcpSocket      *client;
-    QByteArray      resp;
     bool            testMode;   // True if we are running in test mode
     bool            json;       // True if we want the JSON stdout
     QStringList     urls;       // List of url to print
+    QMap<int, QPair<QString, QUrl> > inlineHtml; // HTML given inline, by URL index
+    int             nextToLoad; // Index of the next URL to start loading
+    int             nextToPrint; // Index of the next URL to print
+    int             concurrency; // Maximum number of URLs loading at once
+    bool            finishedAll; // True once we are done with all the URLs
     QPrinter        *printer;   // Printer object that we print to
-    QWebPage        *webPage;   // QWebPage class for printing
-    QString         url;
+    PrinterCache    *printerCache; // Optional cache the printer is borrowed from
+    QPainter        *spool;     // Open spool job documents are coalesced into
+    QList<int>      spoolDocs;  // Documents painted into the open spool job
+    int             spoolSheets; // Pages painted into the open spool job
+    RasterWriter    *raster;    // Open raster file documents are written into
+    QString         spoolFile;  // File the open spool job is written to, if any
+    QVariantList    files;      // Files written, with their sizes and documents
+    QHash<QNetworkReply*, int> probes; // Requests for the version of a document, by URL index
+    QMap<int, QString> renderKeys; // Render cache key to store each rendered document under
+    QMap<int, QString> cachedFiles; // Render cache files to print, by URL index
+    CacheStats      renders;    // Render cache hits and misses for this job
+    QHash<QWebPage*, int> loading; // Pages still loading, and their URL index
+    QMap<int, QPair<QWebPage*, bool> > loaded; // Loaded pages waiting to print
+    QList<QWebPage*> spare;     // Pages free to load the next URL into
+    WebPagePool     *pagePool;  // Optional pool the web pages are borrowed from
     QStringList     printed;
+    CacheStats      cache;      // Resource cache hits and misses for this job
+    ResourcePolicy  policy;     // What the pages may load and run
+    int             blocked;    // Requests turned away by the policy
+    LoadOptions     loadOptions; // When pages are ready and how long the job may take
+    QTimer          *deadlineTimer; // Fires when the job is out of time
+    QTimer          *readyTimer; // Polls loading pages for the print trigger
+    bool            deadlinePassed; // True once the job is out of time
+    QSet<QWebPage*> committed;  // Loading pages showing their new document
+    QMap<int, QString> reasons; // Why each failed URL failed, by URL index
+    bool            mergeMode;  // True to print one template for many records
+    QString         mergeTemplate; // URL of the merge template
+    QVariantList    mergeRecords; // Data to merge, one record per document
+    QWebPage        *mergePage; // Page holding the loaded template
+    bool            mergeLoaded; // True if the template loaded
+    QString         mergeBody;  // Body of the template before any merge
+    QElapsedTimer   clock;      // Started when the job starts running
+    QMap<int, QVariantMap> phases; // Seconds spent in each phase, by URL index
+    bool            tracing;    // True to record a trace of the job
+    int             traceProcess; // Process the trace events go in
+    qint64          traceStart; // Trace clock when the clock was started
+    QVariantList    trace;      // Trace events recorded so far
     bool            exitOnCompletion; // Whether to exit the app when done
+    bool            interactive; // False to keep messages and output instead of showing them
+    int             exitCode_;  // Exit code the job finished with
+    QByteArray      output_;    // Output kept when not interactive
+    QString         messageTitle_; // Message box kept when not interactive
+    QString         messageText_;
 };
 
 #endif // PRINTHTML_H
@@ -0,0 +1,132 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PRINTOPTIONS_H
+#define PRINTOPTIONS_H
+
+#include <QString>
+#include <QVariantMap>
+
+/*
+ * Page setup for a print job, as given on the command line or in a REST
+ * request. Paper width and height are in millimeters and override the named
+ * paper size when both are set; margins are in inches.
+ */
+struct PrintOptions
+{
+    QString printer;        // Printer name, or 'Default'
+    double  leftMargin;
+    double  topMargin;
+    double  rightMargin;
+    double  bottomMargin;
+    QString paper;          // Named paper size (A4, A5, Letter)
+    QString orientation;    // Portrait or Landscape
+    int     pageFrom;       // First page to print, 0 for all
+    int     pageTo;         // Last page to print, 0 for all
+    double  paperWidth;     // Custom paper width in mm, 0 if not used
+    double  paperHeight;    // Custom paper height in mm, 0 if not used
+    int     coalesce;       // Documents to put in one spool job, 0 for a job per document
+    QString output;         // Where the pages go: printer, pdf, pbm or pwg
+    int     dpi;            // Resolution of pbm and pwg output
+    int     copies;         // Copies of each document
+
+    PrintOptions()
+        : printer("Default"), leftMargin(0.5), topMargin(0.5), rightMargin(0.5), bottomMargin(0.5),
+          paper("A4"), orientation("portrait"), pageFrom(0), pageTo(0), paperWidth(0), paperHeight(0),
+          coalesce(0), output("printer"), dpi(203), copies(1)
+    {
+    }
+
+    bool customSize() const { return paperWidth > 0 && paperHeight > 0; }
+    bool toFile() const     { return output != "printer"; }
+    bool raster() const     { return output == "pbm" || output == "pwg"; }
+
+    static bool knownOutput(const QString &output)
+    {
+        return output == "printer" || output == "pdf" || output == "pbm" || output == "pwg";
+    }
+
+    /*
+     * Key identifying the printer configuration. Everything that has to be
+     * resolved through the print backend is part of the key, the page range,
+     * copies and coalescing are not as they are cheap to change for every job.
+     * Printers for output to files are set up differently, so have their
+     * own keys.
+     */
+    QString printerKey() const
+    {
+        QString size = customSize() ? QString("%1x%2mm").arg(paperWidth).arg(paperHeight) : paper;
+        return QString("%1|%2|%3|%4,%5,%6,%7")
+            .arg(toFile() ? "file:" + printer : printer, size, orientation == "Landscape" ? "Landscape" : "Portrait")
+            .arg(leftMargin).arg(topMargin).arg(rightMargin).arg(bottomMargin);
+    }
+
+    /*
+     * Convert to and from a variant map, used to hand jobs to worker processes
+     */
+    QVariantMap toMap() const
+    {
+        QVariantMap map;
+        map.insert("printer", printer);
+        map.insert("left", leftMargin);
+        map.insert("top", topMargin);
+        map.insert("right", rightMargin);
+        map.insert("bottom", bottomMargin);
+        map.insert("paper", paper);
+        map.insert("orientation", orientation);
+        map.insert("pageFrom", pageFrom);
+        map.insert("pageTo", pageTo);
+        map.insert("width", paperWidth);
+        map.insert("height", paperHeight);
+        map.insert("coalesce", coalesce);
+        map.insert("output", output);
+        map.insert("dpi", dpi);
+        map.insert("copies", copies);
+        return map;
+    }
+
+    static PrintOptions fromMap(const QVariantMap &map)
+    {
+        PrintOptions options;
+        options.printer = map.value("printer", options.printer).toString();
+        options.leftMargin = map.value("left", options.leftMargin).toDouble();
+        options.topMargin = map.value("top", options.topMargin).toDouble();
+        options.rightMargin = map.value("right", options.rightMargin).toDouble();
+        options.bottomMargin = map.value("bottom", options.bottomMargin).toDouble();
+        options.paper = map.value("paper", options.paper).toString();
+        options.orientation = map.value("orientation", options.orientation).toString();
+        options.pageFrom = map.value("pageFrom", options.pageFrom).toInt();
+        options.pageTo = map.value("pageTo", options.pageTo).toInt();
+        options.paperWidth = map.value("width", options.paperWidth).toDouble();
+        options.paperHeight = map.value("height", options.paperHeight).toDouble();
+        options.coalesce = map.value("coalesce", options.coalesce).toInt();
+        options.output = map.value("output", options.output).toString();
+        options.dpi = map.value("dpi", options.dpi).toInt();
+        options.copies = map.value("copies", options.copies).toInt();
+        return options;
+    }
+};
+
+#endif // PRINTOPTIONS_H
@@ -0,0 +1,137 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "processmemory.h"
+#include <QWebSettings>
+#include <QFile>
+#include <climits>
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_MAC)
+#include <mach/mach.h>
+#elif defined(Q_OS_UNIX)
+#include <unistd.h>
+#endif
+
+qint64 ProcessMemory::webKitCacheBytes = 0;
+
+#if defined(Q_OS_LINUX)
+/*
+ * Read a size in kilobytes from /proc/self/status
+ */
+static qint64 procStatus(
+    const char *field)
+{
+    QFile file("/proc/self/status");
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    QByteArray prefix = QByteArray(field) + ":";
+    foreach (const QByteArray &line, file.readAll().split('\n')) {
+        if (line.startsWith(prefix))
+            return line.mid(prefix.size()).trimmed().split(' ').first().toLongLong() * 1024;
+    }
+    return 0;
+}
+#endif
+
+/*
+ * Return the bytes of memory the process currently has resident, or 0 if we
+ * can't tell on this system
+ */
+qint64 ProcessMemory::resident()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#elif defined(Q_OS_MAC)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+        return info.resident_size;
+    return 0;
+#elif defined(Q_OS_LINUX)
+    // Second field of statm is the resident size in pages, and cheaper to read than status
+    QFile file("/proc/self/statm");
+    if (!file.open(QIODevice::ReadOnly))
+        return 0;
+    QList<QByteArray> fields = file.readAll().split(' ');
+    return fields.size() > 1 ? fields.at(1).toLongLong() * sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Return the most memory the process has ever had resident, or 0 if we can't
+ * tell on this system
+ */
+qint64 ProcessMemory::peakResident()
+{
+#if defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#elif defined(Q_OS_MAC)
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+        return info.resident_size_max;
+    return 0;
+#elif defined(Q_OS_LINUX)
+    return procStatus("VmHWM");
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Limit WebKit's in-memory cache of decoded images, style sheets and scripts.
+ * Left alone WebKit sizes it from the machine's memory, and a server that
+ * prints many different pages grows until it reaches that size. The back and
+ * forward page cache is turned off, as printed pages are never gone back to.
+ *
+ * PARAMETERS:
+ * bytes    - Most memory the cache may use
+ */
+void ProcessMemory::setWebKitCache(
+    qint64 bytes)
+{
+    webKitCacheBytes = qMax(bytes, qint64(0));
+    int capacity = int(qMin(webKitCacheBytes, qint64(INT_MAX)));
+    QWebSettings::setObjectCacheCapacities(0, capacity / 2, capacity);
+    QWebSettings::setMaximumPagesInCache(0);
+}
+
+/*
+ * Empty WebKit's in-memory caches, to give back as much memory as we can
+ */
+void ProcessMemory::clearWebKitCaches()
+{
+    QWebSettings::clearMemoryCaches();
+}
@@ -0,0 +1,189 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "rasterwriter.h"
+#include <QtEndian>
+#include <string.h>
+
+/*
+ * Constructor for the raster writer
+ *
+ * PARAMETERS:
+ * format   - File format to write
+ * dpi      - Resolution of the pages, written to the PWG page headers
+ */
+RasterWriter::RasterWriter(
+    Format format,
+    int dpi)
+    : format(format), dpi(dpi), pageCount(0)
+{
+}
+
+/*
+ * Destructor. Closes the file if it is still open.
+ */
+RasterWriter::~RasterWriter()
+{
+    close();
+}
+
+/*
+ * Create the file, writing the PWG synchronization word if need be
+ */
+bool RasterWriter::open(
+    const QString &path)
+{
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    pageCount = 0;
+    if (format == Pwg)
+        file.write("RaS2", 4);
+    return true;
+}
+
+/*
+ * Close the file, returning its size in bytes
+ */
+qint64 RasterWriter::close()
+{
+    if (!file.isOpen())
+        return 0;
+    qint64 size = file.size();
+    file.close();
+    return size;
+}
+
+/*
+ * Dither the page down to one bit per pixel, with set bits being black and
+ * the leftmost pixel in the top bit, as both PBM and PWG want
+ */
+QByteArray RasterWriter::toMono(
+    const QImage &page,
+    int *bytesPerLine)
+{
+    // Qt normally puts white at index 0, so set bits are already black
+    QImage mono = page.convertToFormat(QImage::Format_Mono, Qt::MonoOnly | Qt::DiffuseDither);
+    bool invert = mono.colorCount() > 0 && qGray(mono.color(0)) < 128;
+    int width = (mono.width() + 7) / 8;
+    QByteArray bits(width * mono.height(), 0);
+    char *out = bits.data();
+    for (int y = 0; y < mono.height(); y++) {
+        const uchar *line = mono.constScanLine(y);
+        for (int x = 0; x < width; x++)
+            *out++ = char(invert ? ~line[x] : line[x]);
+    }
+    *bytesPerLine = width;
+    return bits;
+}
+
+/*
+ * Add a page to the file
+ */
+bool RasterWriter::writePage(
+    const QImage &page)
+{
+    if (!file.isOpen())
+        return false;
+    int bytesPerLine;
+    QByteArray bits = toMono(page, &bytesPerLine);
+    if (format == Pbm) {
+        file.write(QString("P4\n%1 %2\n").arg(page.width()).arg(page.height()).toLatin1());
+        file.write(bits);
+    } else {
+        // Runs of identical lines are sent once with a repeat count
+        writePwgHeader(page.width(), page.height(), bytesPerLine);
+        const char *data = bits.constData();
+        int y = 0;
+        while (y < page.height()) {
+            const char *line = data + y * bytesPerLine;
+            int repeat = 1;
+            while (repeat < 256 && y + repeat < page.height() && memcmp(line, line + repeat * bytesPerLine, bytesPerLine) == 0)
+                repeat++;
+            writePwgLine(line, bytesPerLine, repeat);
+            y += repeat;
+        }
+    }
+    pageCount++;
+    return file.error() == QFile::NoError;
+}
+
+/*
+ * Write the 1796 byte PWG Raster page header for a 1-bit black page. Only the
+ * fields PWG uses are filled in, everything else is zero.
+ */
+void RasterWriter::writePwgHeader(
+    int width,
+    int height,
+    int bytesPerLine)
+{
+    QByteArray header(1796, 0);
+    uchar *p = reinterpret_cast<uchar*>(header.data());
+    qstrcpy(header.data(), "PwgRaster");
+    qToBigEndian<quint32>(dpi, p + 276);                    // HWResolution
+    qToBigEndian<quint32>(dpi, p + 280);
+    qToBigEndian<quint32>(width * 72 / dpi, p + 352);       // PageSize, in points
+    qToBigEndian<quint32>(height * 72 / dpi, p + 356);
+    qToBigEndian<quint32>(width, p + 372);                  // Width
+    qToBigEndian<quint32>(height, p + 376);                 // Height
+    qToBigEndian<quint32>(1, p + 384);                      // BitsPerColor
+    qToBigEndian<quint32>(1, p + 388);                      // BitsPerPixel
+    qToBigEndian<quint32>(bytesPerLine, p + 392);           // BytesPerLine
+    qToBigEndian<quint32>(3, p + 400);                      // ColorSpace, black
+    qToBigEndian<quint32>(1, p + 420);                      // NumColors
+    qToBigEndian<quint32>(1, p + 456);                      // CrossFeedTransform
+    qToBigEndian<quint32>(1, p + 460);                      // FeedTransform
+    file.write(header);
+}
+
+/*
+ * Write one line of a PWG page, compressed with its line repeat count and
+ * PackBits style runs of bytes
+ */
+void RasterWriter::writePwgLine(
+    const char *line,
+    int length,
+    int repeat)
+{
+    QByteArray out;
+    out.append(char(repeat - 1));
+    int x = 0;
+    while (x < length) {
+        int count = 1;
+        if (x + 1 < length && line[x] == line[x + 1]) {
+            while (count < 128 && x + count < length && line[x + count] == line[x])
+                count++;
+            out.append(char(count - 1));
+            out.append(line[x]);
+        } else {
+            while (count < 128 && x + count < length && (x + count + 1 >= length || line[x + count] != line[x + count + 1]))
+                count++;
+            out.append(char(count == 1 ? 0 : 257 - count));
+            out.append(line + x, count);
+        }
+        x += count;
+    }
+    file.write(out);
+}
@@ -0,0 +1,63 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RASTERWRITER_H
+#define RASTERWRITER_H
+
+#include <QFile>
+#include <QImage>
+#include <QString>
+
+/*
+ * Writes 1-bit raster pages for thermal and label printers, either as a
+ * multi-page PBM (P4) file or as PWG Raster. Pages are given as images at the
+ * target resolution and dithered down to black and white as they are written.
+ */
+class RasterWriter
+{
+public:
+    enum Format { Pbm, Pwg };
+
+    RasterWriter(Format format, int dpi);
+    ~RasterWriter();
+
+    bool open(const QString &path);
+    bool writePage(const QImage &page);
+    qint64 close();
+
+    int pages() const       { return pageCount; }
+
+private:
+    static QByteArray toMono(const QImage &page, int *bytesPerLine);
+    void writePwgHeader(int width, int height, int bytesPerLine);
+    void writePwgLine(const char *line, int length, int repeat);
+
+    Format          format;
+    int             dpi;
+    int             pageCount;  // Pages written so far
+    QFile           file;
+};
+
+#endif // RASTERWRITER_H
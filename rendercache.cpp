@@ -0,0 +1,169 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "rendercache.h"
+#include "json.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+
+QString RenderCache::dir;
+qint64 RenderCache::maxBytes = 0;
+quint64 RenderCache::useCounter = 0;
+QHash<QString, quint64> RenderCache::lastUsed;
+
+/*
+ * Turn on the render cache
+ *
+ * PARAMETERS:
+ * path     - Directory to keep the rendered files in, created if need be
+ * maxSize  - Most bytes to keep, 0 to turn the cache off
+ */
+void RenderCache::enable(
+    const QString &path,
+    qint64 maxSize)
+{
+    dir = path;
+    maxBytes = qMax(qint64(0), maxSize);
+    if (maxBytes > 0)
+        QDir().mkpath(dir);
+}
+
+/*
+ * Make the cache key for a document printed with the given options. The
+ * printer name and coalescing don't change the rendered file, so are not
+ * part of the key. What the page may load and run, and when it is printed,
+ * do change it, so they are.
+ *
+ * PARAMETERS:
+ * document - Identifies the exact version of the document
+ * options  - Options the document is printed with
+ * policy   - What the page may load and run
+ * load     - When the page is printed
+ */
+QString RenderCache::key(
+    const QString &document,
+    const PrintOptions &options,
+    const ResourcePolicy &policy,
+    const LoadOptions &load)
+{
+    PrintOptions setup = options;
+    setup.printer = "Default";
+    QString settings = QString("%1|%2|%3|%4-%5|%6|%7|%8")
+        .arg(setup.printerKey(), setup.output)
+        .arg(setup.dpi).arg(setup.pageFrom).arg(setup.pageTo).arg(setup.copies)
+        .arg(QString::fromUtf8(Json::stringify(policy.toMap())), LoadOptions::triggerName(load.trigger));
+    return QCryptographicHash::hash((document + "\n" + settings).toUtf8(), QCryptographicHash::Sha1).toHex();
+}
+
+/*
+ * Return the cached file for the key, or an empty string if there is none
+ */
+QString RenderCache::lookup(
+    const QString &key,
+    const QString &suffix)
+{
+    QString name = key + "." + suffix;
+    if (!isEnabled() || !QFile::exists(dir + "/" + name))
+        return QString();
+    lastUsed.insert(name, ++useCounter);
+    return dir + "/" + name;
+}
+
+/*
+ * Keep a copy of a rendered file under the key. The copy is written under a
+ * temporary name first, so other processes never see half a file.
+ */
+void RenderCache::store(
+    const QString &key,
+    const QString &suffix,
+    const QString &file)
+{
+    if (!isEnabled() || QFileInfo(file).size() > maxBytes)
+        return;
+    QString name = key + "." + suffix;
+    QString path = dir + "/" + name;
+    QString temp = path + ".tmp";
+    QFile::remove(temp);
+    if (!QFile::copy(file, temp))
+        return;
+    QFile::remove(path);
+    if (!QFile::rename(temp, path)) {
+        QFile::remove(temp);
+        return;
+    }
+    lastUsed.insert(name, ++useCounter);
+    evict();
+}
+
+/*
+ * Drop the least recently used files until we are within our limit. Files
+ * other processes sharing the directory put there are taken to be older than
+ * anything we have used, oldest first.
+ */
+void RenderCache::evict()
+{
+    QFileInfoList files = QDir(dir).entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+    qint64 total = 0;
+    QMap<quint64, QFileInfo> used;
+    QFileInfoList others;
+    foreach (const QFileInfo &info, files) {
+        total += info.size();
+        if (lastUsed.contains(info.fileName()))
+            used.insert(lastUsed.value(info.fileName()), info);
+        else
+            others.append(info);
+    }
+    QFileInfoList order = others + used.values();
+    for (int i = 0; i < order.size() && total > maxBytes; i++) {
+        if (QFile::remove(order.at(i).filePath())) {
+            total -= order.at(i).size();
+            lastUsed.remove(order.at(i).fileName());
+        }
+    }
+}
+
+/*
+ * Return the number of files in the cache
+ */
+int RenderCache::count()
+{
+    return isEnabled() ? QDir(dir).entryList(QDir::Files).size() : 0;
+}
+
+/*
+ * Return the bytes used by the cache
+ */
+qint64 RenderCache::size()
+{
+    qint64 total = 0;
+    if (isEnabled()) {
+        foreach (const QFileInfo &info, QDir(dir).entryInfoList(QDir::Files))
+            total += info.size();
+    }
+    return total;
+}
@@ -0,0 +1,64 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RENDERCACHE_H
+#define RENDERCACHE_H
+
+#include <QHash>
+#include <QString>
+#include "printoptions.h"
+#include "resourcepolicy.h"
+#include "loadoptions.h"
+
+/*
+ * Cache of rendered documents, for reprints. Files written for a document are
+ * kept under a key made from the document (its URL and validators, or a hash
+ * of its inline HTML) and everything that changes how it renders, so printing
+ * it again just copies the file instead of loading the page. The cache is
+ * limited in size, dropping the least recently used files first. Set up once
+ * for the process.
+ */
+class RenderCache
+{
+public:
+    static void enable(const QString &path, qint64 maxSize);
+    static bool isEnabled()     { return maxBytes > 0; }
+    static qint64 maxSize()     { return maxBytes; }
+    static QString key(const QString &document, const PrintOptions &options, const ResourcePolicy &policy, const LoadOptions &load);
+    static QString lookup(const QString &key, const QString &suffix);
+    static void store(const QString &key, const QString &suffix, const QString &file);
+    static int count();
+    static qint64 size();
+
+private:
+    static void evict();
+
+    static QString  dir;
+    static qint64   maxBytes;
+    static quint64  useCounter;
+    static QHash<QString, quint64> lastUsed; // When we last used each file, by file name
+};
+
+#endif // RENDERCACHE_H
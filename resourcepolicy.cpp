@@ -0,0 +1,173 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "resourcepolicy.h"
+#include <QWebPage>
+#include <QWebSettings>
+
+/*
+ * True if the host is one of the listed hosts or a subdomain of one
+ */
+static bool hostMatches(
+    const QString &host,
+    const QStringList &hosts)
+{
+    foreach (const QString &entry, hosts) {
+        QString name = entry.trimmed().toLower();
+        if (name.startsWith("*."))
+            name = name.mid(2);
+        if (!name.isEmpty() && (host == name || host.endsWith("." + name)))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * The site a host belongs to, taken as its last two labels. This treats
+ * shop.example.co.uk and cdn.example.co.uk as one site with all of co.uk,
+ * which is good enough to tell a slip's own assets from other companies'
+ * trackers and CDNs.
+ */
+static QString siteOf(
+    const QString &host)
+{
+    QStringList labels = host.split('.');
+    bool isAddress;
+    labels.last().toInt(&isAddress);
+    if (labels.size() <= 2 || isAddress)
+        return host;
+    return labels.at(labels.size() - 2) + "." + labels.last();
+}
+
+/*
+ * Check whether a page showing the document may load the resource. Only
+ * network URLs are filtered, local files and data URLs are always allowed.
+ *
+ * PARAMETERS:
+ * url          - URL of the resource
+ * documentUrl  - URL of the document the job is printing
+ */
+bool ResourcePolicy::allows(
+    const QUrl &url,
+    const QUrl &documentUrl) const
+{
+    QString scheme = url.scheme().toLower();
+    if (scheme != "http" && scheme != "https" && scheme != "ftp")
+        return true;
+    QString host = url.host().toLower();
+    if (hostMatches(host, denyHosts))
+        return false;
+    if (!allowHosts.isEmpty() && !hostMatches(host, allowHosts))
+        return false;
+    if (!thirdParty && !documentUrl.host().isEmpty() && siteOf(host) != siteOf(documentUrl.host().toLower()))
+        return false;
+    return true;
+}
+
+/*
+ * Narrow the hosts resources may be loaded from to the listed hosts, without
+ * ever letting through a host the policy doesn't already allow
+ *
+ * PARAMETERS:
+ * hosts    - Hosts to only load resources from
+ */
+void ResourcePolicy::allowOnly(
+    const QStringList &hosts)
+{
+    if (hosts.isEmpty())
+        return;
+    if (allowHosts.isEmpty()) {
+        allowHosts = hosts;
+        return;
+    }
+
+    // Keep the hosts on either list that fall within the other
+    QStringList narrowed;
+    QStringList lists[2] = { hosts, allowHosts };
+    for (int i = 0; i < 2; i++) {
+        foreach (const QString &entry, lists[i]) {
+            QString name = entry.trimmed().toLower();
+            if (name.startsWith("*."))
+                name = name.mid(2);
+            if (!name.isEmpty() && hostMatches(name, lists[1 - i]) && !narrowed.contains(name))
+                narrowed << name;
+        }
+    }
+
+    // With nothing in common only the document itself may load, as .invalid never resolves
+    allowHosts = narrowed.isEmpty() ? QStringList("invalid") : narrowed;
+}
+
+/*
+ * Switch scripts, images and plugins on or off for the page
+ */
+void ResourcePolicy::apply(
+    QWebPage *page) const
+{
+    QWebSettings *settings = page->settings();
+    settings->setAttribute(QWebSettings::JavascriptEnabled, javascript);
+    settings->setAttribute(QWebSettings::AutoLoadImages, images);
+    settings->setAttribute(QWebSettings::PluginsEnabled, plugins);
+}
+
+/*
+ * Put the page back to the global settings, for pages that are reused
+ */
+void ResourcePolicy::reset(
+    QWebPage *page)
+{
+    QWebSettings *settings = page->settings();
+    settings->resetAttribute(QWebSettings::JavascriptEnabled);
+    settings->resetAttribute(QWebSettings::AutoLoadImages);
+    settings->resetAttribute(QWebSettings::PluginsEnabled);
+}
+
+/*
+ * Convert to and from a variant map, used to hand jobs to worker processes
+ */
+QVariantMap ResourcePolicy::toMap() const
+{
+    QVariantMap map;
+    map.insert("javascript", javascript);
+    map.insert("images", images);
+    map.insert("plugins", plugins);
+    map.insert("thirdParty", thirdParty);
+    map.insert("allow", allowHosts);
+    map.insert("deny", denyHosts);
+    return map;
+}
+
+ResourcePolicy ResourcePolicy::fromMap(
+    const QVariantMap &map)
+{
+    ResourcePolicy policy;
+    policy.javascript = map.value("javascript", policy.javascript).toBool();
+    policy.images = map.value("images", policy.images).toBool();
+    policy.plugins = map.value("plugins", policy.plugins).toBool();
+    policy.thirdParty = map.value("thirdParty", policy.thirdParty).toBool();
+    policy.allowHosts = map.value("allow").toStringList();
+    policy.denyHosts = map.value("deny").toStringList();
+    return policy;
+}
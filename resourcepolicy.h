@@ -0,0 +1,63 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RESOURCEPOLICY_H
+#define RESOURCEPOLICY_H
+
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+#include <QUrl>
+
+class QWebPage;
+
+/*
+ * What a print job's pages are allowed to load and run. JavaScript, images
+ * and plugins are switched in the page settings, while the host lists are
+ * enforced by the network manager. Host names match themselves and all their
+ * subdomains.
+ */
+struct ResourcePolicy
+{
+    bool        javascript;     // Run scripts
+    bool        images;         // Load images
+    bool        plugins;        // Run plugins such as Flash
+    bool        thirdParty;     // Load resources from other sites than the document
+    QStringList allowHosts;     // If not empty, only load resources from these hosts
+    QStringList denyHosts;      // Never load resources from these hosts
+
+    ResourcePolicy() : javascript(true), images(true), plugins(false), thirdParty(true) {}
+
+    bool allows(const QUrl &url, const QUrl &documentUrl) const;
+    void allowOnly(const QStringList &hosts);
+    bool filtersRequests() const { return !thirdParty || !allowHosts.isEmpty() || !denyHosts.isEmpty(); }
+    void apply(QWebPage *page) const;
+    static void reset(QWebPage *page);
+
+    QVariantMap toMap() const;
+    static ResourcePolicy fromMap(const QVariantMap &map);
+};
+
+#endif // RESOURCEPOLICY_H
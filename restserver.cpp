@@ -1,29 +1,176 @@
 #include "restserver.h"
+#include "json.h"
+#include "rendercache.h"
+#include "printerregistry.h"
+#include "trace.h"
+#include "processmemory.h"
+#include "jobjournal.h"
 #include <QUrl>
+#include <QTcpSocket>
 #include <QTimer>
+#include <QDateTime>
 
-RestServer::RestServer(QObject *parent)
-    : QObject(parent)
+RestServer::RestServer(int poolSize, QObject *parent)
+    : QObject(parent), pagePool(poolSize), jobQueue(&pagePool, &printerCache), workerPool(0), connections(0),
+      maxConnections(0), defaultMaxWait(0), journal(0)
 {
     connect(&server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+    jobQueue.setMetrics(&metrics);
+    connect(&jobQueue, SIGNAL(jobEvent(int,QVariantMap)), this, SLOT(jobEvent(int,QVariantMap)));
+    connect(&jobQueue, SIGNAL(jobFinished(int)), this, SLOT(jobFinished(int)));
+    metrics.describe("jobs_total", "status", "Print jobs finished, by final status.");
+    metrics.describe("documents_total", "result", "Documents finished, by result.");
+    metrics.describe("render_cache_total", "result", "Render cache lookups, by result.");
+    metrics.describe("http_responses_total", "code", "HTTP responses sent, by status code.");
+    metrics.describe("page_pool_recycled_total", QString(), "Web pages thrown away and replaced to keep memory flat.");
+}
+
+RestServer::~RestServer()
+{
+    delete workerPool;
+}
+
+/*
+ * Print jobs in worker processes instead of in the server process, so jobs
+ * for different printers can use more than one core
+ *
+ * PARAMETERS:
+ * count        - Number of worker processes
+ * arguments    - Command line arguments for the workers
+ * jobTimeout   - Seconds a job may take before its worker is restarted
+ */
+void RestServer::setWorkers(
+    int count,
+    const QStringList &arguments,
+    int jobTimeout)
+{
+    if (count <= 0 || workerPool)
+        return;
+    workerPool = new WorkerPool(count, arguments, jobTimeout);
+    jobQueue.setWorkerPool(workerPool);
 }
 
 bool RestServer::listen(quint16 port)
 {
-    return server.listen(QHostAddress::Any, port);
+    if (!server.listen(QHostAddress::Any, port))
+        return false;
+
+    // Start the workers, or pre-create the pages so the first jobs don't pay
+    // for WebKit startup when we print in this process
+    if (workerPool)
+        return workerPool->start();
+    pagePool.warm();
+    return true;
+}
+
+/*
+ * Keep a journal of the accepted jobs, and queue again the jobs that were
+ * accepted but never finished before the last time the server stopped.
+ * Should be called once the workers are set up. Returns false if the journal
+ * can't be written.
+ *
+ * PARAMETERS:
+ * path         - Journal file
+ * commitDelay  - Milliseconds to gather records before committing them
+ */
+bool RestServer::setJournal(
+    const QString &path,
+    int commitDelay)
+{
+    if (journal)
+        return true;
+    journal = new JobJournal(path, commitDelay, this);
+    journal->setMetrics(&metrics);
+    QList<QVariantMap> unfinished;
+    if (!journal->open(&unfinished))
+        return false;
+    jobQueue.reserveIds(journal->highestId());
+    foreach (const QVariantMap &record, unfinished)
+        jobQueue.restore(PrintJob::fromRecord(record));
+    jobQueue.setJournal(journal);
+    connect(journal, SIGNAL(committed(qint64)), this, SLOT(journalCommitted(qint64)));
+    connect(journal, SIGNAL(failed(qint64)), this, SLOT(journalFailed(qint64)));
+    return true;
+}
+
+/*
+ * Set the request size and idle time limits for new connections
+ */
+void RestServer::setLimits(
+    const HttpLimits &limits)
+{
+    this->limits = limits;
+}
+
+/*
+ * Limit how much work the server takes on, so a burst of requests is turned
+ * away instead of using up all the memory
+ *
+ * PARAMETERS:
+ * maxQueued        - Jobs each priority lane may hold waiting, 0 for no limit
+ * maxRunning       - Jobs that may print at the same time, 0 for one per printer
+ * maxConnections   - Client connections to take at once, 0 for no limit
+ * maxWait          - Seconds jobs may wait to start unless they say otherwise, 0 for ever
+ */
+void RestServer::setAdmission(
+    int maxQueued,
+    int maxRunning,
+    int maxConnections,
+    double maxWait)
+{
+    jobQueue.setLimits(maxQueued, maxRunning);
+    this->maxConnections = qMax(0, maxConnections);
+    defaultMaxWait = qMax(0.0, maxWait);
 }
 
+/*
+ * Accept new clients. Once we have as many connections as we allow, new
+ * clients are told to come back later.
+ */
 void RestServer::newConnection()
 {
-    QTcpSocket *client = server.nextPendingConnection();
-    connect(client, SIGNAL(readyRead()), this, SLOT(readClient()));
-    connect(client, SIGNAL(disconnected()), client, SLOT(deleteLater()));
+    while (QTcpSocket *client = server.nextPendingConnection()) {
+        HttpConnection *connection = new HttpConnection(client, limits);
+        connections++;
+        connect(connection, SIGNAL(destroyed()), this, SLOT(connectionClosed()));
+        connect(connection, SIGNAL(responseSent(QByteArray,double)), this, SLOT(responseSent(QByteArray,double)));
+        if (maxConnections > 0 && connections > maxConnections) {
+            connection->refuse("503 Service Unavailable", "too many connections", 1);
+            continue;
+        }
+        connect(connection, SIGNAL(requestReceived(HttpConnection*,HttpRequest)),
+                this, SLOT(handleRequest(HttpConnection*,HttpRequest)));
+    }
+}
+
+/*
+ * A client connection has gone away
+ */
+void RestServer::connectionClosed()
+{
+    connections--;
+}
+
+/*
+ * Record how long it took to answer a request
+ */
+void RestServer::responseSent(
+    const QByteArray &status,
+    double seconds)
+{
+    metrics.increment("http_responses_total", status.left(3));
+    metrics.observe("response", seconds);
 }
 
-static QMap<QString, QString> parseQuery(const QString &query)
+/*
+ * Parse URL encoded parameters, from a query string or a form body
+ */
+static QMap<QString, QString> parseQuery(const QString &query, bool form = false)
 {
     QMap<QString, QString> params;
-    foreach (const QString &pair, query.split('&', QString::SkipEmptyParts)) {
+    foreach (QString pair, query.split('&', QString::SkipEmptyParts)) {
+        if (form)
+            pair.replace('+', ' ');
         int eq = pair.indexOf('=');
         if (eq > 0) {
             QString key = QUrl::fromPercentEncoding(pair.left(eq).toUtf8());
@@ -34,78 +181,759 @@ static QMap<QString, QString> parseQuery(const QString &query)
     return params;
 }
 
-void RestServer::readClient()
+/*
+ * Write a JSON response to the client
+ */
+static void writeJson(
+    HttpConnection *client,
+    const QByteArray &status,
+    const QVariant &body,
+    const QByteArray &headers = QByteArray())
+{
+    client->respond(status, "application/json", Json::stringify(body), headers);
+}
+
+/*
+ * Write a JSON error response to the client
+ */
+static void writeError(
+    HttpConnection *client,
+    const QByteArray &status,
+    const QString &message)
+{
+    QVariantMap error;
+    error.insert("error", message);
+    writeJson(client, status, error);
+}
+
+/*
+ * Build the page setup from the request parameters. Returns false with the
+ * reason in error if they are not valid.
+ */
+static bool optionsFromParams(
+    const QMap<QString, QString> &params,
+    PrintOptions *result,
+    QString *error)
+{
+    PrintOptions options;
+    options.printer = params.value("p", "Default");
+    options.leftMargin = params.value("l", "0.5").toDouble();
+    options.topMargin = params.value("t", "0.5").toDouble();
+    options.rightMargin = params.value("r", "0.5").toDouble();
+    options.bottomMargin = params.value("b", "0.5").toDouble();
+    options.paper = params.value("a", "A4");
+    options.orientation = params.value("o", "portrait");
+    options.pageFrom = params.value("pagefrom", "0").toInt();
+    options.pageTo = params.value("pageto", "0").toInt();
+    options.paperWidth = params.value("width", "0").toDouble();
+    options.paperHeight = params.value("height", "0").toDouble();
+    options.coalesce = params.value("coalesce", "0").toInt();
+    options.output = params.value("output", "printer").toLower();
+    options.dpi = params.value("dpi", "203").toInt();
+    options.copies = qMax(1, params.value("copies", "1").toInt());
+    if (!PrintOptions::knownOutput(options.output)) {
+        *error = "output must be printer, pdf, pbm or pwg";
+        return false;
+    }
+    if (params.contains("a") && params.value("a").contains(',')) {
+        QStringList dims = params.value("a").split(',');
+        if (dims.size() == 2) {
+            bool ok1, ok2;
+            double w = dims[0].toDouble(&ok1);
+            double h = dims[1].toDouble(&ok2);
+            if (ok1 && ok2 && w > 0 && h > 0) {
+                options.paperWidth = w;
+                options.paperHeight = h;
+            }
+        }
+    }
+    *result = options;
+    return true;
+}
+
+/*
+ * Read an on/off request parameter, keeping the default if it is not given
+ */
+static bool flagParam(
+    const QMap<QString, QString> &params,
+    const QString &name,
+    bool defaultValue)
+{
+    if (!params.contains(name))
+        return defaultValue;
+    QString value = params.value(name).toLower();
+    return value != "0" && value != "false" && value != "no" && value != "off";
+}
+
+/*
+ * Build the job's resource policy from the request parameters on top of the
+ * server default. A request can only tighten the server's policy: what the
+ * server switched off stays off, hosts it denied stay denied and hosts it
+ * doesn't allow are never let through.
+ */
+static ResourcePolicy policyFromParams(
+    const QMap<QString, QString> &params,
+    const ResourcePolicy &defaults)
+{
+    ResourcePolicy policy = defaults;
+    policy.javascript = defaults.javascript && flagParam(params, "js", true);
+    policy.images = defaults.images && flagParam(params, "images", true);
+    policy.plugins = defaults.plugins && flagParam(params, "plugins", true);
+    policy.thirdParty = defaults.thirdParty && flagParam(params, "thirdparty", true);
+    if (params.contains("allow"))
+        policy.allowOnly(params.value("allow").split(',', QString::SkipEmptyParts));
+    if (params.contains("deny"))
+        policy.denyHosts += params.value("deny").split(',', QString::SkipEmptyParts);
+    return policy;
+}
+
+/*
+ * Build the job's print trigger and time limits from the request parameters
+ * on top of the server default. Returns false with the error set if they are
+ * invalid.
+ */
+static bool loadFromParams(
+    const QMap<QString, QString> &params,
+    const LoadOptions &defaults,
+    LoadOptions *load,
+    QString *error)
+{
+    *load = defaults;
+    if (params.contains("trigger") && !LoadOptions::parseTrigger(params.value("trigger"), &load->trigger)) {
+        *error = "trigger must be load, domready or ready";
+        return false;
+    }
+    if (params.contains("ondeadline")) {
+        QString onDeadline = params.value("ondeadline").toLower();
+        if (onDeadline != "print" && onDeadline != "fail") {
+            *error = "ondeadline must be print or fail";
+            return false;
+        }
+        load->printOnDeadline = onDeadline == "print";
+    }
+    load->deadline = params.value("deadline", QString::number(load->deadline)).toDouble();
+    load->resourceTimeout = params.value("resourcetimeout", QString::number(load->resourceTimeout)).toDouble();
+    return true;
+}
+
+/*
+ * Read the priority lane and the longest a job may wait to start from the
+ * request parameters. Returns false with the reason in error if they are not
+ * valid.
+ */
+static bool laneFromParams(
+    const QMap<QString, QString> &params,
+    double defaultMaxWait,
+    PrintJob *job,
+    QString *error)
+{
+    if (!PrintJob::parsePriority(params.value("priority", "bulk"), &job->priority)) {
+        *error = "priority must be urgent or bulk";
+        return false;
+    }
+    job->maxWait = params.contains("maxwait") ? params.value("maxwait").toDouble() : defaultMaxWait;
+    return true;
+}
+
+/*
+ * True if two jobs print with the same settings, so their documents can go
+ * in one job
+ */
+static bool sameSetup(
+    const PrintJob *a,
+    const PrintJob *b)
+{
+    return a->priority == b->priority && a->maxWait == b->maxWait && a->traced == b->traced
+        && a->options.toMap() == b->options.toMap()
+        && a->policy.toMap() == b->policy.toMap()
+        && a->load.toMap() == b->load.toMap();
+}
+
+/*
+ * Merge the values of a JSON object into the request parameters. Lists of
+ * plain values are joined with commas.
+ */
+static QMap<QString, QString> mergeParams(
+    QMap<QString, QString> params,
+    const QVariantMap &values)
+{
+    for (QVariantMap::const_iterator it = values.constBegin(); it != values.constEnd(); ++it) {
+        if (it.value().type() == QVariant::List) {
+            QStringList items;
+            foreach (const QVariant &item, it.value().toList()) {
+                if (item.type() == QVariant::Map || item.type() == QVariant::List)
+                    break;
+                items << item.toString();
+            }
+            if (items.size() == it.value().toList().size())
+                params.insert(it.key(), items.join(","));
+        } else if (it.value().type() != QVariant::Map)
+            params.insert(it.key(), it.value().toString());
+    }
+    return params;
+}
+
+/*
+ * Handle a batch of documents posted as JSON. The body is either an array of
+ * documents, or an object with a 'documents' array and default parameters for
+ * all of them. Each document has either a 'url' or inline 'html' (with an
+ * optional 'baseUrl'), plus any of the /print parameters. Every document is
+ * queued as its own job, unless coalescing is asked for, in which case runs of
+ * documents with the same settings share a job (and so a spool job) of up to
+ * that many documents. The response lists the job for each document.
+ */
+void RestServer::printBatch(
+    HttpConnection *client,
+    const HttpRequest &request,
+    const QMap<QString, QString> &params)
+{
+    QString error;
+    QVariant body = Json::parse(request.body, &error);
+    if (!error.isEmpty()) {
+        writeError(client, "400 Bad Request", "invalid JSON: " + error);
+        return;
+    }
+    QMap<QString, QString> defaults = params;
+    QVariantList documents;
+    if (body.type() == QVariant::Map) {
+        defaults = mergeParams(defaults, body.toMap());
+        documents = body.toMap().value("documents").toList();
+    } else {
+        documents = body.toList();
+    }
+    if (documents.isEmpty()) {
+        writeError(client, "400 Bad Request", "no documents to print");
+        return;
+    }
+
+    QVariantList results;
+    QList<PrintJob*> jobs;
+    QMap<int, int> jobOf;   // Job for each accepted document, by document index
+    for (int i = 0; i < documents.size(); i++) {
+        QVariantMap document = documents.at(i).toMap();
+        QVariantMap result;
+        result.insert("index", i);
+        QString url = document.value("url").toString();
+        QString html = document.value("html").toString();
+        if (url.isEmpty() && html.isEmpty()) {
+            result.insert("status", "rejected");
+            result.insert("error", "document needs a url or html");
+            results.append(result);
+            continue;
+        }
+
+        QMap<QString, QString> jobParams = mergeParams(defaults, document);
+        PrintJob *job = new PrintJob;
+        PrintOptions options;
+        LoadOptions load;
+        QString paramError;
+        if (!optionsFromParams(jobParams, &options, &paramError) || !loadFromParams(jobParams, defaultLoad, &load, &paramError)
+            || !laneFromParams(jobParams, defaultMaxWait, job, &paramError) || !checkPrinter(options, &paramError)) {
+            delete job;
+            result.insert("status", "rejected");
+            result.insert("error", paramError);
+            results.append(result);
+            continue;
+        }
+        job->options = options;
+        job->policy = policyFromParams(jobParams, defaultPolicy);
+        job->load = load;
+        job->traced = flagParam(jobParams, "trace", false);
+        PrintJob *last = jobs.isEmpty() ? 0 : jobs.last();
+        if (last && last->urls.size() < last->options.coalesce && sameSetup(last, job)) {
+            delete job;
+            job = last;
+        } else {
+            jobs.append(job);
+        }
+        if (!html.isEmpty()) {
+            job->html.insert(job->urls.size(), html);
+            job->baseUrls.insert(job->urls.size(), document.value("baseUrl").toString());
+            job->urls << (url.isEmpty() ? QString("inline:%1").arg(i) : url);
+        } else {
+            job->urls << url;
+        }
+        jobOf.insert(i, jobs.size() - 1);
+        results.append(result);
+    }
+
+    // Only queue the jobs once they have all their documents, and only if
+    // there is room for all of them
+    int urgent = 0;
+    foreach (PrintJob *job, jobs) {
+        if (job->priority == PrintJob::Urgent)
+            urgent++;
+    }
+    if (!admit(client, PrintJob::Urgent, urgent) || !admit(client, PrintJob::Bulk, jobs.size() - urgent)) {
+        qDeleteAll(jobs);
+        return;
+    }
+    QList<int> jobIds;
+    foreach (PrintJob *job, jobs)
+        jobIds.append(jobQueue.submit(job));
+    for (int i = 0; i < results.size(); i++) {
+        QVariantMap result = results.at(i).toMap();
+        int index = result.value("index").toInt();
+        if (!jobOf.contains(index))
+            continue;
+        int id = jobIds.at(jobOf.value(index));
+        result.insert("id", id);
+        result.insert("status", PrintJob::stateName(jobQueue.job(id)->state));
+        results[i] = result;
+    }
+
+    QVariantMap resp;
+    resp.insert("documents", results);
+    if (jobIds.isEmpty()) {
+        resp.insert("error", "no valid documents");
+        writeJson(client, "400 Bad Request", resp);
+        return;
+    }
+    int batch = jobQueue.createBatch(jobIds);
+    resp.insert("batch", batch);
+    QByteArray location = "Location: /batches/" + QByteArray::number(batch) + "\r\n";
+    accepted(client, jobIds, resp, location, params.value("stream") == "1");
+}
+
+/*
+ * Handle a merge job posted as JSON. The body is an object with the template
+ * as a 'url' to load or as 'html' (with an optional 'baseUrl'), the
+ * 'records' to merge into it and any of the /print parameters. The template
+ * is loaded once and printed for every record, as one job.
+ */
+void RestServer::printMerge(
+    HttpConnection *client,
+    const HttpRequest &request,
+    const QMap<QString, QString> &params)
+{
+    QString error;
+    QVariantMap body = Json::parse(request.body, &error).toMap();
+    if (!error.isEmpty()) {
+        writeError(client, "400 Bad Request", "invalid JSON: " + error);
+        return;
+    }
+    QString url = body.value("url").toString();
+    QString html = body.value("html").toString();
+    QVariantList records = body.value("records").toList();
+    if (url.isEmpty() && html.isEmpty()) {
+        writeError(client, "400 Bad Request", "the template needs a url or html");
+        return;
+    }
+    if (records.isEmpty()) {
+        writeError(client, "400 Bad Request", "no records to merge");
+        return;
+    }
+    foreach (const QVariant &record, records) {
+        if (record.type() != QVariant::Map) {
+            writeError(client, "400 Bad Request", "every record must be an object");
+            return;
+        }
+    }
+
+    QMap<QString, QString> jobParams = mergeParams(params, body);
+    PrintJob *job = new PrintJob;
+    PrintOptions options;
+    LoadOptions load;
+    if (!optionsFromParams(jobParams, &options, &error) || !loadFromParams(jobParams, defaultLoad, &load, &error)
+        || !laneFromParams(jobParams, defaultMaxWait, job, &error) || !checkPrinter(options, &error)) {
+        delete job;
+        writeError(client, "400 Bad Request", error);
+        return;
+    }
+    if (!admit(client, job->priority, 1)) {
+        delete job;
+        return;
+    }
+    job->options = options;
+    job->policy = policyFromParams(jobParams, defaultPolicy);
+    job->load = load;
+    job->traced = flagParam(jobParams, "trace", false);
+    job->urls << (url.isEmpty() ? QString("inline:0") : url);
+    if (!html.isEmpty()) {
+        job->html.insert(0, html);
+        job->baseUrls.insert(0, body.value("baseUrl").toString());
+    }
+    job->records = records;
+    int id = jobQueue.submit(job);
+
+    QByteArray location = "Location: /jobs/" + QByteArray::number(id) + "\r\n";
+    accepted(client, QList<int>() << id, jobQueue.job(id)->toMap(), location, jobParams.value("stream") == "1");
+}
+
+/*
+ * Check the job's printer is installed and takes its paper, so bad jobs are
+ * turned away before any page is loaded. Anything goes in test mode, as
+ * nothing is printed.
+ */
+bool RestServer::checkPrinter(
+    const PrintOptions &options,
+    QString *error)
+{
+    return jobQueue.isTestMode() || PrinterRegistry::instance()->check(options, error);
+}
+
+/*
+ * Tell the client its jobs were accepted. With a journal the answer waits
+ * until the jobs are committed to it, so a client is never told a job was
+ * accepted that a crash could lose.
+ *
+ * PARAMETERS:
+ * client   - Client that submitted the jobs
+ * jobIds   - Jobs submitted
+ * body     - What to answer with
+ * headers  - Extra headers for the answer
+ * stream   - True to stream the progress of the jobs instead
+ */
+void RestServer::accepted(
+    HttpConnection *client,
+    const QList<int> &jobIds,
+    const QVariantMap &body,
+    const QByteArray &headers,
+    bool stream)
+{
+    if (!journal || journal->committedSequence() >= journal->lastSequence()) {
+        sendAccepted(client, jobIds, body, headers, stream);
+        return;
+    }
+    Acceptance acceptance;
+    acceptance.client = client;
+    acceptance.jobIds = jobIds;
+    acceptance.body = body;
+    acceptance.headers = headers;
+    acceptance.stream = stream;
+    acceptance.sequence = journal->lastSequence();
+    uncommitted.append(acceptance);
+}
+
+/*
+ * Send the answers that were waiting for the journal to commit
+ */
+void RestServer::journalCommitted(
+    qint64 sequence)
+{
+    while (!uncommitted.isEmpty() && uncommitted.first().sequence <= sequence) {
+        Acceptance acceptance = uncommitted.takeFirst();
+        if (acceptance.client)
+            sendAccepted(acceptance.client, acceptance.jobIds, acceptance.body, acceptance.headers, acceptance.stream);
+    }
+}
+
+/*
+ * The journal could not write the jobs the waiting answers depend on, so
+ * they were never made durable. The jobs still waiting to start are taken
+ * back and the clients are told to try again later. Jobs that already
+ * started can't be recalled, so they are listed in the answer for the
+ * client not to submit again.
+ */
+void RestServer::journalFailed(
+    qint64 sequence)
 {
-    QTcpSocket *client = qobject_cast<QTcpSocket*>(sender());
+    while (!uncommitted.isEmpty() && uncommitted.first().sequence <= sequence) {
+        Acceptance acceptance = uncommitted.takeFirst();
+        QVariantList started;
+        foreach (int id, acceptance.jobIds) {
+            if (!jobQueue.withdraw(id, "job journal write failed"))
+                started.append(id);
+        }
+        if (!acceptance.client)
+            continue;
+        QVariantMap error;
+        error.insert("error", "job journal write failed");
+        error.insert("retryAfter", 1);
+        if (!started.isEmpty())
+            error.insert("started", started);
+        writeJson(acceptance.client, "503 Service Unavailable", error, "Retry-After: 1\r\n");
+    }
+}
+
+/*
+ * Answer a request that submitted jobs. A job may have finished while its
+ * answer waited for the journal, in which case its stream ends straight away.
+ */
+void RestServer::sendAccepted(
+    HttpConnection *client,
+    const QList<int> &jobIds,
+    const QVariantMap &body,
+    const QByteArray &headers,
+    bool stream)
+{
+    qint64 start = Trace::now();
+    if (stream) {
+        startStream(client, jobIds, body, headers);
+        foreach (int id, jobIds) {
+            const PrintJob *job = jobQueue.job(id);
+            if (job && job->finishedAt.isValid())
+                jobFinished(id);
+        }
+    } else {
+        writeJson(client, "202 Accepted", body, headers);
+    }
+    traceResponse(jobIds, start);
+}
+
+/*
+ * Add the time taken to answer the request that submitted the jobs to the
+ * traces of those being traced
+ */
+void RestServer::traceResponse(
+    const QList<int> &jobIds,
+    qint64 start)
+{
+    qint64 end = Trace::now();
+    foreach (int id, jobIds)
+        jobQueue.addTrace(id, Trace::span(id, 0, "respond", start, end));
+}
+
+/*
+ * Check there is room in the lane for the new jobs. If there isn't, the
+ * client is told to try again later and false is returned.
+ */
+bool RestServer::admit(
+    HttpConnection *client,
+    PrintJob::Priority priority,
+    int count)
+{
+    if (count <= 0 || jobQueue.hasRoom(priority, count))
+        return true;
+    QVariantMap error;
+    error.insert("error", PrintJob::priorityName(priority) + " queue is full");
+    int retryAfter = jobQueue.retryAfter(priority);
+    error.insert("retryAfter", retryAfter);
+    writeJson(client, "429 Too Many Requests", error, "Retry-After: " + QByteArray::number(retryAfter) + "\r\n");
+    return false;
+}
+
+/*
+ * Answer with a stream of newline delimited JSON events instead of waiting
+ * for the jobs. The first line is what the client would otherwise have got
+ * back, then a line follows each time a document starts loading, is loaded,
+ * is spooled or fails, and a "done" line with the result of each job. The
+ * response ends once every job is done.
+ */
+void RestServer::startStream(
+    HttpConnection *client,
+    const QList<int> &jobIds,
+    const QVariantMap &first,
+    const QByteArray &headers)
+{
+    QVariantMap event = first;
+    event.insert("event", "queued");
+    client->beginStream("200 OK", "application/x-ndjson", headers);
+    client->writeStream(Json::stringify(event) + "\n");
+    foreach (int id, jobIds)
+        streams.insert(id, client);
+}
+
+/*
+ * Send progress on a job to the client streaming it, if any
+ */
+void RestServer::jobEvent(
+    int id,
+    const QVariantMap &event)
+{
+    HttpConnection *client = streams.value(id);
     if (!client)
         return;
-    if (!client->canReadLine())
+    QVariantMap line = event;
+    line.insert("id", id);
+    line.insert("time", QDateTime::currentDateTime());
+    client->writeStream(Json::stringify(line) + "\n");
+}
+
+/*
+ * Send the result of a job to the client streaming it, and end the stream
+ * if that was the last of its jobs
+ */
+void RestServer::jobFinished(
+    int id)
+{
+    if (!streams.contains(id))
+        return;
+    QPointer<HttpConnection> client = streams.take(id);
+    const PrintJob *job = jobQueue.job(id);
+    if (!client || !job)
         return;
+    QVariantMap line = job->toMap();
+    line.insert("event", "done");
+    client->writeStream(Json::stringify(line) + "\n");
+    foreach (const QPointer<HttpConnection> &other, streams) {
+        if (other.data() == client.data())
+            return;
+    }
+    client->endStream();
+}
 
-    QString requestLine = QString::fromUtf8(client->readLine()).trimmed();
-    if (!requestLine.startsWith("GET")) {
-        client->write("HTTP/1.1 400 Bad Request\r\n\r\n");
-        client->disconnectFromHost();
+/*
+ * Handle a request from a client. Parameters can be given in the query
+ * string, or for POST requests as a URL encoded form body.
+ */
+void RestServer::handleRequest(
+    HttpConnection *client,
+    const HttpRequest &request)
+{
+    if (request.method != "GET" && request.method != "POST") {
+        writeError(client, "405 Method Not Allowed", "only GET and POST are supported");
         return;
     }
 
-    QString path = requestLine.section(' ', 1, 1);
-    QString endpoint = path.section('?', 0, 0);
-    QString query = path.section('?', 1);
-    QMap<QString, QString> params = parseQuery(query);
+    QString endpoint = request.path;
+    QMap<QString, QString> params = parseQuery(request.query);
+    if (request.method == "POST" && request.header("content-type").startsWith("application/x-www-form-urlencoded")) {
+        QMap<QString, QString> form = parseQuery(QString::fromUtf8(request.body), true);
+        for (QMap<QString, QString>::const_iterator it = form.constBegin(); it != form.constEnd(); ++it)
+            params.insert(it.key(), it.value());
+    }
 
     if (endpoint == "/print" && params.contains("url")) {
-        QByteArray resp = "";
-
         QStringList urls; urls << params.value("url");
-        QString printer = params.value("p", "Default");
-        double l = params.value("l", "0.5").toDouble();
-        double t = params.value("t", "0.5").toDouble();
-        double r = params.value("r", "0.5").toDouble();
-        double b = params.value("b", "0.5").toDouble();
-        QString paper = params.value("a", "A4");
-        QString orient = params.value("o", "portrait");
-        int pageFrom = params.value("pagefrom", "0").toInt();
-        int pageTo = params.value("pageto", "0").toInt();
-        double width = params.value("width", "0").toDouble();
-        double height = params.value("height", "0").toDouble();
-        if (params.contains("a") && params.value("a").contains(',')) {
-            QStringList dims = params.value("a").split(',');
-            if (dims.size() == 2) {
-                bool ok1, ok2;
-                double w = dims[0].toDouble(&ok1);
-                double h = dims[1].toDouble(&ok2);
-                if (ok1 && ok2 && w > 0 && h > 0) {
-                    width = w;
-                    height = h;
-                }
-            }
+        PrintJob *job = new PrintJob;
+        QString paramError;
+        if (!optionsFromParams(params, &job->options, &paramError) || !loadFromParams(params, defaultLoad, &job->load, &paramError)
+            || !laneFromParams(params, defaultMaxWait, job, &paramError) || !checkPrinter(job->options, &paramError)) {
+            delete job;
+            writeError(client, "400 Bad Request", paramError);
+            return;
         }
-        // Prepare the response in json
-        resp = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n";
-        resp += "[{\"status\":\"started\",\"printer\":\"" + QUrl::toPercentEncoding(printer) + "\",";
-        resp += "\"urls\":[";
-        for (int i = 0; i < urls.size(); ++i) {
-            resp += "\"" + QUrl::toPercentEncoding(urls[i]) + "\"";
-            if (i < urls.size() - 1) {
-                resp += ",";
-            }
+        if (!admit(client, job->priority, 1)) {
+            delete job;
+            return;
         }
-        resp += "],\"left\":" + QString::number(l) + ",\"top\":" + QString::number(t) +
-                ",\"right\":" + QString::number(r) + ",\"bottom\":" + QString::number(b) +
-                ",\"paper\":\"" + QUrl::toPercentEncoding(paper) + "\",\"orientation\":\"" +
-                QUrl::toPercentEncoding(orient) + "\",\"pageFrom\":" + QString::number(pageFrom) +
-                ",\"pageTo\":" + QString::number(pageTo);
-        resp += ",\"width\":" + QString::number(width) + ",\"height\":" + QString::number(height) + "}\r\n";
-        
-
-        PrintHtml *job = new PrintHtml(false, true, urls, printer, l, t, r, b, paper, orient, pageFrom, pageTo, width, height, false, client, resp);
-        connect(job, SIGNAL(finished()), job, SLOT(deleteLater()));
-        QTimer::singleShot(0, job, SLOT(run()));
+        job->policy = policyFromParams(params, defaultPolicy);
+        job->traced = flagParam(params, "trace", false);
+        job->urls = urls;
 
-        
+        // Queue the job and tell the client where to find out how it went
+        int id = jobQueue.submit(job);
+        QByteArray location = "Location: /jobs/" + QByteArray::number(id) + "\r\n";
+        accepted(client, QList<int>() << id, jobQueue.job(id)->toMap(), location, params.value("stream") == "1");
+    } else if (endpoint == "/print/batch") {
+        if (request.method != "POST") {
+            writeError(client, "405 Method Not Allowed", "batches must be POSTed as JSON");
+            return;
+        }
+        printBatch(client, request, params);
+    } else if (endpoint == "/print/merge") {
+        if (request.method != "POST") {
+            writeError(client, "405 Method Not Allowed", "merge jobs must be POSTed as JSON");
+            return;
+        }
+        printMerge(client, request, params);
+    } else if (endpoint.startsWith("/batches/")) {
+        bool ok;
+        int id = endpoint.mid(9).toInt(&ok);
+        QList<int> jobIds = jobQueue.batch(id);
+        if (!ok || jobIds.isEmpty()) {
+            writeError(client, "404 Not Found", "unknown batch");
+            return;
+        }
+        QVariantList documents;
+        foreach (int jobId, jobIds) {
+            const PrintJob *job = jobQueue.job(jobId);
+            QVariantMap document;
+            if (job) {
+                document = job->toMap();
+            } else {
+                document.insert("id", jobId);
+                document.insert("status", "expired");
+            }
+            documents.append(document);
+        }
+        QVariantMap resp;
+        resp.insert("batch", id);
+        resp.insert("documents", documents);
+        writeJson(client, "200 OK", resp);
+    } else if (endpoint.startsWith("/jobs/") && endpoint.endsWith("/trace")) {
+        bool ok;
+        const PrintJob *job = jobQueue.job(endpoint.mid(6, endpoint.size() - 12).toInt(&ok));
+        if (ok && job && job->traced) {
+            client->respond("200 OK", "application/json", Trace::toJson(job->trace));
+        } else {
+            writeError(client, "404 Not Found", ok && job ? "job was not traced" : "unknown job");
+        }
+    } else if (endpoint.startsWith("/jobs/")) {
+        bool ok;
+        const PrintJob *job = jobQueue.job(endpoint.mid(6).toInt(&ok));
+        if (ok && job) {
+            writeJson(client, "200 OK", job->toMap());
+        } else {
+            writeError(client, "404 Not Found", "unknown job");
+        }
+    } else if (endpoint == "/printers") {
+        QVariantMap resp;
+        resp.insert("printers", PrinterRegistry::instance()->printers());
+        resp.insert("refreshed", PrinterRegistry::instance()->refreshed().toString(Qt::ISODate));
+        writeJson(client, "200 OK", resp);
+    } else if (endpoint == "/metrics") {
+        metrics.setGauge("jobs_queued", jobQueue.queuedCount());
+        metrics.setGauge("jobs_running", jobQueue.runningCount());
+        metrics.setGauge("connections_open", connections);
+        metrics.setGauge("page_pool_idle", pagePool.idleCount());
+        metrics.setGauge("page_pool_busy", pagePool.busyCount());
+        metrics.setCounter("page_pool_recycled_total", pagePool.recycled());
+        metrics.setGauge("process_resident_memory_bytes", ProcessMemory::resident());
+        metrics.setGauge("process_resident_memory_peak_bytes", ProcessMemory::peakResident());
+        if (workerPool)
+            metrics.setGauge("worker_resident_memory_bytes", workerPool->residentBytes());
+        client->respond("200 OK", "text/plain; version=0.0.4", metrics.text());
+    } else if (endpoint == "/status") {
+        QVariantMap pool;
+        pool.insert("size", pagePool.size());
+        pool.insert("idle", pagePool.idleCount());
+        pool.insert("busy", pagePool.busyCount());
+        pool.insert("created", pagePool.created());
+        pool.insert("recycled", pagePool.recycled());
+        QVariantMap printers;
+        printers.insert("entries", printerCache.count());
+        printers.insert("hits", printerCache.hits());
+        printers.insert("misses", printerCache.misses());
+        QVariantMap jobs;
+        jobs.insert("queued", jobQueue.queuedCount());
+        jobs.insert("urgent", jobQueue.queuedCount(PrintJob::Urgent));
+        jobs.insert("bulk", jobQueue.queuedCount(PrintJob::Bulk));
+        jobs.insert("running", jobQueue.runningCount());
+        jobs.insert("dropped", jobQueue.droppedCount());
+        jobs.insert("connections", connections);
+        QVariantMap cache;
+        CacheStats stats = NetworkManager::instance()->stats();
+        cache.insert("hits", stats.hits);
+        cache.insert("misses", stats.misses);
+        if (DiskCache *disk = NetworkManager::instance()->diskCache()) {
+            cache.insert("size", disk->cacheSize());
+            cache.insert("maxSize", disk->maximumCacheSize());
+        }
+        QVariantMap renderCache;
+        CacheStats renders = jobQueue.renderStats();
+        renderCache.insert("hits", renders.hits);
+        renderCache.insert("misses", renders.misses);
+        renderCache.insert("entries", RenderCache::count());
+        renderCache.insert("size", RenderCache::size());
+        renderCache.insert("maxSize", RenderCache::maxSize());
+        QVariantMap memory;
+        memory.insert("rss", ProcessMemory::resident());
+        memory.insert("peakRss", ProcessMemory::peakResident());
+        memory.insert("maxRss", WebPagePool::maxResident());
+        memory.insert("webkitCache", ProcessMemory::webKitCache());
+        memory.insert("recycleAfter", WebPagePool::maxUses());
+        QVariantMap status;
+        if (journal)
+            status.insert("journal", journal->stats());
+        status.insert("memory", memory);
+        status.insert("cache", cache);
+        status.insert("renderCache", renderCache);
+        status.insert("pagePool", pool);
+        status.insert("printerCache", printers);
+        status.insert("jobs", jobs);
+        if (workerPool) {
+            QVariantMap workers;
+            workers.insert("count", workerPool->count());
+            workers.insert("busy", workerPool->busyCount());
+            workers.insert("pending", workerPool->pendingCount());
+            workers.insert("restarts", workerPool->restarts());
+            workers.insert("rss", workerPool->residentBytes());
+            status.insert("workers", workers);
+        }
+        writeJson(client, "200 OK", status);
     } else {
-        client->write("HTTP/1.1 404 Not Found\r\n\r\n");
-        client->disconnectFromHost();
+        writeError(client, "404 Not Found", "unknown endpoint");
     }
 }
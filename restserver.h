@@ -3,22 +3,75 @@
 
 #include <QObject>
 #include <QTcpServer>
-#include <QTcpSocket>
-#include "printhtml.h"
+#include <QPointer>
+#include "httpconnection.h"
+#include "webpagepool.h"
+#include "printercache.h"
+#include "jobqueue.h"
+#include "workerpool.h"
+#include "metrics.h"
+
+class JobJournal;
 
 class RestServer : public QObject
 {
     Q_OBJECT
 public:
-    explicit RestServer(QObject *parent = 0);
+    explicit RestServer(int poolSize = 2, QObject *parent = 0);
+    ~RestServer();
     bool listen(quint16 port);
+    void setWorkers(int count, const QStringList &arguments, int jobTimeout);
+    void setLimits(const HttpLimits &limits);
+    void setTestMode(bool testMode) { jobQueue.setTestMode(testMode); }
+    void setPolicy(const ResourcePolicy &policy) { defaultPolicy = policy; }
+    void setLoadOptions(const LoadOptions &load) { defaultLoad = load; }
+    void setAdmission(int maxQueued, int maxRunning, int maxConnections, double maxWait);
+    bool setJournal(const QString &path, int commitDelay);
 
 private slots:
     void newConnection();
-    void readClient();
+    void handleRequest(HttpConnection *client, const HttpRequest &request);
+    void responseSent(const QByteArray &status, double seconds);
+    void jobEvent(int id, const QVariantMap &event);
+    void jobFinished(int id);
+    void connectionClosed();
+    void journalCommitted(qint64 sequence);
+    void journalFailed(qint64 sequence);
 
 private:
+    void printBatch(HttpConnection *client, const HttpRequest &request, const QMap<QString, QString> &params);
+    void printMerge(HttpConnection *client, const HttpRequest &request, const QMap<QString, QString> &params);
+    bool checkPrinter(const PrintOptions &options, QString *error);
+    bool admit(HttpConnection *client, PrintJob::Priority priority, int count);
+    void traceResponse(const QList<int> &jobIds, qint64 start);
+    void accepted(HttpConnection *client, const QList<int> &jobIds, const QVariantMap &body, const QByteArray &headers, bool stream);
+    void sendAccepted(HttpConnection *client, const QList<int> &jobIds, const QVariantMap &body, const QByteArray &headers, bool stream);
+
+    struct Acceptance {
+        QPointer<HttpConnection> client;
+        QList<int>  jobIds;
+        QVariantMap body;       // What to answer with
+        QByteArray  headers;
+        bool        stream;     // True to stream progress instead
+        qint64      sequence;   // Journal record the answer waits for
+    };
+    void startStream(HttpConnection *client, const QList<int> &jobIds, const QVariantMap &first, const QByteArray &headers);
+
     QTcpServer server;
+    HttpLimits limits;      // Request size and idle time limits
+    WebPagePool pagePool;   // Warm web pages shared by all print jobs
+    PrinterCache printerCache; // Configured printers shared by all print jobs
+    JobQueue jobQueue;      // Per printer queues of submitted jobs
+    WorkerPool *workerPool; // Worker processes the jobs print in, if any
+    Metrics metrics;        // Job timings and outcomes for /metrics
+    ResourcePolicy defaultPolicy; // Policy for jobs that don't set their own
+    LoadOptions defaultLoad; // Print trigger and time limits for jobs that don't set their own
+    QHash<int, QPointer<HttpConnection> > streams; // Connections streaming progress, by job id
+    int connections;        // Client connections open
+    int maxConnections;     // Connections we take before turning clients away, 0 for no limit
+    double defaultMaxWait;  // Seconds jobs may wait to start when they don't say, 0 for ever
+    JobJournal *journal;    // Where accepted jobs are made durable, if anywhere
+    QList<Acceptance> uncommitted; // Answers waiting for their jobs to be journaled, oldest first
 };
 
 #endif // RESTSERVER_H
@@ -0,0 +1,78 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "spooldirectory.h"
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+
+QString SpoolDirectory::dir;
+int SpoolDirectory::keep = 0;
+int SpoolDirectory::counter = 0;
+
+/*
+ * Set where the files go and how many of them to keep
+ *
+ * PARAMETERS:
+ * path     - Directory to write the files to, created if need be
+ * maxFiles - Number of files to keep, 0 to keep them all
+ */
+void SpoolDirectory::setPath(
+    const QString &path,
+    int maxFiles)
+{
+    dir = path;
+    keep = qMax(0, maxFiles);
+}
+
+/*
+ * Return a new, unused file name in the spool directory. Names sort in the
+ * order they were made and include the process id, as the worker processes
+ * share the directory.
+ */
+QString SpoolDirectory::newFile(
+    const QString &suffix)
+{
+    QDir().mkpath(dir);
+    return QString("%1/printhtml-%2-%3-%4.%5")
+        .arg(dir)
+        .arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmsszzz"))
+        .arg(QCoreApplication::applicationPid())
+        .arg(++counter)
+        .arg(suffix);
+}
+
+/*
+ * Delete the oldest files until we are within our limit
+ */
+void SpoolDirectory::rotate()
+{
+    if (keep <= 0)
+        return;
+    QStringList files = QDir(dir).entryList(QStringList() << "printhtml-*", QDir::Files, QDir::Time);
+    for (int i = keep; i < files.size(); i++)
+        QFile::remove(dir + "/" + files.at(i));
+}
@@ -0,0 +1,51 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SPOOLDIRECTORY_H
+#define SPOOLDIRECTORY_H
+
+#include <QString>
+
+/*
+ * Directory that documents rendered to files are written to. It only keeps
+ * the newest files, deleting the oldest as new ones are added, so it can be
+ * left to run without filling the disk. Set up once for the process.
+ */
+class SpoolDirectory
+{
+public:
+    static void setPath(const QString &path, int maxFiles);
+    static QString path()   { return dir; }
+    static int maxFiles()   { return keep; }
+    static QString newFile(const QString &suffix);
+    static void rotate();
+
+private:
+    static QString  dir;
+    static int      keep;       // Number of files to keep, 0 for all of them
+    static int      counter;    // Files named so far by this process
+};
+
+#endif // SPOOLDIRECTORY_H
@@ -0,0 +1,304 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "stdinrunner.h"
+#include "commandline.h"
+#include "printhtml.h"
+#include "json.h"
+#include "trace.h"
+#include <QTimer>
+#include <QFileInfo>
+#include <stdio.h>
+
+/*
+ * Read stdin until it is closed, handing on each line as it comes in
+ */
+void StdinReader::run()
+{
+    char buffer[4096];
+    QByteArray line;
+    while (fgets(buffer, sizeof(buffer), stdin)) {
+        line += buffer;
+        if (line.endsWith('\n')) {
+            emit lineRead(line);
+            line.clear();
+        }
+    }
+    if (!line.isEmpty())
+        emit lineRead(line);
+}
+
+/*
+ * Constructor for the stdin runner
+ *
+ * PARAMETERS:
+ * defaults - Our own command line arguments, which every job starts from
+ * poolSize - Number of warm web pages to keep ready
+ * parent   - Parent object
+ */
+StdinRunner::StdinRunner(
+    const QStringList &defaults,
+    int poolSize,
+    QObject *parent)
+    : QObject(parent), lines(0), closed(false), engine(0), pagePool(poolSize)
+{
+    foreach (const QString &arg, defaults) {
+        if (arg.toLower() != "-stdin")
+            this->defaults << arg;
+    }
+    connect(&reader, SIGNAL(lineRead(QByteArray)), this, SLOT(readJob(QByteArray)));
+    connect(&reader, SIGNAL(finished()), this, SLOT(inputClosed()));
+}
+
+/*
+ * Start reading jobs. Lines arrive once the event loop is running.
+ */
+void StdinRunner::start()
+{
+    pagePool.warm();
+    reader.start();
+}
+
+/*
+ * Turn a job read from stdin into command line arguments. Each key is the
+ * name of a command line option without the dash, so {"p": "Default",
+ * "a": "A5", "test": true} is the same as -p Default -a A5 -test. Options
+ * that take a list, like allow and deny, may be given as arrays. The URLs
+ * to print are given in 'url' or 'urls', and 'args' may hold raw command
+ * line arguments instead. Returns false with the error set if a key is not
+ * an option a job can set, as the command line would take it for a URL.
+ *
+ * PARAMETERS:
+ * job      - Job as read from stdin
+ * args     - Set to the job's command line arguments
+ * error    - Set to what is wrong with the job, if anything
+ */
+bool StdinRunner::jobArguments(
+    const QVariantMap &job,
+    QStringList *args,
+    QString *error)
+{
+    *args = job.value("args").toStringList();
+    for (QVariantMap::const_iterator it = job.constBegin(); it != job.constEnd(); ++it) {
+        QString name = it.key();
+        if (name == "id" || name == "args" || name == "url" || name == "urls")
+            continue;
+        if (name.startsWith('-'))
+            name.remove(0, 1);
+        if (CommandLine::isProcessOption(name)) {
+            *error = "The " + name + " option only takes effect on the command line.";
+            return false;
+        }
+        if (!CommandLine::isRunOption(name)) {
+            *error = "Unknown option " + it.key() + ".";
+            return false;
+        }
+        QString flag = "-" + name;
+        QVariant value = it.value();
+        if (value.type() == QVariant::Bool) {
+            if (value.toBool())
+                *args << flag;
+        } else if (value.type() == QVariant::List) {
+            *args << flag << value.toStringList().join(",");
+        } else {
+            *args << flag << value.toString();
+        }
+    }
+    if (job.contains("url"))
+        *args << job.value("url").toString();
+    *args += job.value("urls").toStringList();
+    return true;
+}
+
+/*
+ * Queue a job read from stdin. Blank lines are skipped.
+ *
+ * PARAMETERS:
+ * line     - Line read from stdin
+ */
+void StdinRunner::readJob(
+    const QByteArray &line)
+{
+    lines++;
+    QByteArray text = line.trimmed();
+    if (text.isEmpty())
+        return;
+    Job job;
+    job.line = lines;
+    QString error;
+    QVariant data = Json::parse(text, &error);
+    if (!error.isEmpty() || data.type() != QVariant::Map) {
+        fail(job, error.isEmpty() ? QString("A job should be a JSON object.") : "The job is not valid JSON: " + error);
+        return;
+    }
+    QVariantMap map = data.toMap();
+    job.id = map.value("id");
+    if (!jobArguments(map, &job.args, &error)) {
+        fail(job, error);
+        return;
+    }
+    pending.enqueue(job);
+    startNext();
+}
+
+/*
+ * Stdin was closed, so exit once the jobs already read are done
+ */
+void StdinRunner::inputClosed()
+{
+    closed = true;
+    startNext();
+}
+
+/*
+ * Start printing the next job if we are idle
+ */
+void StdinRunner::startNext()
+{
+    while (!engine && !pending.isEmpty()) {
+        current = pending.dequeue();
+
+        CommandLine cmd;
+        if (!cmd.parse(defaults + current.args)) {
+            fail(current, cmd.errorText);
+            continue;
+        }
+        if (cmd.serverMode || cmd.daemonMode || cmd.workerMode || cmd.stdinMode) {
+            fail(current, "Jobs read from stdin can only print URLs.");
+            continue;
+        }
+        if (cmd.urls.isEmpty()) {
+            fail(current, "The job has no URLs to print.");
+            continue;
+        }
+        if (!cmd.mergeFile.isEmpty() && !cmd.loadMergeRecords()) {
+            fail(current, cmd.errorText);
+            continue;
+        }
+
+        // Always collect JSON results, so a URL that fails doesn't end the job
+        engine = new PrintHtml(cmd.testMode, true, cmd.urls, cmd.options, false);
+        engine->setInteractive(false);
+        engine->setPolicy(cmd.policy);
+        engine->setLoadOptions(cmd.load);
+        if (!cmd.mergeFile.isEmpty())
+            engine->setMergeRecords(cmd.mergeRecords);
+        if (!cmd.traceFile.isEmpty()) {
+            engine->setTracing(int(QCoreApplication::applicationPid()), "PrintHtml");
+            traceFile = QFileInfo(cmd.traceFile).absoluteFilePath();
+        }
+        engine->setConcurrency(cmd.concurrency);
+        engine->setPagePool(&pagePool);
+        engine->setPrinterCache(&printerCache);
+        connect(engine, SIGNAL(finished()), this, SLOT(jobFinished()));
+        QTimer::singleShot(0, engine, SLOT(run()));
+    }
+    if (!engine && closed)
+        QCoreApplication::exit(0);
+}
+
+/*
+ * Write the result of the job that just finished and start the next one
+ */
+void StdinRunner::jobFinished()
+{
+    if (!engine)
+        return;
+    if (!traceFile.isEmpty())
+        Trace::write(traceFile, engine->traceEvents());
+    traceFile.clear();
+
+    QVariantMap result;
+    result.insert("exitCode", engine->exitCode());
+    result.insert("success", engine->printedUrls());
+    result.insert("error", engine->failedUrls());
+    QVariantList failures = engine->failures();
+    if (!failures.isEmpty())
+        result.insert("failures", failures);
+    QVariantList files = engine->outputFiles();
+    if (!files.isEmpty())
+        result.insert("files", files);
+    QVariantMap cache;
+    cache.insert("hits", engine->cacheStats().hits);
+    cache.insert("misses", engine->cacheStats().misses);
+    result.insert("cache", cache);
+    CacheStats renders = engine->renderStats();
+    if (renders.hits + renders.misses > 0) {
+        QVariantMap renderStats;
+        renderStats.insert("hits", renders.hits);
+        renderStats.insert("misses", renders.misses);
+        result.insert("renders", renderStats);
+    }
+    result.insert("blocked", engine->blockedCount());
+    result.insert("timings", engine->timings());
+    if (!engine->messageText().isEmpty())
+        result.insert("message", engine->messageText());
+    writeResult(current, result);
+
+    // We are called from inside the engine, so let it unwind before it goes
+    engine->deleteLater();
+    engine = 0;
+    current = Job();
+    startNext();
+}
+
+/*
+ * Write the result for a job that could not be started
+ *
+ * PARAMETERS:
+ * job      - Job that failed
+ * message  - Why it failed
+ */
+void StdinRunner::fail(
+    const Job &job,
+    const QString &message)
+{
+    QVariantMap result;
+    result.insert("exitCode", -1);
+    result.insert("success", QStringList());
+    result.insert("error", QStringList());
+    result.insert("message", message);
+    writeResult(job, result);
+}
+
+/*
+ * Write one result line to stdout, tagged with the job's line and id
+ *
+ * PARAMETERS:
+ * job      - Job the result is for
+ * result   - Result of the job
+ */
+void StdinRunner::writeResult(
+    const Job &job,
+    const QVariantMap &result)
+{
+    QVariantMap line = result;
+    line.insert("line", job.line);
+    if (job.id.isValid())
+        line.insert("id", job.id);
+    QByteArray text = Json::stringify(line) + "\n";
+    fwrite(text.constData(), 1, text.size(), stdout);
+    fflush(stdout);
+}
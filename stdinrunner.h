@@ -0,0 +1,106 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef STDINRUNNER_H
+#define STDINRUNNER_H
+
+#include <QObject>
+#include <QThread>
+#include <QQueue>
+#include <QStringList>
+#include <QVariantMap>
+#include "webpagepool.h"
+#include "printercache.h"
+
+class PrintHtml;
+
+/*
+ * Reads stdin one line at a time. Qt has no portable way to wait for input
+ * on stdin without blocking (a socket notifier doesn't work on a Windows
+ * console or pipe), so the blocking reads are done in their own thread and
+ * each line is handed to the main thread as a signal.
+ */
+class StdinReader : public QThread
+{
+    Q_OBJECT
+public:
+    explicit StdinReader(QObject *parent = 0) : QThread(parent) {}
+
+signals:
+    void lineRead(const QByteArray &line);
+
+protected:
+    void run();
+};
+
+/*
+ * Prints jobs read from stdin, one JSON object per line, and writes one JSON
+ * result line to stdout for each as it finishes. Jobs take the same options
+ * as the command line and are printed one at a time in the order they are
+ * read, using warm pages and cached printers, so a local integration pays
+ * for starting WebKit once rather than once per document. Exits once stdin
+ * is closed and the last job has finished.
+ */
+class StdinRunner : public QObject
+{
+    Q_OBJECT
+public:
+    StdinRunner(const QStringList &defaults, int poolSize, QObject *parent = 0);
+
+    void start();
+
+    static bool jobArguments(const QVariantMap &job, QStringList *args, QString *error);
+
+private slots:
+    void readJob(const QByteArray &line);
+    void inputClosed();
+    void jobFinished();
+
+private:
+    struct Job {
+        int         line;       // Line of stdin the job was read from
+        QVariant    id;         // Id the caller gave the job, echoed in the result
+        QStringList args;       // Job's options as command line arguments
+
+        Job() : line(0) {}
+    };
+
+    void startNext();
+    void fail(const Job &job, const QString &message);
+    void writeResult(const Job &job, const QVariantMap &result);
+
+    StdinReader     reader;
+    QStringList     defaults;   // Options from our own command line every job starts from
+    int             lines;      // Lines read so far
+    bool            closed;     // True once stdin has been closed
+    QQueue<Job>     pending;    // Jobs waiting for their turn
+    Job             current;    // Job being printed, if any
+    PrintHtml       *engine;
+    QString         traceFile;  // Where to write the trace of the current job, if asked for
+    WebPagePool     pagePool;
+    PrinterCache    printerCache;
+};
+
+#endif // STDINRUNNER_H
@@ -0,0 +1,182 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "trace.h"
+#include "json.h"
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+
+/*
+ * Return the time in microseconds since the epoch. The wall clock is only
+ * read once, after that the time comes from the monotonic clock.
+ */
+qint64 Trace::now()
+{
+    static qint64 base = QDateTime::currentMSecsSinceEpoch() * 1000;
+    static QElapsedTimer clock;
+    if (!clock.isValid())
+        clock.start();
+    return base + clock.nsecsElapsed() / 1000;
+}
+
+/*
+ * Create an event for something that took from start to end
+ *
+ * PARAMETERS:
+ * process  - Job the event belongs to
+ * thread   - Document the event belongs to, 0 for the job itself
+ * name     - What took the time
+ * start    - When it started, from now()
+ * end      - When it ended, from now()
+ * args     - Details shown with the event
+ */
+QVariantMap Trace::span(
+    int process,
+    int thread,
+    const QString &name,
+    qint64 start,
+    qint64 end,
+    const QVariantMap &args)
+{
+    QVariantMap event;
+    event.insert("name", name);
+    event.insert("cat", "job");
+    event.insert("ph", "X");
+    event.insert("ts", start);
+    event.insert("dur", qMax(end - start, qint64(0)));
+    event.insert("pid", process);
+    event.insert("tid", thread);
+    if (!args.isEmpty())
+        event.insert("args", args);
+    return event;
+}
+
+/*
+ * Create the events for a network request. Requests overlap, so they are
+ * async events with a begin and an end rather than one span, and go on their
+ * own tracks in the viewer. They belong to no job until place()d.
+ *
+ * PARAMETERS:
+ * id       - Number unique to the request
+ * name     - URL requested
+ * start    - When the request was made, from now()
+ * end      - When it finished, from now()
+ * args     - Details shown with the request
+ */
+QVariantList Trace::request(
+    int id,
+    const QString &name,
+    qint64 start,
+    qint64 end,
+    const QVariantMap &args)
+{
+    QVariantMap begin;
+    begin.insert("name", name);
+    begin.insert("cat", "network");
+    begin.insert("ph", "b");
+    begin.insert("id", id);
+    begin.insert("ts", start);
+    begin.insert("args", args);
+    QVariantMap finish = begin;
+    finish.insert("ph", "e");
+    finish.insert("ts", qMax(end, start));
+    finish.remove("args");
+    return QVariantList() << begin << finish;
+}
+
+/*
+ * Move events to the given job and document
+ */
+QVariantList Trace::place(
+    QVariantList events,
+    int process,
+    int thread)
+{
+    for (int i = 0; i < events.size(); i++) {
+        QVariantMap event = events.at(i).toMap();
+        event.insert("pid", process);
+        event.insert("tid", thread);
+        events[i] = event;
+    }
+    return events;
+}
+
+/*
+ * Create the event naming a job in the viewer
+ */
+QVariantMap Trace::processName(
+    int process,
+    const QString &name)
+{
+    QVariantMap args;
+    args.insert("name", name);
+    QVariantMap event;
+    event.insert("name", "process_name");
+    event.insert("ph", "M");
+    event.insert("pid", process);
+    event.insert("args", args);
+    return event;
+}
+
+/*
+ * Create the event naming a document of a job in the viewer
+ */
+QVariantMap Trace::threadName(
+    int process,
+    int thread,
+    const QString &name)
+{
+    QVariantMap event = processName(process, name);
+    event.insert("name", "thread_name");
+    event.insert("tid", thread);
+    return event;
+}
+
+/*
+ * Return the events as a trace file
+ */
+QByteArray Trace::toJson(
+    const QVariantList &events)
+{
+    QVariantMap trace;
+    trace.insert("traceEvents", events);
+    trace.insert("displayTimeUnit", "ms");
+    return Json::stringify(trace);
+}
+
+/*
+ * Write the events to a trace file. Returns false if the file can't be
+ * written.
+ */
+bool Trace::write(
+    const QString &path,
+    const QVariantList &events)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    return file.write(toJson(events)) >= 0;
+}
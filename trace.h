@@ -0,0 +1,53 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <QVariantList>
+#include <QVariantMap>
+
+/*
+ * Timeline of what a job spent its time on, as trace event JSON that
+ * chrome://tracing and Perfetto open. Events are timed in microseconds since
+ * the epoch, so the events recorded by worker processes line up with the
+ * server's. Each job is a process in the viewer and each of its documents a
+ * thread, with thread 0 for the job itself.
+ */
+class Trace
+{
+public:
+    static qint64 now();
+    static QVariantMap span(int process, int thread, const QString &name, qint64 start, qint64 end, const QVariantMap &args = QVariantMap());
+    static QVariantList request(int id, const QString &name, qint64 start, qint64 end, const QVariantMap &args);
+    static QVariantList place(QVariantList events, int process, int thread);
+    static QVariantMap processName(int process, const QString &name);
+    static QVariantMap threadName(int process, int thread, const QString &name);
+    static QByteArray toJson(const QVariantList &events);
+    static bool write(const QString &path, const QVariantList &events);
+};
+
+#endif // TRACE_H
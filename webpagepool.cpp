@@ -0,0 +1,232 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "webpagepool.h"
+#include "resourcepolicy.h"
+#include "processmemory.h"
+#include <QWebPage>
+#include <QWebFrame>
+#include <QWebHistory>
+#include <QTimer>
+#include <QMetaMethod>
+
+// Blank document used to warm up new pages and to reset returned ones
+static const char *BLANK_DOCUMENT = "<html><body></body></html>";
+
+// Seconds between giving memory back, as the process rarely shrinks right away
+static const int SHRINK_INTERVAL = 60;
+
+/*
+ * Drop the connections a job made to the page's signals. destroyed() is left
+ * alone, as the network manager listens for it to forget the page.
+ */
+static void disconnectJob(
+    QObject *page)
+{
+    const QMetaObject *meta = page->metaObject();
+    for (int i = 0; i < meta->methodCount(); i++) {
+        QMetaMethod method = meta->method(i);
+        if (method.methodType() != QMetaMethod::Signal || QByteArray(method.signature()).startsWith("destroyed("))
+            continue;
+        QObject::disconnect(page, QByteArray("2" + QByteArray(method.signature())).constData(), 0, 0);
+    }
+}
+
+int WebPagePool::maxPageUses = 0;
+qint64 WebPagePool::maxResidentBytes = 0;
+
+/*
+ * Constructor for the web page pool
+ *
+ * PARAMETERS:
+ * size     - Maximum number of idle pages to keep ready
+ * parent   - Parent object
+ */
+WebPagePool::WebPagePool(
+    int size,
+    QObject *parent)
+    : QObject(parent), maxIdle(qMax(0, size)), pagesCreated(0), pagesRecycled(0)
+{
+}
+
+/*
+ * Set when pages are recycled, for every pool in the process
+ *
+ * PARAMETERS:
+ * maxUses      - Jobs a page may print before it is thrown away, 0 for no
+ *                limit
+ * maxResident  - Bytes of memory the process may have resident before all
+ *                the pages and WebKit's memory caches are thrown away, 0 for
+ *                no limit
+ */
+void WebPagePool::setRecycling(
+    int maxUses,
+    qint64 maxResident)
+{
+    maxPageUses = qMax(0, maxUses);
+    maxResidentBytes = qMax(qint64(0), maxResident);
+}
+
+/*
+ * Destructor. Pages still lent out belong to their jobs until returned, so
+ * we only clean up the ones we are holding on to.
+ */
+WebPagePool::~WebPagePool()
+{
+    qDeleteAll(idle);
+    qDeleteAll(resetting);
+    foreach (QWebPage *page, busy)
+        page->deleteLater();
+}
+
+/*
+ * Fill the pool up to its size with pages that have already loaded a blank
+ * document, so the first WebKit initialization is not paid by a print job.
+ */
+void WebPagePool::warm()
+{
+    while (idle.size() + resetting.size() < maxIdle)
+        resetPage(createPage());
+}
+
+/*
+ * Change the maximum number of idle pages, dropping any extra idle pages
+ */
+void WebPagePool::setSize(
+    int size)
+{
+    maxIdle = qMax(0, size);
+    while (idle.size() > maxIdle)
+        deletePage(idle.takeLast());
+}
+
+/*
+ * Borrow a page from the pool. If no warm page is ready a new one is created,
+ * so callers never have to wait.
+ */
+QWebPage *WebPagePool::acquire()
+{
+    QWebPage *page = idle.isEmpty() ? createPage() : idle.takeFirst();
+    busy.insert(page);
+    uses[page]++;
+    return page;
+}
+
+/*
+ * Return a page to the pool. The page is reset to a blank document and any
+ * connections the job made to it are dropped. If the pool is already full,
+ * or the page has printed as many jobs as it may, the page is destroyed.
+ */
+void WebPagePool::release(
+    QWebPage *page)
+{
+    if (!page || !busy.remove(page))
+        return;
+    disconnectJob(page);
+    page->mainFrame()->disconnect();
+    page->triggerAction(QWebPage::Stop);
+    if (shrink() || (maxPageUses > 0 && uses.value(page) >= maxPageUses)) {
+        pagesRecycled++;
+        deletePage(page);
+        return;
+    }
+    if (idle.size() + resetting.size() >= maxIdle) {
+        deletePage(page);
+        return;
+    }
+    page->history()->clear();
+    ResourcePolicy::reset(page);
+    resetPage(page);
+}
+
+/*
+ * Give memory back if the process has grown past its limit, by throwing away
+ * the idle pages and emptying WebKit's memory caches. The pool is filled with
+ * new pages once we are back in the event loop. Memory is rarely returned to
+ * the system straight away, so we wait a while before trying again. Returns
+ * true if we did, in which case the page being returned goes too.
+ */
+bool WebPagePool::shrink()
+{
+    if (maxResidentBytes <= 0 || (lastShrink.isValid() && lastShrink.elapsed() < SHRINK_INTERVAL * 1000))
+        return false;
+    if (ProcessMemory::resident() <= maxResidentBytes)
+        return false;
+    lastShrink.start();
+    pagesRecycled += idle.size();
+    while (!idle.isEmpty())
+        deletePage(idle.takeFirst());
+    ProcessMemory::clearWebKitCaches();
+    QTimer::singleShot(0, this, SLOT(warm()));
+    return true;
+}
+
+/*
+ * Destroy a page once we are back in the event loop
+ */
+void WebPagePool::deletePage(
+    QWebPage *page)
+{
+    uses.remove(page);
+    page->deleteLater();
+}
+
+/*
+ * Create a new page for the pool
+ */
+QWebPage *WebPagePool::createPage()
+{
+    pagesCreated++;
+    return new QWebPage();
+}
+
+/*
+ * Load the blank document into the page. The page is only handed out again
+ * once this load has finished, so a late loadFinished() signal from the reset
+ * can never be mistaken for the next job's page load.
+ */
+void WebPagePool::resetPage(
+    QWebPage *page)
+{
+    resetting.insert(page);
+    connect(page, SIGNAL(loadFinished(bool)), this, SLOT(pageReset(bool)));
+    page->mainFrame()->setHtml(BLANK_DOCUMENT);
+}
+
+/*
+ * Called when a page has finished loading the blank document
+ */
+void WebPagePool::pageReset(
+    bool)
+{
+    QWebPage *page = qobject_cast<QWebPage*>(sender());
+    if (!page || !resetting.remove(page))
+        return;
+    page->disconnect(this);
+    if (idle.size() >= maxIdle)
+        deletePage(page);
+    else
+        idle.append(page);
+}
@@ -0,0 +1,91 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WEBPAGEPOOL_H
+#define WEBPAGEPOOL_H
+
+#include <QObject>
+#include <QList>
+#include <QSet>
+#include <QHash>
+#include <QElapsedTimer>
+
+class QWebPage;
+
+/*
+ * Pool of pre-created web pages that print jobs borrow and give back. Pages
+ * are reset to a blank document when they are returned, and only become
+ * available again once that reset load has completed. WebKit never gives
+ * back all of what a page used, so pages are thrown away after so many jobs,
+ * and all of them along with WebKit's memory caches if the process grows past
+ * its memory limit. The limits are the same for every pool in the process.
+ */
+class WebPagePool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit WebPagePool(int size = 2, QObject *parent = 0);
+    ~WebPagePool();
+
+    QWebPage *acquire();
+    void release(QWebPage *page);
+
+    int size() const        { return maxIdle; }
+    void setSize(int size);
+    int idleCount() const   { return idle.size(); }
+    int busyCount() const   { return busy.size(); }
+    int created() const     { return pagesCreated; }
+    int recycled() const    { return pagesRecycled; }
+
+    static void setRecycling(int maxUses, qint64 maxResident);
+    static int maxUses()    { return maxPageUses; }
+    static qint64 maxResident() { return maxResidentBytes; }
+
+public slots:
+    void warm();
+
+private slots:
+    void pageReset(bool ok);
+
+private:
+    QWebPage *createPage();
+    void resetPage(QWebPage *page);
+    void deletePage(QWebPage *page);
+    bool shrink();
+
+    int             maxIdle;        // Maximum number of idle pages kept around
+    int             pagesCreated;   // Total number of pages ever created
+    int             pagesRecycled;  // Pages thrown away for their use count or memory
+    QHash<QWebPage*, int> uses;     // Jobs each page has been lent to
+    QElapsedTimer   lastShrink;     // Time since we last gave memory back
+    QList<QWebPage*> idle;          // Pages ready to be handed out
+    QSet<QWebPage*> resetting;      // Pages waiting for their reset to finish
+    QSet<QWebPage*> busy;           // Pages currently lent out to a job
+
+    static int      maxPageUses;    // Jobs a page may print before it is recycled, 0 for no limit
+    static qint64   maxResidentBytes; // Process size that makes us give memory back, 0 for no limit
+};
+
+#endif // WEBPAGEPOOL_H
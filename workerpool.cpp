@@ -0,0 +1,515 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "workerpool.h"
+#include "jobqueue.h"
+#include "printhtml.h"
+#include "processmemory.h"
+#include <QCoreApplication>
+#include <QDataStream>
+#include <QTimer>
+#include <QtEndian>
+
+/*
+ * Constructor for the worker pool
+ *
+ * PARAMETERS:
+ * count        - Number of worker processes to run
+ * arguments    - Extra command line arguments to start the workers with
+ * jobTimeout   - Seconds a job may take before its worker is restarted
+ * parent       - Parent object
+ */
+WorkerPool::WorkerPool(
+    int count,
+    const QStringList &arguments,
+    int jobTimeout,
+    QObject *parent)
+    : QObject(parent), arguments(arguments), jobTimeout(jobTimeout), restartCount(0)
+{
+    for (int i = 0; i < count; i++) {
+        WorkerProcess *worker = new WorkerProcess;
+        worker->index = i;
+        worker->process = new QProcess(this);
+        worker->process->setProcessChannelMode(QProcess::ForwardedChannels);
+        worker->socket = 0;
+        worker->job = 0;
+        worker->rss = 0;
+        worker->timer = new QTimer(this);
+        worker->timer->setSingleShot(true);
+        connect(worker->process, SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(workerExited()));
+        connect(worker->process, SIGNAL(error(QProcess::ProcessError)), this, SLOT(workerExited()));
+        connect(worker->timer, SIGNAL(timeout()), this, SLOT(jobTimedOut()));
+        workers.append(worker);
+    }
+    connect(&server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+}
+
+/*
+ * Destructor. Stops all the worker processes.
+ */
+WorkerPool::~WorkerPool()
+{
+    foreach (WorkerProcess *worker, workers) {
+        worker->process->disconnect(this);
+        worker->process->kill();
+        worker->process->waitForFinished(1000);
+        delete worker;
+    }
+}
+
+/*
+ * Start listening for the workers and start the worker processes
+ */
+bool WorkerPool::start()
+{
+    serverName = QString("PrintHtml-%1").arg(QCoreApplication::applicationPid());
+    QLocalServer::removeServer(serverName);
+    if (!server.listen(serverName))
+        return false;
+    foreach (WorkerProcess *worker, workers)
+        spawn(worker);
+    return true;
+}
+
+/*
+ * Start a worker process
+ */
+void WorkerPool::spawn(
+    WorkerProcess *worker)
+{
+    QStringList args = arguments;
+    args << "-worker" << serverName << QString::number(worker->index);
+    worker->rss = 0;
+    worker->process->start(QCoreApplication::applicationFilePath(), args);
+}
+
+/*
+ * Number of workers that are printing a job
+ */
+int WorkerPool::busyCount() const
+{
+    int count = 0;
+    foreach (WorkerProcess *worker, workers) {
+        if (worker->job)
+            count++;
+    }
+    return count;
+}
+
+/*
+ * Memory the workers had resident after their last jobs, in total
+ */
+qint64 WorkerPool::residentBytes() const
+{
+    qint64 total = 0;
+    foreach (WorkerProcess *worker, workers)
+        total += worker->rss;
+    return total;
+}
+
+/*
+ * Hand a job to the next idle worker, or queue it until one is free
+ */
+void WorkerPool::dispatch(
+    PrintJob *job,
+    bool testMode)
+{
+    if (testMode)
+        testJobs.insert(job->id);
+    pending.enqueue(job);
+    dispatchPending();
+}
+
+/*
+ * Send waiting jobs to any idle workers
+ */
+void WorkerPool::dispatchPending()
+{
+    foreach (WorkerProcess *worker, workers) {
+        if (pending.isEmpty())
+            return;
+        if (!worker->socket || worker->job)
+            continue;
+        PrintJob *job = pending.dequeue();
+        QVariantMap message;
+        message.insert("type", "job");
+        message.insert("id", job->id);
+        message.insert("urls", job->urls);
+        message.insert("options", job->options.toMap());
+        message.insert("policy", job->policy.toMap());
+        message.insert("load", job->load.toMap());
+        message.insert("test", testJobs.remove(job->id));
+        if (job->traced)
+            message.insert("trace", true);
+        if (!job->html.isEmpty()) {
+            QVariantMap html;
+            QVariantMap baseUrls;
+            foreach (int index, job->html.keys()) {
+                html.insert(QString::number(index), job->html.value(index));
+                baseUrls.insert(QString::number(index), job->baseUrls.value(index));
+            }
+            message.insert("html", html);
+            message.insert("baseUrls", baseUrls);
+        }
+        if (!job->records.isEmpty())
+            message.insert("records", job->records);
+        worker->job = job;
+        if (jobTimeout > 0)
+            worker->timer->start(jobTimeout * 1000);
+        writeMessage(worker->socket, message);
+    }
+}
+
+/*
+ * A worker process has connected to us. We don't know which one it is until
+ * it sends its hello message.
+ */
+void WorkerPool::newConnection()
+{
+    while (QLocalSocket *socket = server.nextPendingConnection()) {
+        connect(socket, SIGNAL(readyRead()), this, SLOT(workerMessage()));
+        connect(socket, SIGNAL(disconnected()), this, SLOT(workerDisconnected()));
+        unknown.insert(socket, QByteArray());
+    }
+}
+
+/*
+ * Handle messages from a worker process
+ */
+void WorkerPool::workerMessage()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    if (!socket)
+        return;
+
+    // Match up new connections with their worker
+    if (unknown.contains(socket)) {
+        QByteArray &buffer = unknown[socket];
+        QList<QVariantMap> messages = readMessages(socket, buffer);
+        if (messages.isEmpty())
+            return;
+        int index = messages.first().value("index").toInt();
+        if (messages.first().value("type") != "hello" || index < 0 || index >= workers.size()) {
+            unknown.remove(socket);
+            socket->abort();
+            return;
+        }
+        workers[index]->socket = socket;
+        workers[index]->buffer = unknown.take(socket);
+        dispatchPending();
+        return;
+    }
+
+    WorkerProcess *worker = workerFor(socket);
+    if (!worker)
+        return;
+    foreach (const QVariantMap &message, readMessages(socket, worker->buffer)) {
+        if (!worker->job || message.value("id").toInt() != worker->job->id)
+            continue;
+        if (message.value("type") == "event") {
+            QVariantMap event = message;
+            event.remove("type");
+            emit jobEvent(worker->job->id, event);
+            continue;
+        }
+        if (message.value("type") != "result")
+            continue;
+        PrintJob *job = worker->job;
+        worker->job = 0;
+        worker->rss = message.value("rss").toLongLong();
+        worker->timer->stop();
+        emit jobFinished(job->id, message);
+    }
+    dispatchPending();
+}
+
+/*
+ * A worker's connection dropped. It is no longer used for new jobs, and the
+ * job it was printing is failed once the process has exited.
+ */
+void WorkerPool::workerDisconnected()
+{
+    QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+    if (!socket)
+        return;
+    unknown.remove(socket);
+    WorkerProcess *worker = workerFor(socket);
+    if (worker)
+        worker->socket = 0;
+    socket->deleteLater();
+}
+
+/*
+ * A worker process has exited or failed to start. Fail the job it was
+ * printing and start a new worker shortly.
+ */
+void WorkerPool::workerExited()
+{
+    WorkerProcess *worker = workerFor(sender());
+    if (!worker || worker->process->state() != QProcess::NotRunning)
+        return;
+    if (worker->socket) {
+        worker->socket->disconnect(this);
+        worker->socket->deleteLater();
+        worker->socket = 0;
+    }
+    worker->buffer.clear();
+    failJob(worker, "worker process exited");
+    restartCount++;
+
+    // Wait a moment before restarting, so a worker that keeps crashing
+    // doesn't keep us busy
+    QTimer::singleShot(1000, this, SLOT(spawnDead()));
+}
+
+/*
+ * A worker has taken too long over a job. Kill the worker and fail the job,
+ * it gets restarted when it has exited. The worker is cut off first, as
+ * failing the job starts the next one, which must not go to the hung worker.
+ */
+void WorkerPool::jobTimedOut()
+{
+    WorkerProcess *worker = workerFor(sender());
+    if (!worker)
+        return;
+    if (worker->socket) {
+        worker->socket->disconnect(this);
+        worker->socket->abort();
+        worker->socket->deleteLater();
+        worker->socket = 0;
+    }
+    worker->buffer.clear();
+    worker->process->kill();
+    failJob(worker, "worker timed out");
+}
+
+/*
+ * Restart any worker processes that are not running
+ */
+void WorkerPool::spawnDead()
+{
+    foreach (WorkerProcess *worker, workers) {
+        if (worker->process->state() == QProcess::NotRunning)
+            spawn(worker);
+    }
+}
+
+/*
+ * Report the worker's job as failed
+ */
+void WorkerPool::failJob(
+    WorkerProcess *worker,
+    const QString &message)
+{
+    worker->timer->stop();
+    if (!worker->job)
+        return;
+    PrintJob *job = worker->job;
+    worker->job = 0;
+    QVariantMap result;
+    result.insert("error", job->urls);
+    result.insert("message", message);
+    emit jobFinished(job->id, result);
+}
+
+/*
+ * Find the worker that owns the process, socket or timer
+ */
+WorkerPool::WorkerProcess *WorkerPool::workerFor(
+    QObject *object) const
+{
+    foreach (WorkerProcess *worker, workers) {
+        if (worker->process == object || worker->socket.data() == object || worker->timer == object)
+            return worker;
+    }
+    return 0;
+}
+
+/*
+ * Write a length prefixed message to the device
+ */
+void WorkerPool::writeMessage(
+    QIODevice *device,
+    const QVariantMap &message)
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_4_8);
+    stream << quint32(0) << message;
+    qToBigEndian<quint32>(data.size() - sizeof(quint32), (uchar *)data.data());
+    device->write(data);
+}
+
+/*
+ * Read all the complete messages available on the device. Anything left
+ * over is kept in the buffer until the rest of it arrives.
+ */
+QList<QVariantMap> WorkerPool::readMessages(
+    QIODevice *device,
+    QByteArray &buffer)
+{
+    QList<QVariantMap> messages;
+    buffer += device->readAll();
+    while (buffer.size() >= int(sizeof(quint32))) {
+        quint32 size = qFromBigEndian<quint32>((const uchar *)buffer.constData());
+        if (buffer.size() - int(sizeof(quint32)) < int(size))
+            break;
+        QByteArray data = buffer.mid(sizeof(quint32), size);
+        buffer.remove(0, sizeof(quint32) + size);
+        QDataStream stream(data);
+        stream.setVersion(QDataStream::Qt_4_8);
+        QVariantMap message;
+        stream >> message;
+        messages.append(message);
+    }
+    return messages;
+}
+
+/*
+ * Constructor for the worker side of the pool
+ *
+ * PARAMETERS:
+ * serverName   - Name of the local server to connect to
+ * index        - Index of this worker in the pool
+ * poolSize     - Number of warm web pages to keep ready
+ * parent       - Parent object
+ */
+Worker::Worker(
+    const QString &serverName,
+    int index,
+    int poolSize,
+    QObject *parent)
+    : QObject(parent), serverName(serverName), index(index), jobId(0), engine(0), pagePool(poolSize)
+{
+    connect(&socket, SIGNAL(readyRead()), this, SLOT(readJob()));
+    connect(&socket, SIGNAL(disconnected()), this, SLOT(serverGone()));
+}
+
+/*
+ * Connect to the server and tell it which worker we are
+ */
+bool Worker::start()
+{
+    socket.connectToServer(serverName);
+    if (!socket.waitForConnected(5000))
+        return false;
+    pagePool.warm();
+    QVariantMap hello;
+    hello.insert("type", "hello");
+    hello.insert("index", index);
+    WorkerPool::writeMessage(&socket, hello);
+    return true;
+}
+
+/*
+ * Start printing a job sent to us by the server. The server only sends a job
+ * when we are idle.
+ */
+void Worker::readJob()
+{
+    foreach (const QVariantMap &message, WorkerPool::readMessages(&socket, buffer)) {
+        if (message.value("type") != "job" || engine)
+            continue;
+        jobId = message.value("id").toInt();
+        PrintOptions options = PrintOptions::fromMap(message.value("options").toMap());
+        engine = new PrintHtml(message.value("test").toBool(), true, message.value("urls").toStringList(), options, false);
+        QVariantMap html = message.value("html").toMap();
+        QVariantMap baseUrls = message.value("baseUrls").toMap();
+        for (QVariantMap::const_iterator it = html.constBegin(); it != html.constEnd(); ++it)
+            engine->setHtml(it.key().toInt(), it.value().toString(), QUrl(baseUrls.value(it.key()).toString()));
+        if (message.contains("records"))
+            engine->setMergeRecords(message.value("records").toList());
+        engine->setPolicy(ResourcePolicy::fromMap(message.value("policy").toMap()));
+        engine->setLoadOptions(LoadOptions::fromMap(message.value("load").toMap()));
+        engine->setPagePool(&pagePool);
+        engine->setPrinterCache(&printerCache);
+        if (message.value("trace").toBool())
+            engine->setTracing(jobId, QString("job %1").arg(jobId));
+        connect(engine, SIGNAL(finished()), this, SLOT(jobFinished()));
+        connect(engine, SIGNAL(documentEvent(int,QString,QString)), this, SLOT(documentEvent(int,QString,QString)));
+        QTimer::singleShot(0, engine, SLOT(run()));
+    }
+}
+
+/*
+ * Pass progress on the job's documents on to the server as it happens
+ */
+void Worker::documentEvent(
+    int index,
+    const QString &url,
+    const QString &event)
+{
+    QVariantMap message;
+    message.insert("type", "event");
+    message.insert("id", jobId);
+    message.insert("index", index);
+    message.insert("url", url);
+    message.insert("event", event);
+    WorkerPool::writeMessage(&socket, message);
+}
+
+/*
+ * Send the result of the job back to the server
+ */
+void Worker::jobFinished()
+{
+    if (!engine)
+        return;
+    CacheStats cache = engine->cacheStats();
+    QVariantMap stats;
+    stats.insert("hits", cache.hits);
+    stats.insert("misses", cache.misses);
+    QVariantMap result;
+    result.insert("type", "result");
+    result.insert("id", jobId);
+    result.insert("success", engine->printedUrls());
+    result.insert("error", engine->failedUrls());
+    result.insert("cache", stats);
+    CacheStats renders = engine->renderStats();
+    QVariantMap renderStats;
+    renderStats.insert("hits", renders.hits);
+    renderStats.insert("misses", renders.misses);
+    result.insert("renders", renderStats);
+    result.insert("blocked", engine->blockedCount());
+    result.insert("failures", engine->failures());
+    result.insert("files", engine->outputFiles());
+    result.insert("timings", engine->timings());
+    if (!engine->traceEvents().isEmpty())
+        result.insert("trace", engine->traceEvents());
+    result.insert("rss", ProcessMemory::resident());
+    WorkerPool::writeMessage(&socket, result);
+
+    // We are called from inside the engine, so let it unwind before it goes
+    engine->deleteLater();
+    engine = 0;
+}
+
+/*
+ * The server has gone away, so there is nothing left for us to do
+ */
+void Worker::serverGone()
+{
+    QCoreApplication::exit(0);
+}
@@ -0,0 +1,138 @@
+/*
+ * MIT License
+ *
+ * Copyright (C) 2017 Kendall Bennett
+ * Copyright (C) 2017 AMain.com, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QSet>
+#include <QQueue>
+#include <QStringList>
+#include <QVariantMap>
+#include <QProcess>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
+#include "webpagepool.h"
+#include "printercache.h"
+
+class QTimer;
+class PrintHtml;
+struct PrintJob;
+
+/*
+ * Pool of worker processes that render and print jobs for the REST server.
+ * WebKit only runs on the main thread, so to use more than one core the
+ * server hands jobs to worker processes, each with its own engine, over
+ * local sockets. Workers that crash or stop responding are restarted.
+ */
+class WorkerPool : public QObject
+{
+    Q_OBJECT
+public:
+    WorkerPool(int count, const QStringList &arguments, int jobTimeout, QObject *parent = 0);
+    ~WorkerPool();
+
+    bool start();
+    void dispatch(PrintJob *job, bool testMode = false);
+    int count() const       { return workers.size(); }
+    int busyCount() const;
+    int pendingCount() const { return pending.size(); }
+    int restarts() const    { return restartCount; }
+    qint64 residentBytes() const;
+
+    static void writeMessage(QIODevice *device, const QVariantMap &message);
+    static QList<QVariantMap> readMessages(QIODevice *device, QByteArray &buffer);
+
+signals:
+    void jobFinished(int id, const QVariantMap &result);
+    void jobEvent(int id, const QVariantMap &event);
+
+private slots:
+    void newConnection();
+    void workerMessage();
+    void workerDisconnected();
+    void workerExited();
+    void jobTimedOut();
+    void spawnDead();
+
+private:
+    struct WorkerProcess {
+        int         index;
+        QProcess    *process;
+        QPointer<QLocalSocket> socket; // Connection from the worker, once it said hello
+        QByteArray  buffer;     // Partially received message
+        PrintJob    *job;       // Job the worker is printing, if any
+        QTimer      *timer;     // Fires if the job takes too long
+        qint64      rss;        // Resident memory after its last job, in bytes
+    };
+
+    void spawn(WorkerProcess *worker);
+    void dispatchPending();
+    void failJob(WorkerProcess *worker, const QString &message);
+    WorkerProcess *workerFor(QObject *object) const;
+
+    QLocalServer    server;
+    QString         serverName;
+    QStringList     arguments;  // Extra arguments the workers are started with
+    int             jobTimeout; // Seconds before a busy worker is considered hung
+    int             restartCount;
+    QList<WorkerProcess*> workers;
+    QQueue<PrintJob*> pending;  // Jobs waiting for an idle worker
+    QSet<int>       testJobs;   // Ids of pending jobs to run in test mode
+    QHash<QLocalSocket*, QByteArray> unknown; // Connections that have not said hello yet
+};
+
+/*
+ * Runs inside a worker process. Receives jobs from the server over a local
+ * socket, prints them and sends back the results.
+ */
+class Worker : public QObject
+{
+    Q_OBJECT
+public:
+    Worker(const QString &serverName, int index, int poolSize, QObject *parent = 0);
+    bool start();
+
+private slots:
+    void readJob();
+    void jobFinished();
+    void documentEvent(int index, const QString &url, const QString &event);
+    void serverGone();
+
+private:
+    QLocalSocket    socket;
+    QString         serverName;
+    int             index;
+    QByteArray      buffer;
+    int             jobId;
+    PrintHtml       *engine;
+    WebPagePool     pagePool;
+    PrinterCache    printerCache;
+};
+
+#endif // WORKERPOOL_H